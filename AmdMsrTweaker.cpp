@@ -1,151 +1,315 @@
-/*
- * Copyright (c) Martin Kinkelin
- *
- * See the "License.txt" file in the root directory for infos
- * about permitted and prohibited uses of this code.
- */
-
-#include <iostream>
-#include <conio.h>
-#include "Info.h"
-#include "Worker.h"
-#include "WinRing0.h"
-
-using std::cout;
-using std::cerr;
-using std::endl;
-
-
-void PrintInfo(const Info& info);
-void WaitForKey();
-
-
-/// <summary>Entry point for the program.</summary>
-int main(int argc, const char* argv[])
-{
-	// initialize WinRing0
-	if (!InitializeOls() || GetDllStatus() != 0)
-	{
-		cerr << "ERROR: WinRing0 initialization failed" << endl;
-		DeinitializeOls();
-
-		return 1;
-	}
-
-	try
-	{
-		Info info;
-		if (!info.Initialize())
-		{
-			cout << "ERROR: unsupported CPU" << endl;
-			DeinitializeOls();
-			WaitForKey();
-			return 2;
-		}
-
-		if (argc > 1)
-		{
-			Worker worker(info);
-
-			if (!worker.ParseParams(argc, argv))
-			{
-				DeinitializeOls();
-				WaitForKey();
-				return 3;
-			}
-
-			worker.ApplyChanges();
-		}
-		else
-		{
-			PrintInfo(info);
-			WaitForKey();
-		}
-	}
-	catch (const std::exception& e)
-	{
-		cerr << "ERROR: " << e.what() << endl;
-		DeinitializeOls();
-		WaitForKey();
-		return 10;
-	}
-
-	DeinitializeOls();
-
-	return 0;
-}
-
-
-void PrintInfo(const Info& info)
-{
-	cout << endl;
-	cout << "AmdMsrTweaker v1.1" << endl;
-	cout << endl;
-
-	cout << ".:. General" << endl << "---" << endl;
-	cout << "  AMD family 0x" << std::hex << info.Family << ", model 0x" << info.Model << std::dec << " CPU, " << info.NumCores << " cores" << endl;
-	cout << "  Default reference clock: " << info.multiScaleFactor * 100 << " MHz" << endl;
-	cout << "  Available multipliers: " << (info.MinMulti / info.multiScaleFactor) << " .. " << (info.MaxSoftwareMulti / info.multiScaleFactor) << endl;
-	cout << "  Available voltage IDs: " << info.MinVID << " .. " << info.MaxVID << " (" << info.VIDStep << " steps)" << endl;
-	cout << endl;
-
-	cout << ".:. Turbo" << endl << "---" << endl;
-	if (!info.IsBoostSupported)
-		cout << "  not supported" << endl;
-	else
-	{
-		cout << "  " << (info.IsBoostEnabled ? "enabled" : "disabled") << endl;
-		cout << "  " << (info.IsBoostLocked ? "locked" : "unlocked") << endl;
-
-		if (info.MaxMulti != info.MaxSoftwareMulti)
-			cout << "  Max multiplier: " << (info.MaxMulti / info.multiScaleFactor) << endl;
-	}
-	cout << endl;
-
-	cout << ".:. P-states" << endl << "---" << endl;
-	cout << "  " << info.NumPStates << " of " << (info.Family == 0x10 ? 5 : 8) << " enabled (P0 .. P" << (info.NumPStates - 1) << ")" << endl;
-
-	if (info.IsBoostSupported && info.NumBoostStates > 0)
-	{
-		cout << "  Turbo P-states:";
-		for (int i = 0; i < info.NumBoostStates; i++)
-			cout << " P" << i;
-		cout << endl;
-	}
-
-	cout << "  ---" << endl;
-
-	for (int i = 0; i < info.NumPStates; i++)
-	{
-		const PStateInfo pi = info.ReadPState(i);
-
-		cout << "  P" << i << ": " << (pi.Multi / info.multiScaleFactor) << "x at " << info.DecodeVID(pi.VID) << "V" << endl;
-
-		if (pi.NBPState >= 0)
-		{
-			cout << "      NorthBridge in NB_P" << pi.NBPState;
-			if (pi.NBVID >= 0)
-				cout << " at " << info.DecodeVID(pi.NBVID) << "V";
-			cout << endl;
-		}
-	}
-
-	if (info.Family == 0x15)
-	{
-		cout << "  ---" << endl;
-
-		for (int i = 0; i < info.NumNBPStates; i++)
-		{
-			const NBPStateInfo pi = info.ReadNBPState(i);
-			cout << "  NB_P" << i << ": " << pi.Multi << "x at " << info.DecodeVID(pi.VID) << "V" << endl;
-		}
-	}
-}
-
-
-void WaitForKey()
-{
-	cout << endl << "Press any key to exit... ";
-	_getch();
-	cout << endl;
-}
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include <cctype>
+#include <cstring>
+#include <iostream>
+#include <conio.h>
+#include "Batch.h"
+#include "Bench.h"
+#include "Consistency.h"
+#include "Diff.h"
+#include "Exporter.h"
+#include "Experiment.h"
+#include "Hotplug.h"
+#include "Info.h"
+#include "Ladder.h"
+#include "MemBench.h"
+#include "Monitor.h"
+#include "NBGovernor.h"
+#include "PowerCap.h"
+#include "PowerPlan.h"
+#include "Profiles.h"
+#include "RecordReplay.h"
+#include "Report.h"
+#include "Sim.h"
+#include "Snapshot.h"
+#include "Sweep.h"
+#include "Trace.h"
+#include "TurboPolicy.h"
+#include "Wakeup.h"
+#include "Worker.h"
+#include "WinRing0.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+
+void WaitForKey();
+
+static bool IsCommand(int argc, const char* argv[], const char* command);
+static bool HasParam(int argc, const char* argv[], const char* key);
+static bool IsRegularParam(const char* param);
+template <typename T> static int RunCommand(const Info& info, int argc, const char* argv[]);
+static int RunOfflineLadder(int argc, const char* argv[]);
+template <typename T> static int RunOfflineCommand(int argc, const char* argv[]);
+
+
+/// <summary>Entry point for the program.</summary>
+int main(int argc, const char* argv[])
+{
+	// commands working on saved data only do not need WinRing0
+	if (IsCommand(argc, argv, "Ladder") && HasParam(argc, argv, "Snapshot"))
+		return RunOfflineLadder(argc, argv);
+	if (IsCommand(argc, argv, "Analyze"))
+		return RunOfflineCommand<TraceAnalyzer>(argc, argv);
+	if (IsCommand(argc, argv, "Replay"))
+		return RunOfflineCommand<ReplayRunner>(argc, argv);
+	if (IsCommand(argc, argv, "Bench"))
+		return RunOfflineCommand<Benchmark>(argc, argv);
+	if (IsCommand(argc, argv, "Diff"))
+		return RunOfflineCommand<SnapshotDiff>(argc, argv);
+	if (IsCommand(argc, argv, "Simulate"))
+		return RunOfflineCommand<Simulator>(argc, argv);
+
+	// "Record Log=<file> <command>" runs the command while logging all register traffic
+	vector<const char*> args(argv, argv + argc);
+	RecordingBackend recorder(GetWinRing0Backend());
+	const bool isRecording = IsCommand(argc, argv, "Record");
+	if (isRecording)
+	{
+		if (argc < 3 || _strnicmp(argv[2], "Log=", 4) != 0)
+		{
+			cerr << "ERROR: usage: Record Log=<file> [command]" << endl;
+			return 3;
+		}
+
+		args.erase(args.begin() + 1, args.begin() + 3);
+
+		// Replay re-applies the log with the Worker, other commands cannot be replayed
+		if (args.size() > 1 && !IsRegularParam(args[1]))
+		{
+			cerr << "ERROR: only regular parameter lists can be recorded, not the " << args[1] << " command" << endl;
+			return 3;
+		}
+
+		if (!recorder.Open(argv[2] + 4, vector<string>(args.begin(), args.end())))
+		{
+			cerr << "ERROR: cannot create log " << (argv[2] + 4) << endl;
+			return 4;
+		}
+
+		argc = (int)args.size();
+		argv = &args[0];
+	}
+
+	BackendScope recording(isRecording ? &recorder : NULL);
+
+	// initialize WinRing0
+	if (!InitializeOls() || GetDllStatus() != 0)
+	{
+		cerr << "ERROR: WinRing0 initialization failed" << endl;
+		DeinitializeOls();
+
+		return 1;
+	}
+
+	// named commands may run unattended (scheduled checks, batches): errors
+	// only pause for the info screen and regular parameter lists
+	const bool isInteractive = (argc <= 1 || IsRegularParam(argv[1]));
+
+	try
+	{
+		Info info;
+		if (!info.Initialize())
+		{
+			cout << "ERROR: unsupported CPU" << endl;
+			DeinitializeOls();
+			if (isInteractive)
+				WaitForKey();
+			return 2;
+		}
+
+		int result = 0;
+
+		if (IsCommand(argc, argv, "NBGov"))
+			result = RunCommand<NBGovernor>(info, argc, argv);
+		else if (IsCommand(argc, argv, "PowerCap"))
+			result = RunCommand<PowerCapGovernor>(info, argc, argv);
+		else if (IsCommand(argc, argv, "Batch"))
+			result = RunCommand<BatchRunner>(info, argc, argv);
+		else if (IsCommand(argc, argv, "Ladder"))
+			result = RunCommand<LadderGenerator>(info, argc, argv);
+		else if (IsCommand(argc, argv, "Export"))
+			result = RunCommand<Exporter>(info, argc, argv);
+		else if (IsCommand(argc, argv, "Trace"))
+			result = RunCommand<TraceRecorder>(info, argc, argv);
+		else if (IsCommand(argc, argv, "TurboPolicy"))
+			result = RunCommand<TurboPolicy>(info, argc, argv);
+		else if (IsCommand(argc, argv, "Sweep"))
+			result = RunCommand<ParetoSweep>(info, argc, argv);
+		else if (IsCommand(argc, argv, "Experiment"))
+			result = RunCommand<ABExperiment>(info, argc, argv);
+		else if (IsCommand(argc, argv, "Hotplug"))
+			result = RunCommand<HotplugDaemon>(info, argc, argv);
+		else if (IsCommand(argc, argv, "PowerPlan"))
+			result = RunCommand<PowerPlanSync>(info, argc, argv);
+		else if (IsCommand(argc, argv, "MemBench"))
+			result = RunCommand<MemoryBenchmark>(info, argc, argv);
+		else if (IsCommand(argc, argv, "Wakeup"))
+			result = RunCommand<WakeupBenchmark>(info, argc, argv);
+		else if (IsCommand(argc, argv, "Monitor"))
+			result = RunCommand<Monitor>(info, argc, argv);
+		else if (IsCommand(argc, argv, "Profiles"))
+			result = RunCommand<ProfileSwitcher>(info, argc, argv);
+		else if (IsCommand(argc, argv, "Verify"))
+			result = RunCommand<ConsistencyChecker>(info, argc, argv);
+		else if (IsCommand(argc, argv, "Info"))
+			result = RunCommand<InfoReport>(info, argc, argv);
+		else if (IsCommand(argc, argv, "Snapshot"))
+		{
+			if (argc != 3)
+			{
+				cerr << "ERROR: usage: Snapshot <file>" << endl;
+				result = 3;
+			}
+			else
+			{
+				Snapshot snapshot;
+				snapshot.Read(info);
+
+				if (!snapshot.Save(argv[2], info))
+				{
+					cerr << "ERROR: cannot write snapshot " << argv[2] << endl;
+					result = 4;
+				}
+			}
+		}
+		else if (argc > 1)
+		{
+			Worker worker(info);
+
+			if (!worker.ParseParams(argc, argv))
+				result = 3;
+			else
+				worker.ApplyChanges();
+		}
+		else
+		{
+			PrintInfo(info);
+			WaitForKey();
+		}
+
+		if (result != 0)
+		{
+			DeinitializeOls();
+			if (isInteractive)
+				WaitForKey();
+			return result;
+		}
+	}
+	catch (const std::exception& e)
+	{
+		cerr << "ERROR: " << e.what() << endl;
+		DeinitializeOls();
+		if (isInteractive)
+			WaitForKey();
+		return 10;
+	}
+
+	DeinitializeOls();
+
+	return 0;
+}
+
+
+static bool IsCommand(int argc, const char* argv[], const char* command)
+{
+	return (argc > 1 && _stricmp(argv[1], command) == 0);
+}
+
+static bool HasParam(int argc, const char* argv[], const char* key)
+{
+	const size_t length = strlen(key);
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (_strnicmp(argv[i], key, length) == 0 && argv[i][length] == '=')
+			return true;
+	}
+
+	return false;
+}
+
+static bool IsRegularParam(const char* param)
+{
+	// commands are plain words; regular parameters are "key=value" or "P<n>"
+	return (strchr(param, '=') != NULL || (tolower(param[0]) == 'p' && isdigit((unsigned char)param[1])));
+}
+
+// Runs a command implemented by a class providing ParseParams() and Run().
+template <typename T> static int RunCommand(const Info& info, int argc, const char* argv[])
+{
+	T command(info);
+
+	// the command name takes the place of the program name
+	if (!command.ParseParams(argc - 1, argv + 1))
+		return 3;
+
+	command.Run();
+	return 0;
+}
+
+static int RunOfflineLadder(int argc, const char* argv[])
+{
+	try
+	{
+		Info info;
+		LadderGenerator ladder(info);
+
+		if (!ladder.ParseParams(argc - 1, argv + 1))
+			return 3;
+
+		Snapshot snapshot;
+		if (!snapshot.Load(ladder.GetSnapshotPath().c_str(), info))
+		{
+			cerr << "ERROR: cannot load snapshot " << ladder.GetSnapshotPath().c_str() << endl;
+			return 4;
+		}
+
+		ladder.Run();
+	}
+	catch (const std::exception& e)
+	{
+		cerr << "ERROR: " << e.what() << endl;
+		return 10;
+	}
+
+	return 0;
+}
+
+// Runs a command working on saved data only (default-constructible, no Info).
+template <typename T> static int RunOfflineCommand(int argc, const char* argv[])
+{
+	try
+	{
+		T command;
+
+		if (!command.ParseParams(argc - 1, argv + 1))
+			return 3;
+
+		command.Run();
+	}
+	catch (const std::exception& e)
+	{
+		cerr << "ERROR: " << e.what() << endl;
+		return 10;
+	}
+
+	return 0;
+}
+
+
+void WaitForKey()
+{
+	cout << endl << "Press any key to exit... ";
+	_getch();
+	cout << endl;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include "WinRing0.h"
+
+
+// Implements the register access functions declared in WinRing0.h.
+// By default, WinRing0 is used; other backends record, replay or simulate
+// the register traffic. MSR and CPUID accesses refer to the logical CPU the
+// calling thread has last been switched to (see GetCurrentCPU()).
+class Backend
+{
+public:
+
+	virtual ~Backend() { }
+
+	virtual DWORD ReadPciConfig(DWORD device, DWORD function, DWORD regAddress) = 0;
+	virtual void WritePciConfig(DWORD device, DWORD function, DWORD regAddress, DWORD value) = 0;
+
+	// reads count consecutive configuration registers; WinRing0 only reads one DWORD per
+	// call, backends with bulk access to the configuration space read the block at once
+	virtual void ReadPciConfigBlock(DWORD device, DWORD function, DWORD regAddress, DWORD* values, int count)
+	{
+		for (int i = 0; i < count; i++)
+			values[i] = ReadPciConfig(device, function, regAddress + i * 4);
+	}
+
+	virtual QWORD Rdmsr(DWORD index) = 0;
+	virtual void Wrmsr(DWORD index, const QWORD& value) = 0;
+
+	virtual CpuidRegs Cpuid(DWORD index) = 0;
+
+	virtual int GetNumLogicalCPUs() = 0;
+	virtual void SwitchTo(int logicalCPUIndex) = 0;
+
+	// whether the logical CPU is currently online (hotplug)
+	virtual bool IsOnline(int logicalCPUIndex) { return logicalCPUIndex < GetNumLogicalCPUs(); }
+};
+
+
+// the backend used by the free functions (NULL: WinRing0)
+Backend* GetBackend();
+void SetBackend(Backend* backend);
+
+// the WinRing0 backend, e.g. to be wrapped by another backend
+Backend* GetWinRing0Backend();
+
+
+// Uses a backend for the lifetime of the scope.
+class BackendScope
+{
+public:
+
+	BackendScope(Backend* backend)
+		: _previous(GetBackend())
+	{
+		SetBackend(backend);
+	}
+
+	~BackendScope()
+	{
+		SetBackend(_previous);
+	}
+
+
+private:
+
+	Backend* _previous;
+
+	BackendScope(const BackendScope&);
+	BackendScope& operator=(const BackendScope&);
+};
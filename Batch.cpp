@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <io.h>
+#include <locale>
+#include "Batch.h"
+#include "Report.h"
+#include "StringUtils.h"
+#include "Worker.h"
+#include "WinRing0.h"
+
+using std::cerr;
+using std::cin;
+using std::cout;
+using std::endl;
+using std::string;
+using std::tolower;
+using std::vector;
+
+
+bool BatchRunner::ParseParams(int argc, const char* argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const string param(argv[i]);
+
+		string key, value;
+		StringUtils::SplitPair(key, value, param, '=');
+
+		if (value.empty())
+		{
+			if (_scriptPath.empty())
+			{
+				_scriptPath = param;
+				continue;
+			}
+		}
+		else
+		{
+			if (_stricmp(key.c_str(), "KeepGoing") == 0)
+			{
+				const int flag = atoi(value.c_str());
+				if (flag == 0 || flag == 1)
+				{
+					_keepGoing = (flag == 1);
+					continue;
+				}
+			}
+		}
+
+		cerr << "ERROR: invalid parameter " << param.c_str() << endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+void BatchRunner::Run()
+{
+	if (_scriptPath.empty())
+	{
+		Process(cin, _isatty(_fileno(stdin)) != 0);
+		return;
+	}
+
+	std::ifstream script(_scriptPath.c_str());
+	if (!script)
+		throw std::exception("cannot open batch script");
+
+	Process(script, false);
+}
+
+
+void BatchRunner::Process(std::istream& input, bool interactive)
+{
+	string line;
+	for (int lineNumber = 1; ; lineNumber++)
+	{
+		if (interactive)
+			cout << "> " << std::flush;
+
+		if (!std::getline(input, line))
+			break;
+
+		vector<string> tokens;
+		StringUtils::Tokenize(tokens, line, " \t\r", true);
+
+		if (tokens.empty() || tokens[0][0] == '#')
+			continue;
+
+		if (_stricmp(tokens[0].c_str(), "exit") == 0 || _stricmp(tokens[0].c_str(), "quit") == 0)
+			break;
+
+		bool success;
+		try
+		{
+			success = Execute(tokens);
+		}
+		catch (const std::exception& e)
+		{
+			cerr << "ERROR: " << e.what() << endl;
+			success = false;
+		}
+
+		if (!success)
+		{
+			if (!interactive)
+				cerr << "ERROR: line " << lineNumber << " failed: " << line.c_str() << endl;
+
+			if (!interactive && !_keepGoing)
+				throw std::exception("batch aborted");
+		}
+	}
+}
+
+
+bool BatchRunner::Execute(const vector<string>& tokens)
+{
+	const Info& info = *_info;
+	const char* verb = tokens[0].c_str();
+
+	if (_stricmp(verb, "info") == 0)
+	{
+		// refresh the boost status which may have been changed by a previous command
+		Info current = info;
+		if (!current.Initialize())
+			return false;
+
+		PrintInfo(current);
+		return true;
+	}
+
+	if (_stricmp(verb, "read") == 0)
+	{
+		Read(tokens);
+		return true;
+	}
+
+	if (_stricmp(verb, "sleep") == 0)
+	{
+		if (tokens.size() != 2 || atoi(tokens[1].c_str()) < 0)
+			return false;
+
+		Sleep(atoi(tokens[1].c_str()));
+		return true;
+	}
+
+	if (_stricmp(verb, "verify") == 0)
+	{
+		if (_lastChanges.empty())
+		{
+			cerr << "ERROR: no changes to verify" << endl;
+			return false;
+		}
+
+		vector<const char*> argv;
+		argv.push_back("");
+		for (size_t i = 0; i < _lastChanges.size(); i++)
+			argv.push_back(_lastChanges[i].c_str());
+
+		Worker worker(info);
+		if (!worker.ParseParams((int)argv.size(), &argv[0]))
+			return false;
+
+		const bool verified = worker.Verify();
+		cout << (verified ? "verified" : "verification failed") << endl;
+		return verified;
+	}
+
+	// regular command line
+	vector<const char*> argv;
+	argv.push_back("");
+	for (size_t i = 0; i < tokens.size(); i++)
+		argv.push_back(tokens[i].c_str());
+
+	Worker worker(info);
+	if (!worker.ParseParams((int)argv.size(), &argv[0]))
+		return false;
+
+	worker.ApplyChanges();
+	_lastChanges = tokens;
+
+	return true;
+}
+
+
+void BatchRunner::Read(const vector<string>& tokens) const
+{
+	const Info& info = *_info;
+
+	int first = 0, last = info.NumPStates - 1;
+	if (tokens.size() == 2 && tokens[1].length() >= 2 && tolower(tokens[1][0]) == 'p')
+		first = last = atoi(tokens[1].c_str() + 1);
+
+	if (first < 0 || last >= info.NumPStates)
+		throw std::exception("P-state index out of range");
+
+	// printed as parameters, so the output can be fed back as command
+	for (int i = first; i <= last; i++)
+	{
+		const PStateInfo psi = info.ReadPState(i);
+		cout << "P" << i << "=" << (psi.Multi / info.multiScaleFactor) << "@" << info.DecodeVID(psi.VID) << endl;
+	}
+
+	if (tokens.size() == 2)
+		return;
+
+	if (info.Family == 0x15)
+	{
+		for (int i = 0; i < info.NumNBPStates; i++)
+		{
+			const NBPStateInfo nbpsi = info.ReadNBPState(i);
+			cout << "NB_P" << i << "=" << nbpsi.Multi << "@" << info.DecodeVID(nbpsi.VID) << endl;
+		}
+	}
+
+	cout << "current:";
+
+	const int numLogicalCPUs = GetNumLogicalCPUs();
+	for (int j = 0; j < numLogicalCPUs; j++)
+	{
+		SwitchTo(j);
+		cout << " P" << info.GetCurrentPState();
+	}
+
+	cout << endl;
+}
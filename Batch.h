@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <istream>
+#include <string>
+#include <vector>
+#include "Info.h"
+
+
+// Runs a sequence of commands (read from a script file or stdin) against a
+// single initialized Info, one command per line:
+//   info              prints the info screen
+//   read [P<n>]       prints the P-state definitions and current P-states
+//   sleep <ms>        pauses
+//   verify            checks whether the last applied changes are in effect
+//   exit              stops processing
+// Any other line is handled like a regular command line (e.g. "P0=12@1.3 Turbo=0").
+class BatchRunner
+{
+public:
+
+	BatchRunner(const Info& info)
+		: _info(&info)
+		, _keepGoing(false)
+	{ }
+
+	bool ParseParams(int argc, const char* argv[]);
+
+	// throws an exception if a command fails (unless KeepGoing=1)
+	void Run();
+
+
+private:
+
+	const Info* _info;
+	std::string _scriptPath; // empty => stdin
+	bool _keepGoing;
+	std::vector<std::string> _lastChanges; // parameters of the last applied changes
+
+	void Process(std::istream& input, bool interactive);
+	bool Execute(const std::vector<std::string>& tokens);
+
+	void Read(const std::vector<std::string>& tokens) const;
+};
@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include "Bench.h"
+#include "Info.h"
+#include "Kernels.h"
+#include "Sim.h"
+#include "StringUtils.h"
+#include "Worker.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::min;
+using std::string;
+using std::vector;
+
+
+bool Benchmark::ParseParams(int argc, const char* argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const string param(argv[i]);
+
+		string key, value;
+		StringUtils::SplitPair(key, value, param, '=');
+
+		if (!value.empty())
+		{
+			if (_stricmp(key.c_str(), "Family") == 0)
+			{
+				const int family = (int)strtol(value.c_str(), NULL, 0);
+				if (family == 0x15 || family == 0x16 || family == 0x17)
+				{
+					_family = family;
+					continue;
+				}
+			}
+
+			if (_stricmp(key.c_str(), "CPUs") == 0)
+			{
+				vector<string> tokens;
+				StringUtils::Tokenize(tokens, value.c_str(), ",", true);
+
+				_cpuCounts.clear();
+				for (size_t j = 0; j < tokens.size(); j++)
+				{
+					const int numCPUs = atoi(tokens[j].c_str());
+					if (numCPUs < 1 || numCPUs > 256)
+					{
+						_cpuCounts.clear();
+						break;
+					}
+
+					_cpuCounts.push_back(numCPUs);
+				}
+
+				if (!_cpuCounts.empty())
+					continue;
+			}
+
+			if (_stricmp(key.c_str(), "MsrLatency") == 0 && atoi(value.c_str()) >= 0)
+			{
+				_msrLatency = atoi(value.c_str());
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "PciLatency") == 0 && atoi(value.c_str()) >= 0)
+			{
+				_pciLatency = atoi(value.c_str());
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Runs") == 0 && atoi(value.c_str()) > 0)
+			{
+				_numRuns = atoi(value.c_str());
+				continue;
+			}
+
+			// the command line to apply, comma separated (e.g. "P2=16@1.3,Turbo=1")
+			if (_stricmp(key.c_str(), "Params") == 0)
+			{
+				_params.clear();
+				StringUtils::Tokenize(_params, value.c_str(), ",", true);
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Baseline") == 0)
+			{
+				_baselinePath = value;
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Save") == 0)
+			{
+				_savePath = value;
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Threshold") == 0 && atof(value.c_str()) >= 0)
+			{
+				_threshold = atof(value.c_str());
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Format") == 0)
+			{
+				if (ParseOutputFormat(value.c_str(), _format))
+					continue;
+			}
+		}
+
+		cerr << "ERROR: invalid parameter " << param.c_str() << endl;
+		return false;
+	}
+
+	if (_cpuCounts.empty())
+	{
+		for (int numCPUs = 2; numCPUs <= 256; numCPUs *= 2)
+			_cpuCounts.push_back(numCPUs);
+	}
+
+	if (_params.empty())
+	{
+		_params.push_back("P2=16@1.3");
+		_params.push_back("P3=14@1.2");
+		_params.push_back("Turbo=1");
+	}
+
+	return true;
+}
+
+
+Benchmark::Result Benchmark::Measure(int numCPUs) const
+{
+	SimBackend sim(numCPUs, _family);
+	sim.SetLatencies(_msrLatency, _pciLatency);
+
+	BackendScope scope(&sim);
+
+	vector<const char*> argv;
+	argv.push_back("");
+	for (size_t i = 0; i < _params.size(); i++)
+		argv.push_back(_params[i].c_str());
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	const double usPerTick = 1000000.0 / frequency.QuadPart;
+
+	Result result;
+	result.Family = _family;
+	result.NumCPUs = numCPUs;
+	result.MsrLatency = _msrLatency;
+	result.PciLatency = _pciLatency;
+	result.InitializeUs = result.ParseUs = result.ApplyUs = 1e300;
+	result.NumOps = 0;
+
+	for (int run = 0; run < _numRuns; run++)
+	{
+		sim.Reset();
+		sim.ResetCounters();
+		SwitchTo(-1);
+
+		const long long t0 = GetTimerTicks();
+
+		Info info;
+		if (!info.Initialize())
+			throw std::exception("simulated CPU not supported");
+
+		const long long t1 = GetTimerTicks();
+
+		Worker worker(info);
+		if (!worker.ParseParams((int)argv.size(), &argv[0]))
+			throw std::exception("invalid Params");
+
+		const long long t2 = GetTimerTicks();
+
+		worker.ApplyChanges();
+
+		const long long t3 = GetTimerTicks();
+
+		result.InitializeUs = min(result.InitializeUs, (t1 - t0) * usPerTick);
+		result.ParseUs = min(result.ParseUs, (t2 - t1) * usPerTick);
+		result.ApplyUs = min(result.ApplyUs, (t3 - t2) * usPerTick);
+		result.NumOps = sim.GetNumMsrAccesses() + sim.GetNumPciAccesses();
+	}
+
+	return result;
+}
+
+
+void Benchmark::Run()
+{
+	vector<Result> results;
+	for (size_t i = 0; i < _cpuCounts.size(); i++)
+		results.push_back(Measure(_cpuCounts[i]));
+
+	if (_format == FORMAT_TEXT)
+	{
+		cout << "CPUs  Initialize [us]  ParseParams [us]  ApplyChanges [us]  ops  ops/s" << endl;
+
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const Result& r = results[i];
+			const double totalUs = r.InitializeUs + r.ParseUs + r.ApplyUs;
+
+			cout << r.NumCPUs << "  " << r.InitializeUs << "  " << r.ParseUs << "  " << r.ApplyUs
+			     << "  " << r.NumOps << "  " << (totalUs > 0 ? r.NumOps / totalUs * 1e6 : 0.0) << endl;
+		}
+	}
+	else
+	{
+		RecordWriter writer(stdout, _format);
+		for (size_t i = 0; i < results.size(); i++)
+			Write(writer, results[i]);
+	}
+
+	if (!_savePath.empty())
+	{
+		FILE* file = fopen(_savePath.c_str(), "w");
+		if (!file)
+			throw std::exception("cannot write results");
+
+		{
+			RecordWriter writer(file, FORMAT_CSV);
+			for (size_t i = 0; i < results.size(); i++)
+				Write(writer, results[i]);
+		}
+
+		fclose(file);
+	}
+
+	if (_baselinePath.empty())
+		return;
+
+	vector<Result> baseline;
+	if (!LoadResults(_baselinePath.c_str(), baseline))
+		throw std::exception("cannot read baseline");
+
+	// the number of register accesses is deterministic, the times may vary by the threshold
+	bool regressed = false;
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const Result& r = results[i];
+
+		for (size_t j = 0; j < baseline.size(); j++)
+		{
+			const Result& b = baseline[j];
+			if (b.Family != r.Family || b.NumCPUs != r.NumCPUs || b.MsrLatency != r.MsrLatency || b.PciLatency != r.PciLatency)
+				continue;
+
+			if (r.NumOps > b.NumOps)
+			{
+				cerr << "  " << r.NumCPUs << " CPUs: " << r.NumOps << " register accesses, baseline " << b.NumOps << endl;
+				regressed = true;
+			}
+
+			if (r.ApplyUs > b.ApplyUs * (1.0 + _threshold / 100.0))
+			{
+				cerr << "  " << r.NumCPUs << " CPUs: ApplyChanges " << r.ApplyUs << " us, baseline " << b.ApplyUs << " us" << endl;
+				regressed = true;
+			}
+		}
+	}
+
+	if (regressed)
+		throw std::exception("benchmark regressed compared to the baseline");
+}
+
+
+void Benchmark::Write(RecordWriter& writer, const Result& result)
+{
+	const double totalUs = result.InitializeUs + result.ParseUs + result.ApplyUs;
+
+	writer.BeginRecord("bench");
+	writer.Field("family", result.Family);
+	writer.Field("cpus", result.NumCPUs);
+	writer.Field("msr_latency_ns", result.MsrLatency);
+	writer.Field("pci_latency_ns", result.PciLatency);
+	writer.Field("initialize_us", result.InitializeUs);
+	writer.Field("parse_us", result.ParseUs);
+	writer.Field("apply_us", result.ApplyUs);
+	writer.Field("total_us", totalUs);
+	writer.Field("ops", (double)result.NumOps);
+	writer.Field("ops_per_s", totalUs > 0 ? result.NumOps / totalUs * 1e6 : 0.0);
+	writer.EndRecord();
+}
+
+bool Benchmark::LoadResults(const char* path, vector<Result>& results)
+{
+	std::ifstream file(path);
+	if (!file)
+		return false;
+
+	// columns are looked up by the names in the header
+	vector<string> header;
+	string line;
+	while (std::getline(file, line))
+	{
+		vector<string> fields;
+		StringUtils::Tokenize(fields, line.c_str(), ",\r", false);
+
+		if (fields.empty())
+			continue;
+
+		if (fields[0] == "type")
+		{
+			header = fields;
+			continue;
+		}
+
+		if (fields[0] != "\"bench\"" || fields.size() != header.size())
+			continue;
+
+		Result r;
+		r.Family = 0x15; // baselines saved without the family column
+		r.NumCPUs = r.MsrLatency = r.PciLatency = -1;
+		r.InitializeUs = r.ParseUs = r.ApplyUs = 0.0;
+		r.NumOps = 0;
+
+		for (size_t i = 1; i < fields.size(); i++)
+		{
+			const char* name = header[i].c_str();
+			const char* value = fields[i].c_str();
+
+			if (strcmp(name, "family") == 0)
+				r.Family = atoi(value);
+			else if (strcmp(name, "cpus") == 0)
+				r.NumCPUs = atoi(value);
+			else if (strcmp(name, "msr_latency_ns") == 0)
+				r.MsrLatency = atoi(value);
+			else if (strcmp(name, "pci_latency_ns") == 0)
+				r.PciLatency = atoi(value);
+			else if (strcmp(name, "initialize_us") == 0)
+				r.InitializeUs = atof(value);
+			else if (strcmp(name, "parse_us") == 0)
+				r.ParseUs = atof(value);
+			else if (strcmp(name, "apply_us") == 0)
+				r.ApplyUs = atof(value);
+			else if (strcmp(name, "ops") == 0)
+				r.NumOps = (long long)atof(value);
+		}
+
+		results.push_back(r);
+	}
+
+	return true;
+}
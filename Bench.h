@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "RecordWriter.h"
+
+
+// "Bench" command: times Info::Initialize, Worker::ParseParams and
+// Worker::ApplyChanges against simulated CPUs with increasing numbers of
+// logical CPUs and injected register access latencies.
+class Benchmark
+{
+public:
+
+	struct Result
+	{
+		int Family;
+		int NumCPUs;
+		int MsrLatency, PciLatency;            // ns
+		double InitializeUs, ParseUs, ApplyUs; // best of all runs
+		long long NumOps;                      // register accesses per run
+	};
+
+	Benchmark()
+		: _family(0x15)
+		, _msrLatency(0)
+		, _pciLatency(0)
+		, _numRuns(10)
+		, _threshold(20.0)
+		, _format(FORMAT_TEXT)
+	{ }
+
+	bool ParseParams(int argc, const char* argv[]);
+
+	// throws an exception if a result regresses compared to the baseline
+	void Run();
+
+
+private:
+
+	int _family; // of the simulated CPUs
+	std::vector<int> _cpuCounts;
+	int _msrLatency, _pciLatency; // ns per access
+	int _numRuns;
+	std::vector<std::string> _params; // command line to apply
+	std::string _baselinePath, _savePath;
+	double _threshold;                // allowed slowdown vs. baseline in %
+	OutputFormat _format;
+
+	Result Measure(int numCPUs) const;
+
+	static void Write(RecordWriter& writer, const Result& result);
+	static bool LoadResults(const char* path, std::vector<Result>& results);
+};
@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include <exception>
+#include <iostream>
+#include <map>
+#include "Consistency.h"
+#include "Snapshot.h"
+#include "StringUtils.h"
+#include "WinRing0.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::map;
+using std::string;
+using std::vector;
+
+typedef vector<unsigned long long> PStateDefinitions;
+
+
+bool ConsistencyChecker::ParseParams(int argc, const char* argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const string param(argv[i]);
+
+		if (_stricmp(param.c_str(), "Repair") == 0)
+		{
+			_repair = true;
+			continue;
+		}
+
+		string key, value;
+		StringUtils::SplitPair(key, value, param, '=');
+
+		if (!value.empty())
+		{
+			// snapshot with the expected P-state definitions
+			if (_stricmp(key.c_str(), "Profile") == 0)
+			{
+				_profilePath = value;
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Format") == 0)
+			{
+				if (ParseOutputFormat(value.c_str(), _format))
+					continue;
+			}
+		}
+
+		cerr << "ERROR: invalid parameter " << param.c_str() << endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+static PStateDefinitions GetDefinitions(const PStateTable& table, int cpu)
+{
+	const unsigned long long* first = &table.PStates[cpu * table.NumPStates];
+	return PStateDefinitions(first, first + table.NumPStates);
+}
+
+void ConsistencyChecker::Run()
+{
+	const Info& info = *_info;
+
+	PStateTable table;
+	table.Read(info);
+
+	// group the cores by identical definitions
+	map<PStateDefinitions, vector<int> > groups;
+	for (int j = 0; j < table.NumCPUs; j++)
+		groups[GetDefinitions(table, j)].push_back(j);
+
+	PStateDefinitions reference;
+	if (!_profilePath.empty())
+	{
+		Info profileInfo;
+		Snapshot profile;
+		if (!profile.Load(_profilePath.c_str(), profileInfo))
+			throw std::exception("cannot load profile");
+		if (profileInfo.Family != info.Family || profileInfo.Model != info.Model || profileInfo.NumPStates != info.NumPStates)
+			throw std::exception("profile is for a different CPU");
+
+		reference.assign(profile.PStates.begin(), profile.PStates.end());
+	}
+	else
+	{
+		// the largest group; on ties, the one of the lowest core
+		size_t largest = 0;
+		for (map<PStateDefinitions, vector<int> >::const_iterator it = groups.begin(); it != groups.end(); ++it)
+		{
+			const size_t size = it->second.size();
+			if (size > largest || (size == largest && it->second[0] < groups[reference][0]))
+			{
+				largest = size;
+				reference = it->first;
+			}
+		}
+	}
+
+	if (_format == FORMAT_TEXT)
+	{
+		cout << table.NumCPUs << " logical CPUs, " << groups.size() << " distinct P-state definition"
+		     << (groups.size() == 1 ? "" : "s") << endl;
+
+		for (map<PStateDefinitions, vector<int> >::const_iterator it = groups.begin(); it != groups.end(); ++it)
+		{
+			cout << "  CPUs";
+			for (size_t k = 0; k < it->second.size(); k++)
+				cout << (k == 0 ? " " : ",") << it->second[k];
+			cout << (it->first == reference ? " (reference)" : "") << endl;
+		}
+	}
+
+	int numOutliers;
+	if (_format == FORMAT_TEXT)
+		numOutliers = Report(table, reference, NULL);
+	else
+	{
+		RecordWriter writer(stdout, _format);
+		numOutliers = Report(table, reference, &writer);
+	}
+
+	if (numOutliers == 0)
+		return;
+
+	if (!_repair)
+		throw std::exception("P-state definitions differ between cores");
+
+	Repair(table, reference);
+
+	// check the result
+	PStateTable repaired;
+	repaired.Read(info);
+	for (int j = 0; j < repaired.NumCPUs; j++)
+	{
+		if (GetDefinitions(repaired, j) != reference)
+			throw std::exception("repair failed");
+	}
+
+	cerr << "repaired " << numOutliers << " logical CPU" << (numOutliers == 1 ? "" : "s") << endl;
+}
+
+
+// reports the differences to the reference and returns the number of deviating cores
+int ConsistencyChecker::Report(const PStateTable& table, const PStateDefinitions& reference, RecordWriter* writer) const
+{
+	const Info& info = *_info;
+
+	PStateTable expected;
+	expected.NumCPUs = 1;
+	expected.NumPStates = table.NumPStates;
+	expected.PStates = reference;
+	expected.Decode(info);
+
+	int numOutliers = 0;
+
+	for (int j = 0; j < table.NumCPUs; j++)
+	{
+		bool isOutlier = false;
+
+		for (int i = 0; i < table.NumPStates; i++)
+		{
+			const unsigned long long actualMsr = table.PStates[j * table.NumPStates + i];
+			if (actualMsr == reference[i])
+				continue;
+
+			isOutlier = true;
+
+			const PStateInfo actual = table.GetPState(info, j, i);
+			const PStateInfo wanted = expected.GetPState(info, 0, i);
+
+			if (writer)
+			{
+				writer->BeginRecord("mismatch");
+				writer->Field("cpu", j);
+				writer->Field("pstate", i);
+				writer->HexField("msr", actualMsr);
+				writer->HexField("expected_msr", reference[i]);
+				writer->Field("multi", actual.Multi / info.multiScaleFactor);
+				writer->Field("expected_multi", wanted.Multi / info.multiScaleFactor);
+				writer->Field("vid", info.DecodeVID(actual.VID));
+				writer->Field("expected_vid", info.DecodeVID(wanted.VID));
+				writer->EndRecord();
+				continue;
+			}
+
+			cout << "  CPU " << j << ": P" << i << " is " << (actual.Multi / info.multiScaleFactor) << "x @ "
+			     << info.DecodeVID(actual.VID) << "V, expected " << (wanted.Multi / info.multiScaleFactor) << "x @ "
+			     << info.DecodeVID(wanted.VID) << "V (0x" << StringUtils::ToHexString(actualMsr)
+			     << " vs. 0x" << StringUtils::ToHexString(reference[i]) << ")" << endl;
+		}
+
+		if (isOutlier)
+			numOutliers++;
+	}
+
+	return numOutliers;
+}
+
+
+// rewrites the deviating P-state MSRs of the deviating cores only
+void ConsistencyChecker::Repair(const PStateTable& table, const PStateDefinitions& reference) const
+{
+	const Info& info = *_info;
+
+	for (int j = 0; j < table.NumCPUs; j++)
+	{
+		bool changedCurrent = false;
+		const int currentPState = table.GetCurrentPState(j);
+
+		for (int i = 0; i < table.NumPStates; i++)
+		{
+			if (table.PStates[j * table.NumPStates + i] == reference[i])
+				continue;
+
+			SwitchTo(j);
+			Wrmsr(0xc0010064 + i, reference[i]);
+
+			if (i == currentPState)
+				changedCurrent = true;
+		}
+
+		// a changed definition of the current P-state takes effect on the next transition
+		if (changedCurrent)
+		{
+			const int tempPState = (currentPState == info.NumPStates - 1 ? 0 : info.NumPStates - 1);
+			info.SetCurrentPState(tempPState);
+			Sleep(1);
+			info.SetCurrentPState(currentPState);
+		}
+	}
+
+	SwitchTo(-1);
+
+	// the MSRs were not written through Info
+	info.InvalidateRegisters();
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Info.h"
+#include "PStateTable.h"
+#include "RecordWriter.h"
+
+
+// "Verify" command: groups the logical CPUs by their P-state definitions
+// (MSRC001_0064..6B) and reports the cores deviating from the majority or
+// from a snapshot. Optionally rewrites the divergent definitions.
+class ConsistencyChecker
+{
+public:
+
+	ConsistencyChecker(const Info& info)
+		: _info(&info)
+		, _repair(false)
+		, _format(FORMAT_TEXT)
+	{ }
+
+	bool ParseParams(int argc, const char* argv[]);
+
+	// throws an exception if cores differ (and have not been repaired)
+	void Run();
+
+
+private:
+
+	const Info* _info;
+	bool _repair;
+	std::string _profilePath; // snapshot, empty => majority
+	OutputFormat _format;
+
+	int Report(const PStateTable& table, const std::vector<unsigned long long>& reference, RecordWriter* writer) const;
+	void Repair(const PStateTable& table, const std::vector<unsigned long long>& reference) const;
+};
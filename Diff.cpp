@@ -0,0 +1,457 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include <algorithm>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include "Diff.h"
+#include "Info.h"
+#include "MappedFile.h"
+#include "Snapshot.h"
+#include "StringUtils.h"
+#include "Threads.h"
+#include "WinRing0.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::map;
+using std::max;
+using std::min;
+using std::string;
+using std::vector;
+
+
+bool SnapshotDiff::ParseParams(int argc, const char* argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const string param(argv[i]);
+
+		string key, value;
+		StringUtils::SplitPair(key, value, param, '=');
+
+		if (value.empty())
+		{
+			// snapshot file or wildcard pattern
+			if (AddPaths(param, _paths))
+				continue;
+		}
+		else
+		{
+			// text file listing one snapshot per line
+			if (_stricmp(key.c_str(), "List") == 0)
+			{
+				if (LoadList(value.c_str(), _paths))
+					continue;
+			}
+
+			if (_stricmp(key.c_str(), "Golden") == 0)
+			{
+				_goldenPath = value;
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Threads") == 0)
+			{
+				const int numThreads = atoi(value.c_str());
+				if (numThreads > 0)
+				{
+					_numThreads = numThreads;
+					continue;
+				}
+			}
+
+			if (_stricmp(key.c_str(), "Examples") == 0)
+			{
+				const int numExamples = atoi(value.c_str());
+				if (numExamples >= 0)
+				{
+					_numExamples = numExamples;
+					continue;
+				}
+			}
+
+			if (_stricmp(key.c_str(), "Format") == 0)
+			{
+				if (ParseOutputFormat(value.c_str(), _format))
+					continue;
+			}
+		}
+
+		cerr << "ERROR: invalid parameter " << param.c_str() << endl;
+		return false;
+	}
+
+	if (_paths.empty())
+	{
+		cerr << "ERROR: no snapshot files" << endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+bool SnapshotDiff::AddPaths(const string& pattern, vector<string>& paths)
+{
+	if (pattern.find_first_of("*?") == string::npos)
+	{
+		paths.push_back(pattern);
+		return true;
+	}
+
+	const size_t slash = pattern.find_last_of("\\/");
+	const string directory = (slash == string::npos ? string() : pattern.substr(0, slash + 1));
+
+	WIN32_FIND_DATAA data;
+	const HANDLE find = FindFirstFileA(pattern.c_str(), &data);
+	if (find == INVALID_HANDLE_VALUE)
+		return false;
+
+	do
+	{
+		if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			paths.push_back(directory + data.cFileName);
+	}
+	while (FindNextFileA(find, &data));
+
+	FindClose(find);
+	return true;
+}
+
+bool SnapshotDiff::LoadList(const char* path, vector<string>& paths)
+{
+	std::ifstream file(path);
+	if (!file)
+		return false;
+
+	string line;
+	while (std::getline(file, line))
+	{
+		if (!line.empty() && line[line.length() - 1] == '\r')
+			line.erase(line.length() - 1);
+		if (!line.empty())
+			paths.push_back(line);
+	}
+
+	return true;
+}
+
+
+static void AddField(vector<SnapshotDiff::Field>& fields, const string& name, const string& value)
+{
+	SnapshotDiff::Field field;
+	field.Name = name;
+	field.Value = value;
+	fields.push_back(field);
+}
+
+bool SnapshotDiff::Normalize(const char* data, size_t size, vector<Field>& fields)
+{
+	Info info;
+	Snapshot snapshot;
+	if (!snapshot.Parse(data, size, info))
+		return false;
+
+	fields.clear();
+	AddField(fields, "family", "0x" + StringUtils::ToHexString(info.Family));
+	AddField(fields, "model", "0x" + StringUtils::ToHexString(info.Model));
+
+	// through the regular decode logic, so equivalent encodings compare equal
+	for (int i = 0; i < info.NumPStates; i++)
+	{
+		const string prefix = "P" + StringUtils::ToString(i) + ".";
+		const PStateInfo psi = info.DecodePState(i, snapshot.PStates[i]);
+
+		AddField(fields, prefix + "enabled", StringUtils::ToString(GetBits(snapshot.PStates[i], 63, 1)));
+		AddField(fields, prefix + "multi", StringUtils::ToString(psi.Multi / info.multiScaleFactor));
+		AddField(fields, prefix + "vid", StringUtils::ToString(info.DecodeVID(psi.VID)));
+		if (psi.NBPState >= 0)
+			AddField(fields, prefix + "nbpstate", StringUtils::ToString(psi.NBPState));
+		if (psi.NBVID >= 0)
+			AddField(fields, prefix + "nbvid", StringUtils::ToString(info.DecodeVID(psi.NBVID)));
+	}
+
+	for (size_t i = 0; i < snapshot.NBPStates.size(); i++)
+	{
+		const string prefix = "NB_P" + StringUtils::ToString(i) + ".";
+		const NBPStateInfo nbpsi = info.DecodeNBPState((int)i, snapshot.NBPStates[i]);
+
+		AddField(fields, prefix + "multi", StringUtils::ToString(nbpsi.Multi));
+		AddField(fields, prefix + "vid", StringUtils::ToString(info.DecodeVID(nbpsi.VID)));
+	}
+
+	if (info.IsBoostSupported)
+	{
+		bool isEnabled, isLocked;
+		info.DecodeBoostState(snapshot.BoostControl, snapshot.HWCR, isEnabled, isLocked);
+
+		AddField(fields, "boost.enabled", isEnabled ? "1" : "0");
+		AddField(fields, "boost.locked", isLocked ? "1" : "0");
+		AddField(fields, "boost.states", StringUtils::ToString(info.NumBoostStates));
+	}
+
+	return true;
+}
+
+
+static string GetKey(const vector<SnapshotDiff::Field>& fields)
+{
+	string key;
+	for (size_t i = 0; i < fields.size(); i++)
+		key += fields[i].Name + "=" + fields[i].Value + "\n";
+	return key;
+}
+
+static string GetHostName(const string& path)
+{
+	const size_t slash = path.find_last_of("\\/");
+	string name = (slash == string::npos ? path : path.substr(slash + 1));
+
+	const size_t dot = name.rfind('.');
+	if (dot != string::npos && dot > 0)
+		name.erase(dot);
+
+	return name;
+}
+
+
+struct DiffTask
+{
+	const vector<string>* Paths;
+	size_t First, End;
+	vector<vector<SnapshotDiff::Field> >* Fields; // per path, empty if invalid
+};
+
+static DWORD WINAPI DiffThread(LPVOID param)
+{
+	DiffTask& task = *static_cast<DiffTask*>(param);
+
+	MappedFile file;
+	for (size_t i = task.First; i < task.End; i++)
+	{
+		vector<SnapshotDiff::Field>& fields = (*task.Fields)[i];
+
+		if (file.Open((*task.Paths)[i].c_str()))
+		{
+			// a corrupt snapshot only counts as invalid
+			try
+			{
+				if (!SnapshotDiff::Normalize((const char*)file.GetData(), file.GetSize(), fields))
+					fields.clear();
+			}
+			catch (...)
+			{
+				fields.clear();
+			}
+
+			file.Close();
+		}
+	}
+
+	return 0;
+}
+
+void SnapshotDiff::Run()
+{
+	const size_t numPaths = _paths.size();
+	vector<vector<Field> > fields(numPaths);
+
+	// contiguous ranges of files, one per thread
+	const int numThreads = (int)max((size_t)1, min(numPaths, (size_t)min(_numThreads > 0 ? _numThreads : GetNumLogicalCPUs(), (int)MAXIMUM_WAIT_OBJECTS)));
+	vector<DiffTask> tasks(numThreads);
+	ThreadGroup threads;
+
+	for (int t = 0; t < numThreads; t++)
+	{
+		DiffTask& task = tasks[t];
+		task.Paths = &_paths;
+		task.First = numPaths * t / numThreads;
+		task.End = numPaths * (t + 1) / numThreads;
+		task.Fields = &fields;
+
+		threads.Start(DiffThread, &task);
+	}
+
+	threads.Wait();
+
+	// group the hosts by configuration, in order of first appearance
+	vector<Cluster> clusters;
+	map<string, size_t> clusterIndices;
+	size_t numInvalid = 0;
+
+	for (size_t i = 0; i < numPaths; i++)
+	{
+		if (fields[i].empty())
+		{
+			cerr << "WARNING: cannot load snapshot " << _paths[i].c_str() << endl;
+			numInvalid++;
+			continue;
+		}
+
+		const string key = GetKey(fields[i]);
+		map<string, size_t>::const_iterator it = clusterIndices.find(key);
+
+		if (it == clusterIndices.end())
+		{
+			clusterIndices[key] = clusters.size();
+			clusters.push_back(Cluster());
+			clusters.back().Fields.swap(fields[i]);
+			clusters.back().Hosts.push_back(i);
+		}
+		else
+		{
+			clusters[it->second].Hosts.push_back(i);
+			vector<Field>().swap(fields[i]);
+		}
+	}
+
+	// the reference is the golden snapshot or else the largest cluster
+	vector<Field> reference;
+	int referenceCluster = -1;
+
+	if (!_goldenPath.empty())
+	{
+		MappedFile golden;
+		if (!golden.Open(_goldenPath.c_str()) || !Normalize((const char*)golden.GetData(), golden.GetSize(), reference))
+			throw std::exception("cannot load golden snapshot");
+
+		map<string, size_t>::const_iterator it = clusterIndices.find(GetKey(reference));
+		if (it != clusterIndices.end())
+			referenceCluster = (int)it->second;
+	}
+	else if (!clusters.empty())
+	{
+		referenceCluster = 0;
+		for (size_t c = 1; c < clusters.size(); c++)
+		{
+			if (clusters[c].Hosts.size() > clusters[referenceCluster].Hosts.size())
+				referenceCluster = (int)c;
+		}
+
+		reference = clusters[referenceCluster].Fields;
+	}
+
+	Print(clusters, reference, referenceCluster, numInvalid);
+}
+
+
+static const string* FindValue(const vector<SnapshotDiff::Field>& fields, const string& name)
+{
+	for (size_t i = 0; i < fields.size(); i++)
+	{
+		if (fields[i].Name == name)
+			return &fields[i].Value;
+	}
+
+	return NULL;
+}
+
+// fields of the cluster differing from the reference, incl. missing ones
+static void GetDifferences(const vector<SnapshotDiff::Field>& fields, const vector<SnapshotDiff::Field>& reference,
+	vector<SnapshotDiff::Field>& actual, vector<string>& expected)
+{
+	for (size_t i = 0; i < fields.size(); i++)
+	{
+		const string* value = FindValue(reference, fields[i].Name);
+		if (value == NULL || *value != fields[i].Value)
+		{
+			actual.push_back(fields[i]);
+			expected.push_back(value == NULL ? "-" : *value);
+		}
+	}
+
+	for (size_t i = 0; i < reference.size(); i++)
+	{
+		if (FindValue(fields, reference[i].Name) == NULL)
+		{
+			SnapshotDiff::Field missing;
+			missing.Name = reference[i].Name;
+			missing.Value = "-";
+			actual.push_back(missing);
+			expected.push_back(reference[i].Value);
+		}
+	}
+}
+
+void SnapshotDiff::Print(const vector<Cluster>& clusters, const vector<Field>& reference,
+	int referenceCluster, size_t numInvalid) const
+{
+	if (_format != FORMAT_TEXT)
+	{
+		RecordWriter writer(stdout, _format);
+
+		for (size_t c = 0; c < clusters.size(); c++)
+		{
+			const Cluster& cluster = clusters[c];
+
+			writer.BeginRecord("cluster");
+			writer.Field("cluster", (int)c + 1);
+			writer.Field("hosts", (int)cluster.Hosts.size());
+			writer.Field("reference", (int)c == referenceCluster);
+			writer.Field("example", GetHostName(_paths[cluster.Hosts[0]]).c_str());
+			writer.EndRecord();
+
+			vector<Field> actual;
+			vector<string> expected;
+			GetDifferences(cluster.Fields, reference, actual, expected);
+
+			for (size_t i = 0; i < actual.size(); i++)
+			{
+				writer.BeginRecord("difference");
+				writer.Field("cluster", (int)c + 1);
+				writer.Field("field", actual[i].Name.c_str());
+				writer.Field("value", actual[i].Value.c_str());
+				writer.Field("expected", expected[i].c_str());
+				writer.EndRecord();
+			}
+		}
+
+		return;
+	}
+
+	cout << (_paths.size() - numInvalid) << " snapshots, " << clusters.size() << " configuration"
+	     << (clusters.size() == 1 ? "" : "s");
+	if (numInvalid > 0)
+		cout << ", " << numInvalid << " unreadable";
+	cout << endl;
+
+	if (!_goldenPath.empty() && referenceCluster < 0)
+		cout << "no host matches the golden snapshot" << endl;
+
+	for (size_t c = 0; c < clusters.size(); c++)
+	{
+		const Cluster& cluster = clusters[c];
+
+		cout << endl << "Configuration " << (c + 1) << ": " << cluster.Hosts.size() << " host"
+		     << (cluster.Hosts.size() == 1 ? "" : "s");
+		if ((int)c == referenceCluster)
+			cout << (_goldenPath.empty() ? " (majority)" : " (golden)");
+		cout << endl;
+
+		const size_t numExamples = min(cluster.Hosts.size(), (size_t)_numExamples);
+		if (numExamples > 0)
+		{
+			cout << "  hosts:";
+			for (size_t k = 0; k < numExamples; k++)
+				cout << " " << GetHostName(_paths[cluster.Hosts[k]]).c_str();
+			if (numExamples < cluster.Hosts.size())
+				cout << " ...";
+			cout << endl;
+		}
+
+		vector<Field> actual;
+		vector<string> expected;
+		GetDifferences(cluster.Fields, reference, actual, expected);
+
+		for (size_t i = 0; i < actual.size(); i++)
+			cout << "  " << actual[i].Name.c_str() << ": " << actual[i].Value.c_str() << ", expected " << expected[i].c_str() << endl;
+	}
+}
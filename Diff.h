@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "RecordWriter.h"
+
+
+// "Diff" command: loads many snapshot files in parallel, decodes them and
+// groups the hosts by identical configurations. Each configuration is
+// compared field by field to the golden snapshot or the largest group.
+class SnapshotDiff
+{
+public:
+
+	// decoded setting, e.g. "P2.multi" = "16"
+	struct Field
+	{
+		std::string Name;
+		std::string Value;
+	};
+
+	// hosts sharing one configuration
+	struct Cluster
+	{
+		std::vector<Field> Fields;
+		std::vector<size_t> Hosts; // indices of the paths
+	};
+
+	SnapshotDiff()
+		: _numThreads(0)
+		, _numExamples(5)
+		, _format(FORMAT_TEXT)
+	{ }
+
+	bool ParseParams(int argc, const char* argv[]);
+	void Run();
+
+	// decodes a snapshot; returns false if it cannot be parsed
+	static bool Normalize(const char* data, size_t size, std::vector<Field>& fields);
+
+
+private:
+
+	std::vector<std::string> _paths;
+	std::string _goldenPath;
+	int _numThreads;  // 0: one per logical CPU
+	int _numExamples; // host names listed per cluster
+	OutputFormat _format;
+
+	static bool AddPaths(const std::string& pattern, std::vector<std::string>& paths);
+	static bool LoadList(const char* path, std::vector<std::string>& paths);
+
+	void Print(const std::vector<Cluster>& clusters, const std::vector<Field>& reference,
+		int referenceCluster, size_t numInvalid) const;
+};
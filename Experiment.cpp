@@ -0,0 +1,711 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <exception>
+#include <iostream>
+#include "Experiment.h"
+#include "Kernels.h"
+#include "StringUtils.h"
+#include "Threads.h"
+#include "WinRing0.h"
+#include "Worker.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::min;
+using std::max;
+using std::string;
+using std::vector;
+
+static const DWORD APERF = 0xe8;
+static const DWORD MPERF = 0xe7;
+
+static const char* SPEC_NAMES[2] = { "A", "B" };
+
+
+static vector<const char*> MakeArgv(const vector<string>& params)
+{
+	vector<const char*> argv;
+	argv.push_back("");
+	for (size_t i = 0; i < params.size(); i++)
+		argv.push_back(params[i].c_str());
+	return argv;
+}
+
+
+bool ABExperiment::ParseParams(int argc, const char* argv[])
+{
+	bool hasSpecs[2] = { false, false };
+
+	for (int i = 1; i < argc; i++)
+	{
+		const string param(argv[i]);
+
+		string key, value;
+		StringUtils::SplitPair(key, value, param, '=');
+
+		if (!value.empty())
+		{
+			if (_stricmp(key.c_str(), "A") == 0 || _stricmp(key.c_str(), "B") == 0)
+			{
+				const int s = (toupper(key[0]) == 'A' ? 0 : 1);
+				if (!ParseSpec(SPEC_NAMES[s], value, _specs[s]))
+					return false;
+
+				hasSpecs[s] = true;
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Split") == 0 && atoi(value.c_str()) > 0)
+			{
+				_split = atoi(value.c_str());
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Trials") == 0 && atoi(value.c_str()) >= 2)
+			{
+				_trials = atoi(value.c_str());
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Duration") == 0 && atoi(value.c_str()) > 0)
+			{
+				_duration = atoi(value.c_str());
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Command") == 0)
+			{
+				_command = value;
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Alternate") == 0)
+			{
+				const int flag = atoi(value.c_str());
+				if (flag == 0 || flag == 1)
+				{
+					_alternate = (flag == 1);
+					continue;
+				}
+			}
+
+			if (_stricmp(key.c_str(), "Cdyn") == 0 && atof(value.c_str()) > 0)
+			{
+				_estimator.Cdyn = atof(value.c_str());
+				continue;
+			}
+			if (_stricmp(key.c_str(), "Static") == 0 && atof(value.c_str()) >= 0)
+			{
+				_estimator.StaticPower = atof(value.c_str());
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Format") == 0)
+			{
+				if (ParseOutputFormat(value.c_str(), _format))
+					continue;
+			}
+		}
+
+		cerr << "ERROR: invalid parameter " << param.c_str() << endl;
+		return false;
+	}
+
+	if (!hasSpecs[0] || !hasSpecs[1])
+	{
+		cerr << "ERROR: both specs (A= and B=) required" << endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+// a spec is a comma separated parameter list, e.g. "P2=16@1.2,P2,Turbo=0"
+bool ABExperiment::ParseSpec(const char* name, const string& value, Spec& spec) const
+{
+	const Info& info = *_info;
+
+	vector<string> tokens;
+	StringUtils::Tokenize(tokens, value, ",", true);
+
+	// syntax check
+	vector<const char*> argv = MakeArgv(tokens);
+	Worker worker(info);
+	if (!worker.ParseParams((int)argv.size(), &argv[0]))
+		return false;
+
+	spec.Definitions.clear();
+	spec.Settings.clear();
+	spec.PState = -1;
+
+	for (size_t i = 0; i < tokens.size(); i++)
+	{
+		const string& token = tokens[i];
+
+		if (token.length() >= 2 && tolower(token[0]) == 'p' && isdigit((unsigned char)token[1]))
+		{
+			if (token.find('=') != string::npos)
+				spec.Definitions.push_back(token);
+			else
+				spec.PState = atoi(token.c_str() + 1);
+			continue;
+		}
+
+		string key, flag;
+		StringUtils::SplitPair(key, flag, token, '=');
+
+		if (_stricmp(key.c_str(), "Turbo") == 0 || _stricmp(key.c_str(), "C1E") == 0)
+		{
+			spec.Settings.push_back(token);
+			continue;
+		}
+
+		// NB P-states and APM are shared by all cores of a node
+		cerr << "ERROR: " << token.c_str() << " in spec " << name << " applies to both partitions" << endl;
+		return false;
+	}
+
+	// a single definition is the forced P-state by default
+	if (spec.PState < 0 && spec.Definitions.size() == 1)
+		spec.PState = atoi(spec.Definitions[0].c_str() + 1);
+
+	if (spec.PState < info.NumBoostStates || spec.PState >= info.NumPStates)
+	{
+		cerr << "ERROR: spec " << name << " needs a software P-state to force (e.g. P" << info.NumBoostStates << ")" << endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+// the definition of the P-state if the spec was applied; false if not affected by it
+bool ABExperiment::GetDefinition(const Spec& spec, int index, PStateInfo& psi) const
+{
+	const Info& info = *_info;
+
+	psi = info.ReadPState(index);
+	bool isAffected = (spec.PState == index);
+
+	for (size_t i = 0; i < spec.Definitions.size(); i++)
+	{
+		const string& token = spec.Definitions[i];
+		if (atoi(token.c_str() + 1) != index)
+			continue;
+
+		string key, value, multi, voltage;
+		StringUtils::SplitPair(key, value, token, '=');
+		StringUtils::SplitPair(multi, voltage, value, '@');
+
+		// rounded like the written values
+		PStateInfo requested = psi;
+		requested.Multi = (multi.empty() ? -1 : info.multiScaleFactor * atof(multi.c_str()));
+		requested.VID = (voltage.empty() ? -1 : info.EncodeVID(atof(voltage.c_str())));
+		requested.NBPState = requested.NBVID = -1;
+
+		QWORD msr = 0;
+		info.EncodePState(psi, msr);
+		info.EncodePState(requested, msr);
+		psi = info.DecodePState(index, msr);
+
+		isAffected = true;
+	}
+
+	return isAffected;
+}
+
+void ABExperiment::SeparateSpecs()
+{
+	const Info& info = *_info;
+
+	Spec& a = _specs[0];
+	Spec& b = _specs[1];
+
+	// slots used by A
+	vector<bool> isUsedByA(info.NumPStates, false);
+	vector<bool> isUsedByB(info.NumPStates, false);
+	for (int i = 0; i < info.NumPStates; i++)
+	{
+		PStateInfo psi;
+		isUsedByA[i] = GetDefinition(a, i, psi);
+		isUsedByB[i] = GetDefinition(b, i, psi);
+	}
+
+	// move B's conflicting definitions (or the original one of its forced P-state) to spare slots
+	vector<string> definitions;
+	int pState = b.PState;
+
+	for (int i = 0; i < info.NumPStates; i++)
+	{
+		PStateInfo defA, defB;
+		if (!GetDefinition(b, i, defB))
+			continue;
+
+		const bool isConflict = (GetDefinition(a, i, defA) && (defA.Multi != defB.Multi || defA.VID != defB.VID));
+
+		if (!isConflict)
+		{
+			for (size_t k = 0; k < b.Definitions.size(); k++)
+			{
+				if (atoi(b.Definitions[k].c_str() + 1) == i)
+					definitions.push_back(b.Definitions[k]);
+			}
+			continue;
+		}
+
+		int spare = info.NumPStates - 1;
+		while (spare >= info.NumBoostStates && (isUsedByA[spare] || isUsedByB[spare]))
+			spare--;
+
+		if (spare < info.NumBoostStates)
+			throw std::exception("no spare P-state to separate the specs");
+
+		isUsedByB[spare] = true;
+
+		const string definition = "P" + StringUtils::ToString(spare) + "=" + StringUtils::ToString(defB.Multi / info.multiScaleFactor)
+		                          + "@" + StringUtils::ToString(info.DecodeVID(defB.VID));
+		definitions.push_back(definition);
+
+		if (b.PState == i)
+			pState = spare;
+
+		(_format == FORMAT_TEXT ? cout : cerr) << "  P" << i << " of spec B moved to " << definition.c_str() << endl;
+	}
+
+	b.Definitions.swap(definitions);
+	b.PState = pState;
+}
+
+
+struct ExperimentTask
+{
+	int CPU;
+	double Duration;      // s
+	unsigned long long Chunk; // kernel iterations between deadline checks
+	unsigned long long Iterations;
+	double Seconds;
+	double Checksum;
+};
+
+static DWORD WINAPI ExperimentThread(LPVOID param)
+{
+	ExperimentTask& task = *static_cast<ExperimentTask*>(param);
+
+	SwitchTo(task.CPU);
+
+	task.Iterations = 0;
+	task.Checksum = 0.0;
+	const double start = GetSeconds();
+
+	do
+	{
+		task.Checksum += RunComputeKernel(task.Chunk);
+		task.Iterations += task.Chunk;
+		task.Seconds = GetSeconds() - start;
+	} while (task.Seconds < task.Duration);
+
+	SwitchTo(-1);
+	return 0;
+}
+
+
+// runs the command once in each partition, concurrently; returns the elapsed times
+static void RunCommands(const string& command, const vector<int> cpus[2], double seconds[2])
+{
+	HANDLE processes[2] = { NULL, NULL };
+	double starts[2];
+
+	for (int s = 0; s < 2; s++)
+	{
+		DWORD_PTR mask = 0;
+		for (size_t k = 0; k < cpus[s].size(); k++)
+		{
+			if (cpus[s][k] < (int)sizeof(DWORD_PTR) * 8)
+				mask |= (DWORD_PTR)1 << cpus[s][k];
+		}
+
+		STARTUPINFOA startupInfo;
+		ZeroMemory(&startupInfo, sizeof(startupInfo));
+		startupInfo.cb = sizeof(startupInfo);
+		PROCESS_INFORMATION processInfo;
+
+		// the command line may be modified by CreateProcess()
+		vector<char> commandLine(command.begin(), command.end());
+		commandLine.push_back(0);
+
+		if (!CreateProcessA(NULL, &commandLine[0], NULL, NULL, FALSE, CREATE_SUSPENDED, NULL, NULL, &startupInfo, &processInfo))
+		{
+			if (s == 1)
+			{
+				TerminateProcess(processes[0], 1);
+				CloseHandle(processes[0]);
+			}
+			throw std::exception("cannot start the workload command");
+		}
+
+		// pinned to the partition before it starts running
+		SetProcessAffinityMask(processInfo.hProcess, mask);
+		starts[s] = GetSeconds();
+		ResumeThread(processInfo.hThread);
+		CloseHandle(processInfo.hThread);
+
+		processes[s] = processInfo.hProcess;
+	}
+
+	// the first one to finish, then the other one
+	const int first = (WaitForMultipleObjects(2, processes, FALSE, INFINITE) == WAIT_OBJECT_0 + 1 ? 1 : 0);
+	seconds[first] = GetSeconds() - starts[first];
+
+	WaitForSingleObject(processes[1 - first], INFINITE);
+	seconds[1 - first] = GetSeconds() - starts[1 - first];
+
+	CloseHandle(processes[0]);
+	CloseHandle(processes[1]);
+}
+
+void ABExperiment::RunTrial(const vector<int>& specOfCPU, Sample samples[2])
+{
+	const int numLogicalCPUs = (int)specOfCPU.size();
+
+	vector<QWORD> aperf(numLogicalCPUs), mperf(numLogicalCPUs);
+	for (int j = 0; j < numLogicalCPUs; j++)
+	{
+		SwitchTo(j);
+		aperf[j] = Rdmsr(APERF);
+		mperf[j] = Rdmsr(MPERF);
+	}
+	SwitchTo(-1);
+
+	double throughputs[2] = { 0.0, 0.0 };
+
+	if (_command.empty())
+	{
+		vector<ExperimentTask> tasks(numLogicalCPUs);
+		ThreadGroup threads;
+
+		for (int j = 0; j < numLogicalCPUs; j++)
+		{
+			tasks[j].CPU = j;
+			tasks[j].Duration = _duration / 1000.0;
+			tasks[j].Chunk = _chunk;
+
+			threads.Start(ExperimentThread, &tasks[j]);
+		}
+
+		threads.Wait();
+
+		volatile double checksum = 0.0;
+		for (int j = 0; j < numLogicalCPUs; j++)
+		{
+			checksum += tasks[j].Checksum;
+			throughputs[specOfCPU[j]] += tasks[j].Iterations / max(tasks[j].Seconds, 1e-9) / 1e6;
+		}
+	}
+	else
+	{
+		vector<int> cpus[2];
+		for (int j = 0; j < numLogicalCPUs; j++)
+			cpus[specOfCPU[j]].push_back(j);
+
+		double seconds[2];
+		RunCommands(_command, cpus, seconds);
+
+		for (int s = 0; s < 2; s++)
+			throughputs[s] = 1.0 / max(seconds[s], 1e-9);
+	}
+
+	vector<int> pStates[2];
+	for (int s = 0; s < 2; s++)
+	{
+		samples[s].Throughput = throughputs[s];
+		samples[s].EffectiveMHz = 0.0;
+	}
+
+	for (int j = 0; j < numLogicalCPUs; j++)
+	{
+		SwitchTo(j);
+		const QWORD aperfDelta = Rdmsr(APERF) - aperf[j];
+		const QWORD mperfDelta = Rdmsr(MPERF) - mperf[j];
+
+		const int s = specOfCPU[j];
+		pStates[s].push_back(_specs[s].PState);
+		if (mperfDelta > 0)
+			samples[s].EffectiveMHz += _p0MHz * aperfDelta / mperfDelta;
+	}
+	SwitchTo(-1);
+
+	for (int s = 0; s < 2; s++)
+	{
+		samples[s].EffectiveMHz /= max((size_t)1, pStates[s].size());
+		samples[s].Power = _estimator.Model(pStates[s]);
+	}
+}
+
+
+// two-sided 95% quantiles of Student's t-distribution for 1..30 degrees of freedom
+static double GetTQuantile(int degreesOfFreedom)
+{
+	static const double quantiles[30] =
+	{
+		12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+		2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+		2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+	};
+
+	return (degreesOfFreedom <= 30 ? quantiles[max(1, degreesOfFreedom) - 1] : 1.96);
+}
+
+// mean and half width of the 95% confidence interval
+static void GetInterval(const vector<double>& values, double& mean, double& halfWidth)
+{
+	const size_t n = values.size();
+
+	mean = 0.0;
+	for (size_t i = 0; i < n; i++)
+		mean += values[i] / n;
+
+	double variance = 0.0;
+	for (size_t i = 0; i < n; i++)
+		variance += (values[i] - mean) * (values[i] - mean) / (n - 1);
+
+	halfWidth = GetTQuantile((int)n - 1) * sqrt(variance / n);
+}
+
+void ABExperiment::Report(const vector<Sample> samples[2], RecordWriter& writer) const
+{
+	static const char* names[4] = { "throughput", "effective_mhz", "power", "efficiency" };
+	static const char* labels[4] = { "throughput [Mops/s]", "effective frequency [MHz]", "power [W]", "efficiency [Mops/J]" };
+
+	if (_format == FORMAT_TEXT)
+		cout << endl << "Results (mean +- 95% confidence interval; the difference is paired by trial):" << endl;
+
+	for (int m = 0; m < 4; m++)
+	{
+		// per spec, and B - A per trial
+		vector<double> values[3];
+
+		for (size_t t = 0; t < samples[0].size(); t++)
+		{
+			for (int s = 0; s < 2; s++)
+			{
+				const Sample& sample = samples[s][t];
+				values[s].push_back(m == 0 ? sample.Throughput : m == 1 ? sample.EffectiveMHz
+				                    : m == 2 ? sample.Power : sample.Throughput / max(sample.Power, 1e-9));
+			}
+
+			values[2].push_back(values[1].back() - values[0].back());
+		}
+
+		double means[3], halfWidths[3];
+		for (int k = 0; k < 3; k++)
+			GetInterval(values[k], means[k], halfWidths[k]);
+
+		const double percent = (means[0] != 0 ? 100.0 * means[2] / means[0] : 0.0);
+
+		if (_format == FORMAT_TEXT)
+		{
+			const char* label = (m == 0 && !_command.empty() ? "throughput [runs/s]" : labels[m]);
+			cout << "  " << label << ": A " << means[0] << " +- " << halfWidths[0]
+			     << ", B " << means[1] << " +- " << halfWidths[1]
+			     << ", B - A " << means[2] << " +- " << halfWidths[2] << " (" << percent << "%)" << endl;
+			continue;
+		}
+
+		writer.BeginRecord("result");
+		writer.Field("metric", names[m]);
+		writer.Field("a_mean", means[0]);
+		writer.Field("a_ci", halfWidths[0]);
+		writer.Field("b_mean", means[1]);
+		writer.Field("b_ci", halfWidths[1]);
+		writer.Field("diff_mean", means[2]);
+		writer.Field("diff_ci", halfWidths[2]);
+		writer.Field("diff_percent", percent);
+		writer.EndRecord();
+	}
+
+	writer.Flush();
+}
+
+
+void ABExperiment::Run()
+{
+	const Info& info = *_info;
+
+	// the partitions run one thread per logical CPU
+	const int numLogicalCPUs = GetNumLogicalCPUs();
+	const int numCPUs = min(numLogicalCPUs, (int)MAXIMUM_WAIT_OBJECTS);
+	if (_split < 0)
+		_split = numCPUs / 2;
+	if (_split < 1 || _split >= numCPUs)
+		throw std::exception("both partitions need at least one logical CPU");
+
+	// keep stdout clean for machine-readable output
+	std::ostream& status = (_format == FORMAT_TEXT ? cout : cerr);
+
+	SeparateSpecs();
+
+	// original settings of all logical CPUs (the definitions are programmed
+	// on all of them, not only on the partitions), restored afterwards
+	const bool wasBoostSourceEnabled = (info.IsBoostSupported && info.IsBoostSourceEnabled());
+	vector<vector<PStateInfo> > originalPStates(numLogicalCPUs);
+	vector<int> currentPStates(numLogicalCPUs);
+	vector<bool> wasCPBDisabled(numLogicalCPUs, false), wasC1EEnabled(numLogicalCPUs, false);
+	for (int j = 0; j < numLogicalCPUs; j++)
+	{
+		SwitchTo(j);
+		for (int i = 0; i < info.NumPStates; i++)
+			originalPStates[j].push_back(info.ReadPState(i));
+		currentPStates[j] = info.GetCurrentPState();
+		if (info.IsBoostSupported)
+			wasCPBDisabled[j] = info.IsCPBDisabled();
+		if (info.IsC1ESupported())
+			wasC1EEnabled[j] = info.IsC1EEnabled();
+	}
+	SwitchTo(-1);
+
+	// MPERF counts at the original P0 frequency
+	_p0MHz = originalPStates[0][info.NumBoostStates].Multi * 100;
+
+	// 10 ms of work between deadline checks, calibrated at the current speed
+	if (_command.empty())
+		_chunk = CalibrateComputeKernel(0.01);
+
+	// the definitions of both specs on all cores, in separate slots
+	vector<string> definitions(_specs[0].Definitions);
+	definitions.insert(definitions.end(), _specs[1].Definitions.begin(), _specs[1].Definitions.end());
+
+	// the per-core settings of each spec
+	Worker workers[2] = { Worker(info), Worker(info) };
+	bool isTurboUsed = false;
+	for (int s = 0; s < 2; s++)
+	{
+		vector<string> params(_specs[s].Settings);
+		params.push_back("P" + StringUtils::ToString(_specs[s].PState));
+
+		vector<const char*> argv = MakeArgv(params);
+		if (!workers[s].ParseParams((int)argv.size(), &argv[0]))
+			throw std::exception("invalid spec");
+
+		for (size_t k = 0; k < _specs[s].Settings.size(); k++)
+			isTurboUsed |= (_stricmp(_specs[s].Settings[k].c_str(), "Turbo=1") == 0);
+	}
+
+	status << "A/B experiment: A = P" << _specs[0].PState << " on CPUs 0-" << (_split - 1)
+	       << ", B = P" << _specs[1].PState << " on CPUs " << _split << "-" << (numCPUs - 1)
+	       << ", " << _trials << " trials of " << (_command.empty() ? StringUtils::ToString(_duration) + " ms compute kernel" : "\"" + _command + "\"").c_str()
+	       << (_alternate ? " (partitions swapped every other trial)" : "") << endl;
+
+	RecordWriter writer(stdout, _format);
+	vector<Sample> samples[2];
+
+	try
+	{
+		if (!definitions.empty())
+		{
+			vector<const char*> argv = MakeArgv(definitions);
+			Worker worker(info);
+			if (!worker.ParseParams((int)argv.size(), &argv[0]))
+				throw std::exception("invalid spec");
+			worker.ApplyChanges();
+		}
+
+		// CpbDis only takes effect with the boost source enabled
+		if (isTurboUsed && info.IsBoostSupported)
+			info.SetBoostSource(true);
+
+		// the model reads the new definitions
+		_estimator.Initialize();
+
+		for (int t = 0; t < _trials; t++)
+		{
+			const bool isSwapped = (_alternate && (t % 2) == 1);
+
+			vector<int> specOfCPU(numCPUs);
+			for (int j = 0; j < numCPUs; j++)
+			{
+				specOfCPU[j] = ((j < _split) != isSwapped ? 0 : 1);
+				workers[specOfCPU[j]].ApplyToCore(j);
+			}
+
+			Sample trial[2];
+			RunTrial(specOfCPU, trial);
+
+			for (int s = 0; s < 2; s++)
+				samples[s].push_back(trial[s]);
+
+			if (_format == FORMAT_TEXT)
+			{
+				cout << "  trial " << (t + 1) << (isSwapped ? " (swapped)" : "") << ":";
+				for (int s = 0; s < 2; s++)
+				{
+					cout << (s == 0 ? " " : " | ") << SPEC_NAMES[s] << " " << trial[s].Throughput << (_command.empty() ? " Mops/s, " : " runs/s, ")
+					     << trial[s].EffectiveMHz << " MHz, " << trial[s].Power << " W";
+				}
+				cout << endl;
+				continue;
+			}
+
+			writer.BeginRecord("trial");
+			writer.Field("trial", t + 1);
+			writer.Field("swapped", isSwapped);
+			writer.Field("a_throughput", trial[0].Throughput);
+			writer.Field("a_effective_mhz", trial[0].EffectiveMHz);
+			writer.Field("a_power", trial[0].Power);
+			writer.Field("b_throughput", trial[1].Throughput);
+			writer.Field("b_effective_mhz", trial[1].EffectiveMHz);
+			writer.Field("b_power", trial[1].Power);
+			writer.EndRecord();
+			writer.Flush();
+		}
+	}
+	catch (...)
+	{
+		Restore(originalPStates, currentPStates, wasCPBDisabled, wasC1EEnabled, wasBoostSourceEnabled);
+		throw;
+	}
+
+	Restore(originalPStates, currentPStates, wasCPBDisabled, wasC1EEnabled, wasBoostSourceEnabled);
+
+	Report(samples, writer);
+}
+
+
+void ABExperiment::Restore(const vector<vector<PStateInfo> >& originalPStates, const vector<int>& currentPStates,
+                           const vector<bool>& wasCPBDisabled, const vector<bool>& wasC1EEnabled,
+                           bool wasBoostSourceEnabled) const
+{
+	const Info& info = *_info;
+
+	if (info.IsBoostSupported)
+		info.SetBoostSource(wasBoostSourceEnabled);
+
+	for (int j = 0; j < (int)originalPStates.size(); j++)
+	{
+		SwitchTo(j);
+
+		for (size_t i = 0; i < originalPStates[j].size(); i++)
+			info.WritePState(originalPStates[j][i]);
+
+		if (info.IsBoostSupported)
+			info.SetCPBDis(!wasCPBDisabled[j]);
+		if (info.IsC1ESupported())
+			info.SetC1E(wasC1EEnabled[j]);
+
+		// the restored definition takes effect on the next transition
+		const int currentPState = currentPStates[j];
+		info.SetCurrentPState(currentPState == info.NumPStates - 1 ? info.NumBoostStates : info.NumPStates - 1);
+		info.SetCurrentPState(currentPState);
+	}
+
+	SwitchTo(-1);
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Info.h"
+#include "PowerCap.h"
+#include "RecordWriter.h"
+
+
+// "Experiment" command: A/B comparison of two settings under load on the
+// same host. The logical CPUs are split into two partitions, each running
+// one spec (P-state definitions, a forced P-state, Turbo=, C1E=) and the
+// same workload concurrently. Reports the throughput, effective frequency
+// and power of both specs with confidence intervals over all trials.
+// The P-state definitions are programmed on all cores; if both specs need
+// the same P-state slot with different definitions, B's one is moved to a
+// spare slot.
+class ABExperiment
+{
+public:
+
+	ABExperiment(const Info& info)
+		: _info(&info)
+		, _estimator(info)
+		, _split(-1)
+		, _trials(10)
+		, _duration(1000)
+		, _alternate(true)
+		, _format(FORMAT_TEXT)
+		, _chunk(0)
+		, _p0MHz(0.0)
+	{ }
+
+	bool ParseParams(int argc, const char* argv[]);
+
+	void Run();
+
+
+private:
+
+	struct Spec
+	{
+		std::vector<std::string> Definitions; // P<n>=multi@voltage
+		std::vector<std::string> Settings;    // Turbo=, C1E=
+		int PState;                           // forced, hardware index
+	};
+
+	// per spec and trial
+	struct Sample
+	{
+		double Throughput;   // million kernel iterations or command runs per second
+		double EffectiveMHz; // average of the partition's cores
+		double Power;        // W, modeled
+	};
+
+	const Info* _info;
+	PowerEstimator _estimator;
+	Spec _specs[2];
+	int _split;            // logical CPUs of the first partition (-1: half)
+	int _trials;
+	int _duration;         // ms per trial (built-in workload)
+	std::string _command;  // workload (empty: built-in compute kernel)
+	bool _alternate;       // swap the partitions every other trial
+	OutputFormat _format;
+
+	unsigned long long _chunk; // kernel iterations between deadline checks
+	double _p0MHz;             // MPERF reference
+
+	bool ParseSpec(const char* name, const std::string& value, Spec& spec) const;
+	void SeparateSpecs();
+	bool GetDefinition(const Spec& spec, int index, PStateInfo& psi) const;
+
+	void RunTrial(const std::vector<int>& specOfCPU, Sample samples[2]);
+	void Restore(const std::vector<std::vector<PStateInfo> >& originalPStates, const std::vector<int>& currentPStates,
+	             const std::vector<bool>& wasCPBDisabled, const std::vector<bool>& wasC1EEnabled,
+	             bool wasBoostSourceEnabled) const;
+
+	void Report(const std::vector<Sample> samples[2], RecordWriter& writer) const;
+};
@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+// winsock2.h must precede windows.h
+#include <winsock2.h>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <conio.h>
+#include "Exporter.h"
+#include "StringUtils.h"
+
+#pragma comment(lib, "ws2_32.lib")
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::ostringstream;
+using std::string;
+
+static const DWORD APERF = 0xe8;
+static const DWORD MPERF = 0xe7;
+
+
+bool Exporter::ParseParams(int argc, const char* argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const string param(argv[i]);
+
+		string key, value;
+		StringUtils::SplitPair(key, value, param, '=');
+
+		if (!value.empty())
+		{
+			if (_stricmp(key.c_str(), "Interval") == 0)
+			{
+				const int interval = atoi(value.c_str());
+				if (interval > 0)
+				{
+					_interval = interval;
+					continue;
+				}
+			}
+
+			if (_stricmp(key.c_str(), "File") == 0)
+			{
+				_path = value;
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Port") == 0)
+			{
+				const int port = atoi(value.c_str());
+				if (port > 0 && port < 65536)
+				{
+					_port = port;
+					continue;
+				}
+			}
+		}
+
+		cerr << "ERROR: invalid parameter " << param.c_str() << endl;
+		return false;
+	}
+
+	if (_path.empty() && _port == 0)
+	{
+		cerr << "ERROR: File=path and/or Port=n required" << endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+void Exporter::Run()
+{
+	const Info& info = *_info;
+
+	CoreCounters initial;
+	initial.Residency.resize(info.NumPStates, 0.0);
+	initial.CurrentPState = -1;
+	initial.EffectiveMHz = 0.0;
+	initial.IsBoostEnabled = false;
+	initial.APerf = initial.MPerf = 0;
+	_cores.assign(GetNumLogicalCPUs(), initial);
+
+	InitializeCriticalSection(&_lock);
+
+	try
+	{
+		Start();
+
+		cout << "Exporting every " << _interval << " ms";
+		if (!_path.empty())
+			cout << " to " << _path.c_str();
+		if (_port != 0)
+			cout << " on http://127.0.0.1:" << _port << "/metrics";
+		cout << ", press any key to stop..." << endl;
+
+		LARGE_INTEGER frequency, last, now;
+		QueryPerformanceFrequency(&frequency);
+		QueryPerformanceCounter(&last);
+
+		for (bool isFirst = true; !_kbhit(); isFirst = false)
+		{
+			QueryPerformanceCounter(&now);
+			const double dt = (isFirst ? 0.0 : (double)(now.QuadPart - last.QuadPart) / frequency.QuadPart);
+			last = now;
+
+			Sample(dt);
+			Publish();
+
+			Sleep(_interval);
+		}
+
+		_getch();
+	}
+	catch (...)
+	{
+		Stop();
+		DeleteCriticalSection(&_lock);
+		throw;
+	}
+
+	Stop();
+	DeleteCriticalSection(&_lock);
+}
+
+
+void Exporter::Start()
+{
+	_stop = false;
+
+	if (_port == 0)
+		return;
+
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+		throw std::exception("Winsock initialization failed");
+
+	const SOCKET listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	_listener = listener;
+
+	// local only
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons((u_short)_port);
+
+	if (listener == INVALID_SOCKET
+	    || bind(listener, (const sockaddr*)&address, sizeof(address)) != 0
+	    || listen(listener, SOMAXCONN) != 0)
+		throw std::exception("cannot listen on the specified port");
+
+	_thread = CreateThread(NULL, 0, ServeThread, this, 0, NULL);
+	if (_thread == NULL)
+		throw std::exception("cannot create HTTP thread");
+}
+
+void Exporter::Stop()
+{
+	_stop = true;
+
+	if (_thread != NULL)
+	{
+		WaitForSingleObject(_thread, INFINITE);
+		CloseHandle(_thread);
+		_thread = NULL;
+	}
+
+	if (_port == 0)
+		return;
+
+	if ((SOCKET)_listener != INVALID_SOCKET)
+		closesocket((SOCKET)_listener);
+	_listener = INVALID_SOCKET;
+
+	WSACleanup();
+}
+
+
+void Exporter::Sample(double dt)
+{
+	const Info& info = *_info;
+
+	// other tools may have changed P0 and the boost source (F4x15C) since the
+	// last sample; this costs one read of each per sample, not per core
+	info.InvalidateRegisters();
+
+	// MPERF counts at the P0 frequency
+	const double p0MHz = info.ReadPState(info.NumBoostStates).Multi * 100;
+
+	for (size_t j = 0; j < _cores.size(); j++)
+	{
+		SwitchTo((int)j);
+
+		CoreCounters& c = _cores[j];
+
+		// the time since the last sample is attributed to the P-state seen now
+		c.CurrentPState = info.GetCurrentPState();
+		if (c.CurrentPState >= 0 && c.CurrentPState < (int)c.Residency.size())
+			c.Residency[c.CurrentPState] += dt;
+
+		const QWORD aperf = Rdmsr(APERF);
+		const QWORD mperf = Rdmsr(MPERF);
+		if (_numSamples > 0 && mperf != c.MPerf)
+			c.EffectiveMHz = p0MHz * (aperf - c.APerf) / (mperf - c.MPerf);
+		c.APerf = aperf;
+		c.MPerf = mperf;
+
+		if (info.IsBoostSupported)
+			info.ReadBoostState(c.IsBoostEnabled, _isBoostLocked);
+	}
+
+	_numSamples++;
+}
+
+void Exporter::Publish()
+{
+	ostringstream text;
+
+	text << "# HELP amdmsr_pstate_residency_seconds_total Time spent in each hardware P-state." << endl;
+	text << "# TYPE amdmsr_pstate_residency_seconds_total counter" << endl;
+	for (size_t j = 0; j < _cores.size(); j++)
+	{
+		for (size_t i = 0; i < _cores[j].Residency.size(); i++)
+			text << "amdmsr_pstate_residency_seconds_total{cpu=\"" << j << "\",pstate=\"" << i << "\"} " << _cores[j].Residency[i] << endl;
+	}
+
+	text << "# HELP amdmsr_current_pstate Hardware P-state at the last sample." << endl;
+	text << "# TYPE amdmsr_current_pstate gauge" << endl;
+	for (size_t j = 0; j < _cores.size(); j++)
+		text << "amdmsr_current_pstate{cpu=\"" << j << "\"} " << _cores[j].CurrentPState << endl;
+
+	text << "# HELP amdmsr_effective_frequency_mhz Average frequency while not halted (APERF/MPERF)." << endl;
+	text << "# TYPE amdmsr_effective_frequency_mhz gauge" << endl;
+	for (size_t j = 0; j < _cores.size(); j++)
+		text << "amdmsr_effective_frequency_mhz{cpu=\"" << j << "\"} " << _cores[j].EffectiveMHz << endl;
+
+	text << "# HELP amdmsr_boost_enabled Whether the core may enter boost P-states." << endl;
+	text << "# TYPE amdmsr_boost_enabled gauge" << endl;
+	for (size_t j = 0; j < _cores.size(); j++)
+		text << "amdmsr_boost_enabled{cpu=\"" << j << "\"} " << (_cores[j].IsBoostEnabled ? 1 : 0) << endl;
+
+	text << "# HELP amdmsr_boost_locked Whether the boost configuration is locked." << endl;
+	text << "# TYPE amdmsr_boost_locked gauge" << endl;
+	text << "amdmsr_boost_locked " << (_isBoostLocked ? 1 : 0) << endl;
+
+	text << "# HELP amdmsr_samples_total Number of samples taken." << endl;
+	text << "# TYPE amdmsr_samples_total counter" << endl;
+	text << "amdmsr_samples_total " << _numSamples << endl;
+
+	const string page = text.str();
+
+	if (!_path.empty())
+	{
+		// write a temporary file and rename it, so the collector never sees a partial file
+		const string tempPath = _path + ".tmp";
+
+		std::ofstream file(tempPath.c_str(), std::ios::binary);
+		file << page;
+		file.close();
+
+		if (!file || !MoveFileEx(tempPath.c_str(), _path.c_str(), MOVEFILE_REPLACE_EXISTING))
+			cerr << "ERROR: cannot write " << _path.c_str() << endl;
+	}
+
+	EnterCriticalSection(&_lock);
+	_page = page;
+	LeaveCriticalSection(&_lock);
+}
+
+
+DWORD WINAPI Exporter::ServeThread(LPVOID param)
+{
+	static_cast<Exporter*>(param)->Serve();
+	return 0;
+}
+
+void Exporter::Serve()
+{
+	const SOCKET listener = (SOCKET)_listener;
+
+	while (!_stop)
+	{
+		// wake up regularly to check for the stop flag
+		fd_set readSet;
+		FD_ZERO(&readSet);
+		FD_SET(listener, &readSet);
+		timeval timeout = { 0, 200 * 1000 };
+
+		if (select(0, &readSet, NULL, NULL, &timeout) <= 0)
+			continue;
+
+		const SOCKET client = accept(listener, NULL, NULL);
+		if (client == INVALID_SOCKET)
+			continue;
+
+		// every request gets the metrics
+		char request[1024];
+		recv(client, request, sizeof(request), 0);
+
+		EnterCriticalSection(&_lock);
+		const string body = _page;
+		LeaveCriticalSection(&_lock);
+
+		ostringstream response;
+		response << "HTTP/1.0 200 OK\r\n";
+		response << "Content-Type: text/plain; version=0.0.4\r\n";
+		response << "Content-Length: " << body.length() << "\r\n";
+		response << "Connection: close\r\n\r\n";
+		response << body;
+
+		const string data = response.str();
+		for (size_t sent = 0; sent < data.length(); )
+		{
+			const int n = send(client, data.c_str() + sent, (int)(data.length() - sent), 0);
+			if (n <= 0)
+				break;
+			sent += n;
+		}
+
+		closesocket(client);
+	}
+}
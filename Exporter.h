@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Info.h"
+#include "WinRing0.h"
+
+
+// Samples the P-state of each core periodically and keeps long-lived counters
+// (time in each hardware P-state, effective frequency, boost state), which are
+// published in the Prometheus text format as node-exporter textfile and/or on
+// a local HTTP endpoint. The published text is only rebuilt after a sample,
+// so scraping never touches any register.
+class Exporter
+{
+public:
+
+	Exporter(const Info& info)
+		: _info(&info)
+		, _interval(1000)
+		, _port(0)
+		, _isBoostLocked(false)
+		, _numSamples(0)
+		, _listener(~(UINT_PTR)0)
+		, _thread(NULL)
+		, _stop(false)
+	{ }
+
+	bool ParseParams(int argc, const char* argv[]);
+
+	// runs until a key is pressed
+	void Run();
+
+
+private:
+
+	struct CoreCounters
+	{
+		std::vector<double> Residency; // seconds in each P-state
+		int CurrentPState;
+		double EffectiveMHz;
+		bool IsBoostEnabled;
+		unsigned long long APerf, MPerf;
+	};
+
+	const Info* _info;
+	int _interval;         // sampling interval in ms
+	std::string _path;     // textfile (empty => none)
+	int _port;             // HTTP port on 127.0.0.1 (0 => none)
+
+	std::vector<CoreCounters> _cores;
+	bool _isBoostLocked;
+	unsigned long long _numSamples;
+
+	// published text, shared with the HTTP thread
+	CRITICAL_SECTION _lock;
+	std::string _page;
+	UINT_PTR _listener; // SOCKET
+	HANDLE _thread;
+	volatile bool _stop;
+
+	void Start();
+	void Stop();
+
+	void Sample(double dt);
+	void Publish();
+
+	static DWORD WINAPI ServeThread(LPVOID param);
+	void Serve();
+};
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include <iostream>
+#include <conio.h>
+#include "Hotplug.h"
+#include "Kernels.h"
+#include "StringUtils.h"
+#include "WinRing0.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+
+bool HotplugDaemon::ParseParams(int argc, const char* argv[])
+{
+	// everything else is the profile
+	vector<const char*> profile;
+	profile.push_back("");
+
+	for (int i = 1; i < argc; i++)
+	{
+		const string param(argv[i]);
+
+		string key, value;
+		StringUtils::SplitPair(key, value, param, '=');
+
+		if (_stricmp(key.c_str(), "Interval") == 0)
+		{
+			const int interval = atoi(value.c_str());
+			if (interval > 0)
+			{
+				_interval = interval;
+				continue;
+			}
+
+			cerr << "ERROR: invalid parameter " << param.c_str() << endl;
+			return false;
+		}
+
+		if (_stricmp(key.c_str(), "Format") == 0)
+		{
+			if (ParseOutputFormat(value.c_str(), _format))
+				continue;
+
+			cerr << "ERROR: invalid parameter " << param.c_str() << endl;
+			return false;
+		}
+
+		profile.push_back(argv[i]);
+	}
+
+	if (profile.size() == 1)
+	{
+		cerr << "ERROR: no profile specified" << endl;
+		return false;
+	}
+
+	return _worker.ParseParams((int)profile.size(), &profile[0]);
+}
+
+
+void HotplugDaemon::Start()
+{
+	_worker.ApplyChanges();
+
+	_online.clear();
+	for (int j = 0; j < GetNumLogicalCPUs(); j++)
+		_online.push_back(IsOnline(j));
+
+	_startTime = GetTickCount();
+}
+
+int HotplugDaemon::Poll(RecordWriter& writer)
+{
+	const Info& info = *_info;
+
+	// hot-added CPUs extend the range
+	const int numLogicalCPUs = GetNumLogicalCPUs();
+	if ((int)_online.size() < numLogicalCPUs)
+		_online.resize(numLogicalCPUs, false);
+
+	int numApplied = 0;
+
+	for (int j = 0; j < numLogicalCPUs; j++)
+	{
+		const bool online = IsOnline(j);
+		const bool isNew = (online && !_online[j]);
+		_online[j] = online;
+
+		if (!isNew)
+			continue;
+
+		const double start = GetSeconds();
+
+		// the core has been reinitialized behind the shadow copies
+		info.InvalidateRegisters(j);
+		const int changedPStates = _worker.ApplyToCore(j);
+
+		const double latency = (GetSeconds() - start) * 1000;
+		numApplied++;
+
+		if (_format == FORMAT_TEXT)
+		{
+			cout << "  CPU " << j << " online: profile applied in " << latency << " ms (P-states rewritten:";
+			for (int i = 0; i < info.NumPStates; i++)
+			{
+				if (changedPStates & (1 << i))
+					cout << " P" << i;
+			}
+			cout << (changedPStates == 0 ? " none)" : ")") << endl;
+			continue;
+		}
+
+		int numChanged = 0;
+		for (int i = 0; i < info.NumPStates; i++)
+			numChanged += ((changedPStates >> i) & 1);
+
+		writer.BeginRecord("hotplug");
+		writer.Field("time_ms", (int)(GetTickCount() - _startTime));
+		writer.Field("cpu", j);
+		writer.Field("latency_ms", latency);
+		writer.Field("pstates_rewritten", numChanged);
+		writer.EndRecord();
+		writer.Flush();
+	}
+
+	return numApplied;
+}
+
+
+void HotplugDaemon::Run()
+{
+	Start();
+
+	// keep stdout clean for machine-readable output
+	(_format == FORMAT_TEXT ? cout : cerr) << "Profile applied to " << _online.size() << " logical CPUs, watching for CPUs coming online ("
+		<< _interval << " ms interval), press any key to stop..." << endl;
+
+	RecordWriter writer(stdout, _format);
+
+	while (!_kbhit())
+	{
+		Sleep(_interval);
+		Poll(writer);
+	}
+
+	_getch();
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Info.h"
+#include "RecordWriter.h"
+#include "Worker.h"
+
+
+// "Hotplug" command: applies a profile (a regular parameter list) to all
+// logical CPUs, then watches for CPUs coming online and applies the per-core
+// part of the profile (P-state definitions, CPB, C1E, forced P-state) to
+// just those, as they start with the firmware's settings.
+class HotplugDaemon
+{
+public:
+
+	HotplugDaemon(const Info& info)
+		: _info(&info)
+		, _worker(info)
+		, _interval(10)
+		, _format(FORMAT_TEXT)
+		, _startTime(0)
+	{ }
+
+	bool ParseParams(int argc, const char* argv[]);
+
+	// runs until a key is pressed
+	void Run();
+
+	// applies the profile to all logical CPUs and takes note of the online ones
+	void Start();
+	// applies the profile to the logical CPUs which have come online since the
+	// last call; returns their number
+	int Poll(RecordWriter& writer);
+
+
+private:
+
+	const Info* _info;
+	Worker _worker;
+	int _interval; // polling interval in ms
+	OutputFormat _format;
+
+	std::vector<bool> _online; // per logical CPU, as of the last poll
+	unsigned long _startTime;  // tick count
+};
@@ -1,91 +1,164 @@
-/*
- * Copyright (c) Martin Kinkelin
- *
- * See the "License.txt" file in the root directory for infos
- * about permitted and prohibited uses of this code.
- */
-
-#pragma once
-
-
-struct PStateInfo
-{
-	int Index;    // hardware index
-	double Multi; // internal one for 100 MHz reference
-	int VID;
-	int NBPState;
-	int NBVID; // family 0x10 only
-};
-
-struct NBPStateInfo
-{
-	int Index;
-	double Multi; // for 200 MHz reference
-	int VID;
-};
-
-
-class Info
-{
-public:
-
-	int Family;
-	int Model;
-	int NumCores;
-	int NumPStates;
-	int NumNBPStates;
-
-	double MinMulti, MaxMulti; // internal ones for 100 MHz reference
-	double MaxSoftwareMulti; // for software (i.e., non-boost) P-states
-	double MinVID, MaxVID;
-	double VIDStep;
-	double multiScaleFactor;
-
-	bool IsBoostSupported;
-	bool IsBoostEnabled;
-	bool IsBoostLocked;
-	int NumBoostStates;
-
-
-	Info()
-		: Family(0)
-		, Model(0)
-		, NumCores(0)
-		, NumPStates(0)
-		, NumNBPStates(2) //except family 0x15, we have at least 2 NB P-States
-		, MinMulti(0.0), MaxMulti(0.0)
-		, MaxSoftwareMulti(0.0)
-		, MinVID(0.0), MaxVID(0.0)
-		, VIDStep(0.0125) //default step for pre SVI2 platforms
-		, multiScaleFactor(1.0) //default for 100MHz REFCLK
-		, IsBoostSupported(false)
-		, IsBoostEnabled(false)
-		, IsBoostLocked(false)
-		, NumBoostStates(0)
-	{
-	}
-
-	bool Initialize();
-
-	PStateInfo ReadPState(int index) const;
-	void WritePState(const PStateInfo& info) const;
-
-	NBPStateInfo ReadNBPState(int index) const;
-	void WriteNBPState(const NBPStateInfo& info) const;
-
-	void SetCPBDis(bool enabled) const;
-	void SetBoostSource(bool enabled) const;
-	void SetAPM(bool enabled) const;
-
-	int GetCurrentPState() const;
-	void SetCurrentPState(int index) const;
-
-	double DecodeVID(int vid) const;
-	int EncodeVID(double vid) const;
-
-private:
-
-	double DecodeMulti(int fid, int did) const;
-	void EncodeMulti(double multi, int& fid, int& did) const;
-
-};
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include "RegisterCache.h"
+
+class PStateTable;
+
+
+struct PStateInfo
+{
+	int Index;    // hardware index
+	double Multi; // internal one for 100 MHz reference
+	int VID;
+	int NBPState;
+	int NBVID; // family 0x10 only
+};
+
+struct NBPStateInfo
+{
+	int Index;
+	double Multi; // for 200 MHz reference
+	int VID;
+};
+
+
+class Info
+{
+public:
+
+	int Family;
+	int Model;
+	int NumCores;
+	int NumPStates;
+	int NumNBPStates;
+
+	double MinMulti, MaxMulti; // internal ones for 100 MHz reference
+	double MaxSoftwareMulti; // for software (i.e., non-boost) P-states
+	double MinVID, MaxVID;
+	double VIDStep;
+	double multiScaleFactor;
+
+	bool IsBoostSupported;
+	bool IsBoostEnabled;
+	bool IsBoostLocked;
+	int NumBoostStates;
+
+
+	Info()
+		: Family(0)
+		, Model(0)
+		, NumCores(0)
+		, NumPStates(0)
+		, NumNBPStates(2) //except family 0x15, we have at least 2 NB P-States
+		, MinMulti(0.0), MaxMulti(0.0)
+		, MaxSoftwareMulti(0.0)
+		, MinVID(0.0), MaxVID(0.0)
+		, VIDStep(0.0125) //default step for pre SVI2 platforms
+		, multiScaleFactor(1.0) //default for 100MHz REFCLK
+		, IsBoostSupported(false)
+		, IsBoostEnabled(false)
+		, IsBoostLocked(false)
+		, NumBoostStates(0)
+	{
+	}
+
+	bool Initialize(); // also drops all shadow registers
+
+	// the registers accessed by the methods below are kept as shadow copies
+	// (per logical CPU and node) and updated on writes; the P-state status
+	// and control registers and HWCR only during an epoch (see RegisterEpoch)
+	void LoadRegisters(const PStateTable& table) const; // of all logical CPUs
+	void InvalidateRegisters() const; // after writes by other code
+	void InvalidateRegisters(int logicalCPUIndex) const; // MSRs of a (re)initialized core
+	void BeginEpoch() const;
+	void EndEpoch() const;
+
+	PStateInfo ReadPState(int index) const;
+	// registers are only written if their value changes
+	bool WritePState(const PStateInfo& info) const; // true if written
+
+	NBPStateInfo ReadNBPState(int index) const;
+	void WriteNBPState(const NBPStateInfo& info) const;
+
+	// conversion between raw register values and P-state infos
+	PStateInfo DecodePState(int index, unsigned long long msr) const;
+	void EncodePState(const PStateInfo& info, unsigned long long& msr) const;
+	NBPStateInfo DecodeNBPState(int index, unsigned long eax) const;
+	void EncodeNBPState(const NBPStateInfo& info, unsigned long& eax) const;
+
+	bool IsCPBDisabled() const; // for the current core
+	void ReadBoostState(bool& isEnabled, bool& isLocked) const; // for the current core
+	// from F4x15C and MSRC001_0015
+	void DecodeBoostState(unsigned long boostControl, unsigned long long hwcr, bool& isEnabled, bool& isLocked) const;
+	void SetCPBDis(bool enabled) const;
+	bool IsBoostSourceEnabled() const; // of the node
+	void SetBoostSource(bool enabled) const;
+	bool IsAPMEnabled() const;
+	void SetAPM(bool enabled) const;
+
+	// C1E on CMP halt (MSRC001_0055), families 0x10 - 0x16
+	bool IsC1ESupported() const;
+	bool IsC1EEnabled() const; // for the current core
+	void SetC1E(bool enabled) const; // for the current core
+
+	int GetCurrentPState() const;
+	void SetCurrentPState(int index) const;
+
+	// the MSR reporting the current hardware P-state and its decoding
+	unsigned long GetPStateStatusIndex() const;
+	int DecodeCurrentPState(unsigned long long status) const;
+
+	bool IsSVI2() const; // 8-bit VIDs, 6.25 mV steps
+
+	double DecodeVID(int vid) const;
+	int EncodeVID(double vid) const;
+
+	double DecodeMulti(int fid, int did) const;
+	void EncodeMulti(double multi, int& fid, int& did) const;
+
+
+private:
+
+	mutable RegisterCache _registers;
+
+	// the current logical CPU's MSRs and the first node's PCI registers
+	unsigned long long ReadMsr(unsigned long index, bool isVolatile = false) const;
+	void WriteMsr(unsigned long index, unsigned long long value, bool isVolatile = false) const;
+	unsigned long ReadNodeConfig(unsigned long function, unsigned long regAddress) const;
+	void LoadNodeConfig(unsigned long function, unsigned long regAddress, int count) const; // in one block
+	void WriteNodeConfig(unsigned long function, unsigned long regAddress, unsigned long value) const;
+};
+
+
+// Keeps the P-state status and control registers as shadow copies for the
+// lifetime of the scope, e.g. for operations reading them repeatedly.
+class RegisterEpoch
+{
+public:
+
+	RegisterEpoch(const Info& info)
+		: _info(&info)
+	{
+		info.BeginEpoch();
+	}
+
+	~RegisterEpoch()
+	{
+		_info->EndEpoch();
+	}
+
+
+private:
+
+	const Info* _info;
+
+	RegisterEpoch(const RegisterEpoch&);
+	RegisterEpoch& operator=(const RegisterEpoch&);
+};
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include "Kernels.h"
+#include "WinRing0.h"
+
+
+long long GetTimerTicks()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart;
+}
+
+double GetSeconds()
+{
+	static LARGE_INTEGER frequency = { 0 };
+	if (frequency.QuadPart == 0)
+		QueryPerformanceFrequency(&frequency);
+
+	return (double)GetTimerTicks() / frequency.QuadPart;
+}
+
+
+double RunComputeKernel(unsigned long long iterations)
+{
+	// 4 chains to keep the FP pipelines busy, converging to 1
+	double a = 0.5, b = 0.6, c = 0.7, d = 0.8;
+
+	for (unsigned long long i = 0; i < iterations; i++)
+	{
+		a = a * 0.999999 + 0.000001;
+		b = b * 0.999999 + 0.000001;
+		c = c * 0.999999 + 0.000001;
+		d = d * 0.999999 + 0.000001;
+	}
+
+	return a + b + c + d;
+}
+
+unsigned long long CalibrateComputeKernel(double seconds)
+{
+	// grow the run until it is long enough to be timed reliably
+	unsigned long long iterations = 1 << 16;
+	volatile double checksum = 0.0;
+
+	for (;;)
+	{
+		const double start = GetSeconds();
+		checksum += RunComputeKernel(iterations);
+		const double elapsed = GetSeconds() - start;
+
+		if (elapsed >= 0.02 || iterations >= (1ULL << 40))
+			return (unsigned long long)(iterations * (seconds / (elapsed > 0 ? elapsed : 1e-9))) + 1;
+
+		iterations *= 2;
+	}
+}
+
+
+void RunTriadKernel(double* a, const double* b, const double* c, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		a[i] = b[i] + 3.0 * c[i];
+}
+
+
+void BuildPointerChain(size_t* buffer, size_t numLines)
+{
+	const size_t lineSize = 64 / sizeof(size_t);
+
+	// visit the lines in a shuffled order (rand() only covers 15 bits,
+	// so a xorshift generator is used instead)
+	size_t* order = new size_t[numLines];
+	for (size_t i = 0; i < numLines; i++)
+		order[i] = i;
+
+	unsigned int state = 0x2545f491;
+	for (size_t i = numLines - 1; i > 0; i--)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+
+		const size_t k = state % (i + 1);
+		const size_t temp = order[i];
+		order[i] = order[k];
+		order[k] = temp;
+	}
+
+	// the last line links back to the first one
+	for (size_t i = 0; i < numLines; i++)
+		buffer[order[i] * lineSize] = order[(i + 1) % numLines] * lineSize;
+
+	delete[] order;
+}
+
+size_t RunPointerChase(const size_t* buffer, size_t start, unsigned long long steps)
+{
+	// each load depends on the previous one
+	size_t index = start;
+	for (unsigned long long i = 0; i < steps; i++)
+		index = buffer[index];
+
+	return index;
+}
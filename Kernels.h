@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+
+// Workloads for the benchmarks, run on the calling thread.
+
+// performance counter ticks and seconds since an arbitrary point in time
+long long GetTimerTicks();
+double GetSeconds();
+
+// independent multiply-add chains, 8 floating-point operations per iteration;
+// returns a checksum which must be used to keep the loop from being dropped
+double RunComputeKernel(unsigned long long iterations);
+// number of iterations taking about the specified time at the current speed
+unsigned long long CalibrateComputeKernel(double seconds);
+
+// STREAM triad a[i] = b[i] + 3 * c[i], one pass; 24 bytes of traffic per element
+void RunTriadKernel(double* a, const double* b, const double* c, size_t count);
+
+// links the cache lines (8 entries of 8 bytes each) of the buffer to one random
+// cycle, defeating the prefetchers; each line's first entry indexes the next line
+void BuildPointerChain(size_t* buffer, size_t numLines);
+// follows the chain from the specified entry; returns the entry reached
+size_t RunPointerChase(const size_t* buffer, size_t start, unsigned long long steps);
@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include "Ladder.h"
+#include "StringUtils.h"
+#include "Worker.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::min;
+using std::max;
+using std::string;
+using std::vector;
+
+
+bool LadderGenerator::ParseParams(int argc, const char* argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const string param(argv[i]);
+
+		string key, value;
+		StringUtils::SplitPair(key, value, param, '=');
+
+		if (!value.empty())
+		{
+			if (_stricmp(key.c_str(), "Points") == 0)
+			{
+				vector<string> points;
+				StringUtils::Tokenize(points, value, ",", true);
+
+				bool valid = !points.empty();
+				for (size_t j = 0; j < points.size() && valid; j++)
+				{
+					string multi, vid;
+					StringUtils::SplitPair(multi, vid, points[j], '@');
+
+					valid = (!multi.empty() && !vid.empty());
+					if (valid)
+						AddPoint(atof(multi.c_str()), atof(vid.c_str()));
+				}
+
+				if (valid)
+					continue;
+			}
+
+			if (_stricmp(key.c_str(), "Spread") == 0)
+			{
+				if (_stricmp(value.c_str(), "even") == 0 || _stricmp(value.c_str(), "ppw") == 0)
+				{
+					_perfPerWatt = (_stricmp(value.c_str(), "ppw") == 0);
+					continue;
+				}
+			}
+
+			if (_stricmp(key.c_str(), "Min") == 0)
+			{
+				_minMulti = atof(value.c_str());
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Max") == 0)
+			{
+				_maxMulti = atof(value.c_str());
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Apply") == 0)
+			{
+				const int flag = atoi(value.c_str());
+				if (flag == 0 || flag == 1)
+				{
+					_apply = (flag == 1);
+					continue;
+				}
+			}
+
+			if (_stricmp(key.c_str(), "Snapshot") == 0)
+			{
+				_snapshotPath = value;
+				continue;
+			}
+		}
+
+		cerr << "ERROR: invalid parameter " << param.c_str() << endl;
+		return false;
+	}
+
+	if (_points.empty())
+	{
+		cerr << "ERROR: missing validated points (Points=multi@vid,...)" << endl;
+		return false;
+	}
+
+	if (_apply && !_snapshotPath.empty())
+	{
+		cerr << "ERROR: a ladder generated from a snapshot cannot be applied" << endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+void LadderGenerator::AddPoint(double multi, double voltage)
+{
+	Point p;
+	p.Multi = multi;
+	p.Voltage = voltage;
+	_points.push_back(p);
+}
+
+
+static bool IsLowerMulti(const LadderGenerator::Point& a, const LadderGenerator::Point& b)
+{
+	return a.Multi < b.Multi;
+}
+
+void LadderGenerator::Fit(vector<Point>& curve) const
+{
+	curve = _points;
+	for (size_t i = 0; i < curve.size(); i++)
+		curve[i].Multi *= _info->multiScaleFactor;
+
+	std::stable_sort(curve.begin(), curve.end(), IsLowerMulti);
+
+	// isotonic regression (pool adjacent violators): the voltage must not decrease with the frequency
+	vector<double> sums;
+	vector<int> counts;
+	for (size_t i = 0; i < curve.size(); i++)
+	{
+		sums.push_back(curve[i].Voltage);
+		counts.push_back(1);
+
+		while (sums.size() >= 2)
+		{
+			const size_t last = sums.size() - 1;
+			if (sums[last - 1] / counts[last - 1] <= sums[last] / counts[last])
+				break;
+
+			sums[last - 1] += sums[last];
+			counts[last - 1] += counts[last];
+			sums.pop_back();
+			counts.pop_back();
+		}
+	}
+
+	size_t i = 0;
+	for (size_t block = 0; block < sums.size(); block++)
+	{
+		for (int j = 0; j < counts[block]; j++, i++)
+			curve[i].Voltage = sums[block] / counts[block];
+	}
+
+	// keep the last (i.e., highest) voltage for duplicate multis
+	vector<Point> unique;
+	for (size_t j = 0; j < curve.size(); j++)
+	{
+		if (!unique.empty() && unique.back().Multi == curve[j].Multi)
+			unique.back() = curve[j];
+		else
+			unique.push_back(curve[j]);
+	}
+	curve.swap(unique);
+}
+
+double LadderGenerator::GetVoltage(const vector<Point>& curve, double multi)
+{
+	if (curve.size() == 1)
+		return curve[0].Voltage;
+
+	// interpolate linearly within the enclosing segment, extrapolate with the outermost ones
+	size_t i = 1;
+	while (i < curve.size() - 1 && curve[i].Multi < multi)
+		i++;
+
+	const Point& a = curve[i - 1];
+	const Point& b = curve[i];
+	return a.Voltage + (b.Voltage - a.Voltage) * (multi - a.Multi) / (b.Multi - a.Multi);
+}
+
+double LadderGenerator::GetPower(const vector<Point>& curve, double multi)
+{
+	const double voltage = GetVoltage(curve, multi);
+	return multi * voltage * voltage;
+}
+
+
+void LadderGenerator::Generate(vector<PStateInfo>& ladder) const
+{
+	const Info& info = *_info;
+
+	if (_points.empty())
+		throw std::exception("no validated points specified");
+
+	const int first = info.NumBoostStates;
+	const int count = info.NumPStates - first;
+	if (count < 1)
+		throw std::exception("no software P-states available");
+
+	vector<Point> curve;
+	Fit(curve);
+
+	double top = (_maxMulti > 0 ? _maxMulti * info.multiScaleFactor : curve.back().Multi);
+	double bottom = (_minMulti > 0 ? _minMulti * info.multiScaleFactor : curve.front().Multi);
+	top = min(top, info.MaxSoftwareMulti);
+	bottom = max(bottom, info.MinMulti);
+
+	if (bottom > top)
+		throw std::exception("empty multiplier range for the ladder");
+
+	const double topPower = GetPower(curve, top);
+	const double bottomPower = GetPower(curve, bottom);
+
+	ladder.clear();
+
+	for (int k = 0; k < count; k++)
+	{
+		const double fraction = (count == 1 ? 0.0 : (double)k / (count - 1));
+
+		double multi;
+		if (!_perfPerWatt)
+			multi = top - fraction * (top - bottom);
+		else
+		{
+			// equal steps of the modeled power f*V^2 (monotone in f => bisection)
+			const double power = topPower - fraction * (topPower - bottomPower);
+
+			double low = bottom, high = top;
+			for (int iteration = 0; iteration < 50; iteration++)
+			{
+				const double mid = (low + high) / 2;
+				if (GetPower(curve, mid) < power)
+					low = mid;
+				else
+					high = mid;
+			}
+
+			multi = (low + high) / 2;
+		}
+
+		// round to an encodable multi (never above the requested one)
+		int fid, did;
+		info.EncodeMulti(multi, fid, did);
+		multi = info.DecodeMulti(fid, did);
+
+		double voltage = GetVoltage(curve, multi);
+		if (info.MinVID > 0)
+			voltage = max(voltage, info.MinVID);
+		voltage = min(voltage, info.MaxVID);
+
+		// round to the next VID step not below the fitted voltage
+		int vid = info.EncodeVID(voltage);
+		if (info.DecodeVID(vid) < voltage - 1e-9 && info.DecodeVID(vid - 1) <= info.MaxVID + 1e-9)
+			vid--;
+
+		PStateInfo psi;
+		psi.Index = first + k;
+		psi.Multi = multi;
+		psi.VID = vid;
+		psi.NBPState = -1;
+		psi.NBVID = -1;
+
+		ladder.push_back(psi);
+	}
+}
+
+
+void LadderGenerator::Run()
+{
+	const Info& info = *_info;
+
+	vector<PStateInfo> ladder;
+	Generate(ladder);
+
+	vector<string> params;
+	for (size_t i = 0; i < ladder.size(); i++)
+	{
+		const PStateInfo& psi = ladder[i];
+
+		string param = "P" + StringUtils::ToString(psi.Index) + "=";
+		param += StringUtils::ToString(psi.Multi / info.multiScaleFactor);
+		param += "@" + StringUtils::ToString(info.DecodeVID(psi.VID));
+		params.push_back(param);
+
+		cout << (i == 0 ? "" : " ") << param;
+	}
+	cout << endl;
+
+	if (_apply)
+	{
+		// apply the whole ladder at once, just like specified on the command line
+		vector<const char*> argv;
+		argv.push_back("");
+		for (size_t i = 0; i < params.size(); i++)
+			argv.push_back(params[i].c_str());
+
+		Worker worker(info);
+		if (!worker.ParseParams((int)argv.size(), &argv[0]))
+			throw std::exception("cannot apply the generated ladder");
+
+		worker.ApplyChanges();
+	}
+}
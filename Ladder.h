@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Info.h"
+
+
+// Generates a complete P-state ladder from a few validated (multi, voltage)
+// points by fitting a monotone voltage/frequency curve.
+class LadderGenerator
+{
+public:
+
+	LadderGenerator(const Info& info)
+		: _info(&info)
+		, _perfPerWatt(false)
+		, _minMulti(-1.0)
+		, _maxMulti(-1.0)
+		, _apply(false)
+	{ }
+
+	bool ParseParams(int argc, const char* argv[]);
+
+	const std::string& GetSnapshotPath() const { return _snapshotPath; }
+
+	// multi: external multiplier (as specified by the user), voltage in V
+	void AddPoint(double multi, double voltage);
+	void SetPerfPerWatt(bool perfPerWatt) { _perfPerWatt = perfPerWatt; }
+
+	// fills all enabled software (non-boost) P-states
+	void Generate(std::vector<PStateInfo>& ladder) const;
+
+	// prints the generated ladder as parameters and optionally applies it
+	void Run();
+
+	struct Point
+	{
+		double Multi;
+		double Voltage;
+	};
+
+
+private:
+
+	const Info* _info;
+	std::vector<Point> _points; // external multis
+	bool _perfPerWatt;          // equal power steps instead of equal frequency steps
+	double _minMulti, _maxMulti;
+	bool _apply;
+	std::string _snapshotPath;
+
+	// monotone curve with strictly increasing internal multis
+	void Fit(std::vector<Point>& curve) const;
+	static double GetVoltage(const std::vector<Point>& curve, double multi);
+	static double GetPower(const std::vector<Point>& curve, double multi);
+};
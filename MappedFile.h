@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+
+// Read-only view of a whole file.
+class MappedFile
+{
+public:
+
+	MappedFile()
+		: _file(0)
+		, _mapping(0)
+		, _data(0)
+		, _size(0)
+	{ }
+
+	~MappedFile() { Close(); }
+
+	bool Open(const char* path);
+	void Close();
+
+	const unsigned char* GetData() const { return _data; }
+	size_t GetSize() const { return _size; }
+
+
+private:
+
+	void* _file;    // HANDLE
+	void* _mapping; // HANDLE
+	const unsigned char* _data;
+	size_t _size;
+
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+};
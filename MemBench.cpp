@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <exception>
+#include <iostream>
+#include "MemBench.h"
+#include "Kernels.h"
+#include "StringUtils.h"
+#include "Threads.h"
+#include "WinRing0.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::min;
+using std::string;
+using std::vector;
+
+
+bool MemoryBenchmark::ParseParams(int argc, const char* argv[])
+{
+	const Info& info = *_info;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const string param(argv[i]);
+
+		string key, value;
+		StringUtils::SplitPair(key, value, param, '=');
+
+		if (!value.empty())
+		{
+			if (_stricmp(key.c_str(), "PState") == 0)
+			{
+				const int index = atoi(value.c_str() + (tolower(value[0]) == 'p' ? 1 : 0));
+				if (index >= info.NumBoostStates && index < info.NumPStates)
+				{
+					_pState = index;
+					continue;
+				}
+			}
+
+			if (_stricmp(key.c_str(), "Size") == 0 && atoi(value.c_str()) > 0)
+			{
+				_size = atoi(value.c_str());
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Duration") == 0 && atoi(value.c_str()) > 0)
+			{
+				_duration = atoi(value.c_str());
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Threads") == 0 && atoi(value.c_str()) > 0)
+			{
+				_numThreads = atoi(value.c_str());
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Format") == 0)
+			{
+				if (ParseOutputFormat(value.c_str(), _format))
+					continue;
+			}
+		}
+
+		cerr << "ERROR: invalid parameter " << param.c_str() << endl;
+		return false;
+	}
+
+	if (_pState < 0)
+		_pState = info.NumBoostStates;
+
+	return true;
+}
+
+
+// switches all cores to the specified P-state via another one, so that
+// changed NB settings take effect
+static void EnterPState(const Info& info, int index)
+{
+	const int otherPState = (index == info.NumPStates - 1 ? info.NumBoostStates : info.NumPStates - 1);
+
+	for (int j = 0; j < GetNumLogicalCPUs(); j++)
+	{
+		SwitchTo(j);
+		info.SetCurrentPState(otherPState);
+		Sleep(1);
+		info.SetCurrentPState(index);
+	}
+
+	SwitchTo(-1);
+}
+
+void MemoryBenchmark::PinNBPState(int index) const
+{
+	const Info& info = *_info;
+
+	if (info.Family == 0x15)
+	{
+		// whichever NB P-state is selected, it runs at the pinned one's speed
+		for (int i = 0; i < info.NumNBPStates; i++)
+		{
+			NBPStateInfo nbpsi = _originalNBPStates[index];
+			nbpsi.Index = i;
+			info.WriteNBPState(nbpsi);
+		}
+	}
+	else
+	{
+		for (int j = 0; j < GetNumLogicalCPUs(); j++)
+		{
+			SwitchTo(j);
+
+			// NB_P0 needs the highest NB voltage of all P-states, which is safe for NB_P1 too
+			int nbVID = -1;
+			for (int i = 0; i < info.NumPStates; i++)
+			{
+				const PStateInfo& original = _originalPStates[j][i];
+				if (nbVID < 0 || original.NBVID < nbVID)
+					nbVID = original.NBVID;
+			}
+
+			for (int i = 0; i < info.NumPStates; i++)
+			{
+				PStateInfo psi;
+				psi.Index = i;
+				psi.Multi = psi.VID = -1;
+				psi.NBPState = index;
+				psi.NBVID = nbVID;
+				info.WritePState(psi);
+			}
+		}
+	}
+
+	EnterPState(info, _pState);
+}
+
+void MemoryBenchmark::Restore() const
+{
+	const Info& info = *_info;
+
+	for (size_t i = 0; i < _originalNBPStates.size(); i++)
+		info.WriteNBPState(_originalNBPStates[i]);
+
+	for (int j = 0; j < (int)_originalPStates.size(); j++)
+	{
+		SwitchTo(j);
+
+		for (size_t i = 0; i < _originalPStates[j].size(); i++)
+		{
+			PStateInfo psi = _originalPStates[j][i];
+			psi.Multi = psi.VID = -1;
+			info.WritePState(psi);
+		}
+
+		const int currentPState = _currentPStates[j];
+		info.SetCurrentPState(currentPState == info.NumPStates - 1 ? info.NumBoostStates : info.NumPStates - 1);
+		Sleep(1);
+		info.SetCurrentPState(currentPState);
+	}
+
+	SwitchTo(-1);
+}
+
+
+struct MemoryTask
+{
+	int CPU;
+	bool IsLatency; // pointer chase instead of triad
+	double Duration; // s
+
+	vector<double> A, B, C;
+	vector<size_t> Chain;
+	size_t Position;
+
+	unsigned long long Work; // bytes or accesses
+	double Seconds;
+};
+
+static DWORD WINAPI MemoryThread(LPVOID param)
+{
+	MemoryTask& task = *static_cast<MemoryTask*>(param);
+
+	SwitchTo(task.CPU);
+
+	const size_t count = task.A.size();
+	const unsigned long long steps = 1 << 16;
+
+	task.Work = 0;
+	const double start = GetSeconds();
+
+	do
+	{
+		if (task.IsLatency)
+		{
+			task.Position = RunPointerChase(&task.Chain[0], task.Position, steps);
+			task.Work += steps;
+		}
+		else
+		{
+			RunTriadKernel(&task.A[0], &task.B[0], &task.C[0], count);
+			task.Work += count * 3 * sizeof(double);
+		}
+
+		task.Seconds = GetSeconds() - start;
+	} while (task.Seconds < task.Duration);
+
+	SwitchTo(-1);
+	return 0;
+}
+
+
+void MemoryBenchmark::Run()
+{
+	const Info& info = *_info;
+
+	if (!(info.Family == 0x10 || info.Family == 0x15))
+		throw std::exception("NB P-states not supported");
+
+	const int numLogicalCPUs = GetNumLogicalCPUs();
+	if (_numThreads == 0 || _numThreads > numLogicalCPUs)
+		_numThreads = numLogicalCPUs;
+	_numThreads = min(_numThreads, (int)MAXIMUM_WAIT_OBJECTS);
+
+	// the working sets, touched once before measuring
+	const size_t bytes = (size_t)_size << 20;
+	const size_t count = bytes / (3 * sizeof(double));
+	const size_t numLines = bytes / 64;
+
+	vector<MemoryTask> tasks(_numThreads);
+	for (int t = 0; t < _numThreads; t++)
+	{
+		MemoryTask& task = tasks[t];
+		task.CPU = t;
+		task.Duration = _duration / 1000.0;
+		task.A.assign(count, 0.0);
+		task.B.assign(count, 1.0);
+		task.C.assign(count, 2.0);
+		task.Chain.assign(numLines * 64 / sizeof(size_t), 0);
+		BuildPointerChain(&task.Chain[0], numLines);
+		task.Position = 0;
+	}
+
+	// original configuration (the mapping to NB P-states is per logical CPU)
+	_originalNBPStates.clear();
+	if (info.Family == 0x15)
+	{
+		for (int i = 0; i < info.NumNBPStates; i++)
+			_originalNBPStates.push_back(info.ReadNBPState(i));
+	}
+
+	_originalPStates.assign(numLogicalCPUs, vector<PStateInfo>());
+	_currentPStates.assign(numLogicalCPUs, 0);
+	for (int j = 0; j < numLogicalCPUs; j++)
+	{
+		SwitchTo(j);
+		for (int i = 0; i < info.NumPStates; i++)
+			_originalPStates[j].push_back(info.ReadPState(i));
+		_currentPStates[j] = info.GetCurrentPState();
+	}
+	SwitchTo(-1);
+
+	// family 0x10 has 2 NB P-states, selected by the NbDid of the P-states
+	const int numNBPStates = (info.Family == 0x15 ? info.NumNBPStates : 2);
+
+	// keep stdout clean for machine-readable output
+	std::ostream& status = (_format == FORMAT_TEXT ? cout : cerr);
+	status << "Measuring " << numNBPStates << " NB P-states at P" << _pState << " on " << _numThreads
+	       << " cores (" << _size << " MB per core and kernel)" << endl;
+
+	RecordWriter writer(stdout, _format);
+
+	try
+	{
+		for (int k = 0; k < numNBPStates; k++)
+		{
+			PinNBPState(k);
+
+			for (int t = 0; t < _numThreads; t++)
+				tasks[t].IsLatency = false;
+			ThreadGroup::Run(MemoryThread, tasks);
+
+			double bandwidth = 0.0;
+			for (int t = 0; t < _numThreads; t++)
+				bandwidth += tasks[t].Work / tasks[t].Seconds / 1e9;
+
+			for (int t = 0; t < _numThreads; t++)
+				tasks[t].IsLatency = true;
+			ThreadGroup::Run(MemoryThread, tasks);
+
+			double latency = 0.0;
+			for (int t = 0; t < _numThreads; t++)
+				latency += tasks[t].Seconds * 1e9 / tasks[t].Work / _numThreads;
+
+			if (_format == FORMAT_TEXT)
+			{
+				cout << "  NB_P" << k;
+				if (info.Family == 0x15)
+				{
+					const NBPStateInfo& nbpsi = _originalNBPStates[k];
+					cout << " (" << nbpsi.Multi << "x at " << info.DecodeVID(nbpsi.VID) << "V)";
+				}
+				cout << ": " << bandwidth << " GB/s, " << latency << " ns" << endl;
+				continue;
+			}
+
+			writer.BeginRecord("membench");
+			writer.Field("nb_pstate", k);
+			writer.Field("nb_multi", info.Family == 0x15 ? _originalNBPStates[k].Multi : 0.0);
+			writer.Field("nb_voltage", info.Family == 0x15 ? info.DecodeVID(_originalNBPStates[k].VID) : 0.0);
+			writer.Field("pstate", _pState);
+			writer.Field("bandwidth_gbs", bandwidth);
+			writer.Field("latency_ns", latency);
+			writer.EndRecord();
+			writer.Flush();
+		}
+	}
+	catch (...)
+	{
+		Restore();
+		throw;
+	}
+
+	Restore();
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <vector>
+#include "Info.h"
+#include "RecordWriter.h"
+
+
+// "MemBench" command: pins the NorthBridge to each NB P-state in turn and
+// measures the memory bandwidth (STREAM triad) and latency (pointer chase)
+// on the benchmark cores.
+// Family 0x15: all NB P-state definitions are set to the pinned one.
+// Family 0x10: all P-states are mapped to the pinned NB P-state.
+class MemoryBenchmark
+{
+public:
+
+	MemoryBenchmark(const Info& info)
+		: _info(&info)
+		, _pState(-1)
+		, _size(32)
+		, _duration(500)
+		, _numThreads(0)
+		, _format(FORMAT_TEXT)
+	{ }
+
+	bool ParseParams(int argc, const char* argv[]);
+
+	void Run();
+
+
+private:
+
+	const Info* _info;
+	int _pState;     // core P-state while measuring (-1: the fastest software one)
+	int _size;       // working set of each kernel per thread in MB
+	int _duration;   // per kernel in ms
+	int _numThreads; // 0: one per logical CPU
+	OutputFormat _format;
+
+	// original configuration, restored afterwards
+	std::vector<NBPStateInfo> _originalNBPStates;      // family 0x15
+	std::vector<std::vector<PStateInfo> > _originalPStates; // per logical CPU
+	std::vector<int> _currentPStates;
+
+	void PinNBPState(int index) const;
+	void Restore() const;
+};
@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <exception>
+#include <iostream>
+#include <conio.h>
+#include "Monitor.h"
+#include "PStateTable.h"
+#include "StringUtils.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+static const DWORD APERF = 0xe8;
+static const DWORD MPERF = 0xe7;
+
+static const int LINE_WIDTH = 79;
+
+
+bool Monitor::ParseParams(int argc, const char* argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const string param(argv[i]);
+
+		string key, value;
+		StringUtils::SplitPair(key, value, param, '=');
+
+		if (!value.empty())
+		{
+			if (_stricmp(key.c_str(), "Interval") == 0)
+			{
+				const int interval = atoi(value.c_str());
+				if (interval > 0)
+				{
+					_interval = interval;
+					continue;
+				}
+			}
+		}
+
+		cerr << "ERROR: invalid parameter " << param.c_str() << endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+void Monitor::ReadDefinitions()
+{
+	const Info& info = *_info;
+
+	PStateTable table;
+	table.Read(info);
+	info.LoadRegisters(table);
+
+	_pStates.resize(table.NumCPUs * info.NumPStates);
+	for (int j = 0; j < table.NumCPUs; j++)
+	{
+		for (int i = 0; i < info.NumPStates; i++)
+			_pStates[j * info.NumPStates + i] = table.GetPState(info, j, i);
+	}
+}
+
+void Monitor::Sample(Frame& frame, const Frame& previous)
+{
+	const Info& info = *_info;
+
+	const int numCPUs = (int)frame.Cores.size();
+
+	for (int j = 0; j < numCPUs; j++)
+	{
+		SwitchTo(j);
+
+		CoreSample& c = frame.Cores[j];
+		const CoreSample& last = previous.Cores[j];
+		const PStateInfo* pStates = &_pStates[j * info.NumPStates];
+
+		c.PState = info.GetCurrentPState();
+		if (c.PState >= 0 && c.PState < info.NumPStates)
+		{
+			c.Multi = pStates[c.PState].Multi / info.multiScaleFactor;
+			c.Voltage = info.DecodeVID(pStates[c.PState].VID);
+		}
+
+		// MPERF counts at the P0 frequency
+		c.APerf = Rdmsr(APERF);
+		c.MPerf = Rdmsr(MPERF);
+		c.EffectiveMHz = 0.0;
+		if (previous.Number > 0 && c.MPerf != last.MPerf)
+			c.EffectiveMHz = pStates[info.NumBoostStates].Multi * 100 * (c.APerf - last.APerf) / (c.MPerf - last.MPerf);
+
+		c.IsBoostEnabled = (info.IsBoostSupported && !info.IsCPBDisabled());
+	}
+
+	SwitchTo(-1);
+
+	for (int n = 0; n < _numNodes; n++)
+	{
+		NodeSample& node = frame.Nodes[n];
+		node.NBPState = -1;
+		node.Temperature = -1000.0;
+
+		// no PCI configuration access on family 0x17
+		if (info.Family == 0x17)
+			continue;
+
+		// F3xA4: CurTmp in 1/8 degrees
+		const DWORD tctl = ReadPciConfig(AMD_CPU_DEVICE + n, 3, 0xa4);
+		node.Temperature = GetBits(tctl, 21, 11) * 0.125;
+		if ((info.Family == 0x15 || info.Family == 0x16) && GetBits(tctl, 19, 1) == 1)
+			node.Temperature -= 49;
+
+		if (info.Family == 0x15 || info.Family == 0x16)
+			node.NBPState = (int)GetBits(ReadPciConfig(AMD_CPU_DEVICE + n, 5, 0x174), 19, 2);
+		else if (info.Family == 0x10)
+		{
+			// the NB P-state follows the P-state of the node's first core
+			const int cpu = n * numCPUs / _numNodes;
+			const int pState = frame.Cores[cpu].PState;
+			if (pState >= 0 && pState < info.NumPStates)
+				node.NBPState = _pStates[cpu * info.NumPStates + pState].NBPState;
+		}
+	}
+
+	frame.Number = previous.Number + 1;
+}
+
+
+DWORD WINAPI Monitor::SampleThread(LPVOID param)
+{
+	static_cast<Monitor*>(param)->SampleLoop();
+	return 0;
+}
+
+void Monitor::SampleLoop()
+{
+	// P-state definitions rarely change, re-read them about every 10 seconds
+	const int refreshSamples = 10000 / _interval + 1;
+
+	try
+	{
+		for (int i = 1; !_stop; i++)
+		{
+			Sleep(_interval);
+
+			if (i % refreshSamples == 0)
+				ReadDefinitions();
+
+			// only this thread writes _front
+			Sample(_frames[1 - _front], _frames[_front]);
+
+			EnterCriticalSection(&_lock);
+			_front = 1 - _front;
+			LeaveCriticalSection(&_lock);
+
+			SetEvent(_frameReady);
+		}
+	}
+	catch (const std::exception& e)
+	{
+		_error = e.what();
+		_stop = true;
+		SetEvent(_frameReady);
+	}
+}
+
+
+// appends a formatted line, padded to overwrite the previous frame
+static void AppendLine(string& text, const char* format, ...)
+{
+	char line[LINE_WIDTH + 1];
+
+	va_list args;
+	va_start(args, format);
+	int n = _vsnprintf(line, LINE_WIDTH, format, args);
+	va_end(args);
+
+	if (n < 0 || n > LINE_WIDTH)
+		n = LINE_WIDTH;
+
+	text.append(line, n);
+	text.append(LINE_WIDTH - n, ' ');
+	text += '\n';
+}
+
+void Monitor::Render(const Frame& frame, double ownUsage, string& text) const
+{
+	text.clear();
+
+	AppendLine(text, "sample %llu, every %d ms, monitor CPU usage %.2f%% - press any key to stop",
+		frame.Number, _interval, ownUsage);
+	AppendLine(text, "");
+	AppendLine(text, "  CPU  P-state  multi  voltage  eff. MHz  boost");
+
+	for (size_t j = 0; j < frame.Cores.size(); j++)
+	{
+		const CoreSample& c = frame.Cores[j];
+		AppendLine(text, "  %3d  P%-6d  %5.2f  %6.4fV  %8.0f  %s",
+			(int)j, c.PState, c.Multi, c.Voltage, c.EffectiveMHz, c.IsBoostEnabled ? "on" : "off");
+	}
+
+	AppendLine(text, "");
+	AppendLine(text, "  node  NB P-state  temperature");
+
+	for (size_t n = 0; n < frame.Nodes.size(); n++)
+	{
+		const NodeSample& node = frame.Nodes[n];
+
+		char nbPState[16], temperature[16];
+		if (node.NBPState >= 0)
+			_snprintf(nbPState, sizeof(nbPState), "NB_P%d", node.NBPState);
+		else
+			strcpy_s(nbPState, "-");
+		if (node.Temperature > -100)
+			_snprintf(temperature, sizeof(temperature), "%.1f C", node.Temperature);
+		else
+			strcpy_s(temperature, "-");
+
+		AppendLine(text, "  %4d  %-10s  %s", (int)n, nbPState, temperature);
+	}
+}
+
+
+void Monitor::Run()
+{
+	const Info& info = *_info;
+
+	if (info.Family == 0x10 || info.Family == 0x15)
+		_numNodes = 1 + (int)GetBits(ReadPciConfig(AMD_CPU_DEVICE, 0, 0x60), 4, 3); // F0x60 NodeCnt
+
+	ReadDefinitions();
+
+	CoreSample core;
+	core.PState = -1;
+	core.Multi = core.Voltage = core.EffectiveMHz = 0.0;
+	core.IsBoostEnabled = false;
+	core.APerf = core.MPerf = 0;
+
+	NodeSample node;
+	node.NBPState = -1;
+	node.Temperature = -1000.0;
+
+	Frame empty;
+	empty.Number = 0;
+	empty.Cores.assign(GetNumLogicalCPUs(), core);
+	empty.Nodes.assign(_numNodes, node);
+
+	// the first frame has no effective frequencies yet
+	_frames[0] = _frames[1] = empty;
+	Sample(_frames[0], empty);
+	_front = 0;
+
+	const HANDLE out = GetStdHandle(STD_OUTPUT_HANDLE);
+	CONSOLE_SCREEN_BUFFER_INFO console;
+	const bool isConsole = (GetConsoleScreenBufferInfo(out, &console) != 0);
+	COORD origin = { 0, 0 };
+	bool isFirst = true;
+
+	InitializeCriticalSection(&_lock);
+	_frameReady = CreateEvent(NULL, FALSE, TRUE, NULL);
+	_stop = false;
+	_thread = CreateThread(NULL, 0, SampleThread, this, 0, NULL);
+
+	if (_frameReady == NULL || _thread == NULL)
+	{
+		_stop = true;
+		if (_thread != NULL)
+		{
+			WaitForSingleObject(_thread, INFINITE);
+			CloseHandle(_thread);
+		}
+		if (_frameReady != NULL)
+			CloseHandle(_frameReady);
+		DeleteCriticalSection(&_lock);
+		throw std::exception("cannot create the sampling thread");
+	}
+
+	// CPU time of the whole process (sampler included) per wall-clock time
+	LARGE_INTEGER frequency, lastTime, now;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&lastTime);
+	FILETIME creation, exit, kernel, user;
+	GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+	unsigned long long lastCPUTime = ((unsigned long long)kernel.dwHighDateTime << 32 | kernel.dwLowDateTime)
+	                               + ((unsigned long long)user.dwHighDateTime << 32 | user.dwLowDateTime);
+	double ownUsage = 0.0;
+
+	string text;
+
+	while (!_kbhit() && !_stop)
+	{
+		if (WaitForSingleObject(_frameReady, 100) != WAIT_OBJECT_0)
+			continue;
+
+		QueryPerformanceCounter(&now);
+		const double elapsed = (double)(now.QuadPart - lastTime.QuadPart) / frequency.QuadPart;
+		if (elapsed >= 1.0)
+		{
+			GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+			const unsigned long long cpuTime = ((unsigned long long)kernel.dwHighDateTime << 32 | kernel.dwLowDateTime)
+			                                 + ((unsigned long long)user.dwHighDateTime << 32 | user.dwLowDateTime);
+
+			// 100 ns units
+			ownUsage = (cpuTime - lastCPUTime) / 100000.0 / elapsed;
+			lastCPUTime = cpuTime;
+			lastTime = now;
+		}
+
+		EnterCriticalSection(&_lock);
+		Render(_frames[_front], ownUsage, text);
+		LeaveCriticalSection(&_lock);
+
+		if (!isConsole)
+		{
+			cout << text.c_str() << endl;
+			continue;
+		}
+
+		if (!isFirst)
+			SetConsoleCursorPosition(out, origin);
+
+		DWORD written;
+		WriteConsole(out, text.c_str(), (DWORD)text.length(), &written, NULL);
+
+		// the console may have scrolled, redraw from where the first frame ended up
+		if (isFirst && GetConsoleScreenBufferInfo(out, &console))
+		{
+			const int numLines = (int)std::count(text.begin(), text.end(), '\n');
+			origin.Y = (short)(console.dwCursorPosition.Y - numLines);
+			isFirst = false;
+		}
+	}
+
+	_stop = true;
+	WaitForSingleObject(_thread, INFINITE);
+	CloseHandle(_thread);
+	_thread = NULL;
+	CloseHandle(_frameReady);
+	_frameReady = NULL;
+	DeleteCriticalSection(&_lock);
+
+	if (!_error.empty())
+		throw std::exception(_error.c_str());
+
+	_getch();
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Info.h"
+#include "WinRing0.h"
+
+
+// "Monitor" command: a refreshing console view of the current P-state,
+// effective frequency and boost state of each core and the NB P-state and
+// temperature of each node. A background thread samples the registers into
+// the back one of two frames and flips them; the console thread only renders
+// the front frame and never touches any register.
+class Monitor
+{
+public:
+
+	Monitor(const Info& info)
+		: _info(&info)
+		, _interval(100)
+		, _numNodes(1)
+		, _front(0)
+		, _thread(NULL)
+		, _frameReady(NULL)
+		, _stop(false)
+	{ }
+
+	bool ParseParams(int argc, const char* argv[]);
+
+	// runs until a key is pressed
+	void Run();
+
+
+private:
+
+	struct CoreSample
+	{
+		int PState;
+		double Multi;
+		double Voltage;
+		double EffectiveMHz;
+		bool IsBoostEnabled;
+		unsigned long long APerf, MPerf;
+	};
+
+	struct NodeSample
+	{
+		int NBPState;       // -1 if unknown
+		double Temperature; // degrees Celsius, < -100 if unknown
+	};
+
+	struct Frame
+	{
+		unsigned long long Number;
+		std::vector<CoreSample> Cores;
+		std::vector<NodeSample> Nodes;
+	};
+
+	const Info* _info;
+	int _interval; // refresh interval in ms
+	int _numNodes;
+
+	// decoded P-state definitions, cpu * NumPStates + index; owned by the sampler
+	std::vector<PStateInfo> _pStates;
+
+	Frame _frames[2];
+	int _front; // frame to render, flipped under _lock
+	CRITICAL_SECTION _lock;
+
+	HANDLE _thread;
+	HANDLE _frameReady; // auto-reset, set after each flip
+	volatile bool _stop;
+	std::string _error; // set by the sampler before it stops
+
+	void ReadDefinitions();
+	void Sample(Frame& frame, const Frame& previous);
+
+	static DWORD WINAPI SampleThread(LPVOID param);
+	void SampleLoop();
+
+	void Render(const Frame& frame, double ownUsage, std::string& text) const;
+};
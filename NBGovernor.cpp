@@ -0,0 +1,389 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <conio.h>
+#include "NBGovernor.h"
+#include "StringUtils.h"
+#include "WinRing0.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::min;
+using std::string;
+using std::vector;
+
+// legacy core performance counters (families 0x10 - 0x15)
+static const DWORD PERF_CTL0 = 0xc0010000;
+static const DWORD PERF_CTR0 = 0xc0010004;
+static const int NUM_COUNTERS = 3;
+
+static const DWORD APERF = 0xe8;
+static const DWORD MPERF = 0xe7;
+
+// counters are 48 bits wide
+static const QWORD COUNTER_MASK = ((QWORD)1 << 48) - 1;
+
+// event select and unit mask for PERF_CTL0..2
+static const int EVENTS[NUM_COUNTERS][2] =
+{
+	{ 0xc0, 0x00 }, // retired instructions
+	{ 0x76, 0x00 }, // CPU clocks not halted
+	{ 0x7e, 0x07 }  // L2 cache misses (instruction fills, data fills, TLB walks)
+};
+
+
+static QWORD EncodePerfCtl(int event, int unitMask)
+{
+	QWORD msr = 0;
+	SetBits(msr, event & 0xff, 0, 8);
+	SetBits(msr, unitMask, 8, 8);
+	SetBits(msr, 3, 16, 2); // count in user and OS mode
+	SetBits(msr, 1, 22, 1); // enable
+	SetBits(msr, (event >> 8) & 0xf, 32, 4);
+	return msr;
+}
+
+
+bool NBGovernor::ParseParams(int argc, const char* argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const string param(argv[i]);
+
+		string key, value;
+		StringUtils::SplitPair(key, value, param, '=');
+
+		if (!value.empty())
+		{
+			if (_stricmp(key.c_str(), "Interval") == 0)
+			{
+				const int interval = atoi(value.c_str());
+				if (interval > 0)
+				{
+					_interval = interval;
+					continue;
+				}
+			}
+
+			if (_stricmp(key.c_str(), "NB_low") == 0)
+			{
+				const int index = atoi(value.c_str());
+				if (index >= 0)
+				{
+					_nbLow = index;
+					continue;
+				}
+			}
+
+			if (_stricmp(key.c_str(), "MPKI_high") == 0)
+			{
+				_mpkiHigh = atof(value.c_str());
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "MPKI_low") == 0)
+			{
+				_mpkiLow = atof(value.c_str());
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "IPC_max") == 0)
+			{
+				_maxIPC = atof(value.c_str());
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Format") == 0)
+			{
+				if (ParseOutputFormat(value.c_str(), _format))
+					continue;
+			}
+		}
+
+		cerr << "ERROR: invalid parameter " << param.c_str() << endl;
+		return false;
+	}
+
+	if (_mpkiLow > _mpkiHigh)
+	{
+		cerr << "ERROR: MPKI_low must not exceed MPKI_high" << endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+void NBGovernor::Run()
+{
+	const Info& info = *_info;
+
+	if (!(info.Family == 0x10 || info.Family == 0x15))
+		throw std::exception("NB P-state governor not supported");
+
+	// remember the original configuration (as seen by the current core)
+	_originalPStates.clear();
+	for (int i = 0; i < info.NumPStates; i++)
+		_originalPStates.push_back(info.ReadPState(i));
+
+	if (info.Family == 0x15)
+	{
+		if (info.NumNBPStates < 2)
+			throw std::exception("NB P-state governor requires at least 2 NB P-states");
+
+		_originalNBP0 = info.ReadNBPState(0);
+		_originalNBP1 = info.ReadNBPState(1);
+	}
+
+	StartCounters();
+
+	try
+	{
+		ReadCounters(_lastCounters);
+		SetFast(false);
+
+		// keep stdout clean for machine-readable output
+		(_format == FORMAT_TEXT ? cout : cerr) << "NB governor running (" << _interval << " ms interval), press any key to stop..." << endl;
+
+		RecordWriter writer(stdout, _format);
+		const DWORD startTime = GetTickCount();
+
+		while (!_kbhit())
+		{
+			Sleep(_interval);
+
+			vector<CoreCounters> counters;
+			ReadCounters(counters);
+
+			QWORD instructions = 0, cycles = 0, l2Misses = 0, aperf = 0, mperf = 0;
+			for (size_t j = 0; j < counters.size(); j++)
+			{
+				const CoreCounters& now = counters[j];
+				const CoreCounters& last = _lastCounters[j];
+
+				instructions += (now.Instructions - last.Instructions) & COUNTER_MASK;
+				cycles += (now.Cycles - last.Cycles) & COUNTER_MASK;
+				l2Misses += (now.L2Misses - last.L2Misses) & COUNTER_MASK;
+				aperf += now.APerf - last.APerf;
+				mperf += now.MPerf - last.MPerf;
+			}
+
+			_lastCounters.swap(counters);
+
+			if (instructions == 0 || cycles == 0)
+				continue;
+
+			const double mpki = 1000.0 * l2Misses / instructions;
+			const double ipc = (double)instructions / cycles;
+			const double ratio = (mperf == 0 ? 0.0 : (double)aperf / mperf);
+
+			bool fast = _isFast;
+			if (!_isFast && mpki >= _mpkiHigh && ipc < _maxIPC)
+				fast = true;
+			else if (_isFast && mpki <= _mpkiLow)
+				fast = false;
+
+			const bool changed = (fast != _isFast);
+			if (changed)
+				SetFast(fast);
+
+			if (_format != FORMAT_TEXT)
+			{
+				writer.BeginRecord("nbgov");
+				writer.Field("time_ms", (int)(GetTickCount() - startTime));
+				writer.Field("mpki", mpki);
+				writer.Field("ipc", ipc);
+				writer.Field("aperf_mperf", ratio);
+				writer.Field("fast", fast);
+				writer.Field("changed", changed);
+				writer.EndRecord();
+				writer.Flush();
+			}
+			else if (changed)
+			{
+				cout << "  " << (fast ? "memory-bound " : "compute-bound") << "  MPKI " << mpki
+				     << ", IPC " << ipc << ", APERF/MPERF " << ratio
+				     << " => NB " << (fast ? "fast" : "slow") << endl;
+			}
+		}
+
+		_getch();
+	}
+	catch (...)
+	{
+		StopCounters();
+		Restore();
+		throw;
+	}
+
+	StopCounters();
+	Restore();
+}
+
+
+void NBGovernor::StartCounters()
+{
+	const int numLogicalCPUs = GetNumLogicalCPUs();
+
+	// check all cores before programming any counter
+	vector<QWORD> originalControls;
+	for (int j = 0; j < numLogicalCPUs; j++)
+	{
+		SwitchTo(j);
+
+		for (int i = 0; i < NUM_COUNTERS; i++)
+		{
+			const QWORD ctl = Rdmsr(PERF_CTL0 + i);
+			if (GetBits(ctl, 22, 1) == 1)
+				throw std::exception("performance counters are already in use");
+
+			originalControls.push_back(ctl);
+		}
+	}
+
+	_originalControls.swap(originalControls);
+
+	for (int j = 0; j < numLogicalCPUs; j++)
+	{
+		SwitchTo(j);
+
+		for (int i = 0; i < NUM_COUNTERS; i++)
+			Wrmsr(PERF_CTL0 + i, EncodePerfCtl(EVENTS[i][0], EVENTS[i][1]));
+	}
+}
+
+void NBGovernor::StopCounters()
+{
+	const int numLogicalCPUs = min(GetNumLogicalCPUs(), (int)_originalControls.size() / NUM_COUNTERS);
+
+	for (int j = 0; j < numLogicalCPUs; j++)
+	{
+		SwitchTo(j);
+
+		for (int i = 0; i < NUM_COUNTERS; i++)
+			Wrmsr(PERF_CTL0 + i, _originalControls[j * NUM_COUNTERS + i]);
+	}
+
+	_originalControls.clear();
+}
+
+void NBGovernor::ReadCounters(vector<CoreCounters>& counters) const
+{
+	const int numLogicalCPUs = GetNumLogicalCPUs();
+
+	counters.resize(numLogicalCPUs);
+
+	for (int j = 0; j < numLogicalCPUs; j++)
+	{
+		SwitchTo(j);
+
+		CoreCounters& c = counters[j];
+		c.Instructions = Rdmsr(PERF_CTR0 + 0);
+		c.Cycles = Rdmsr(PERF_CTR0 + 1);
+		c.L2Misses = Rdmsr(PERF_CTR0 + 2);
+		c.APerf = Rdmsr(APERF);
+		c.MPerf = Rdmsr(MPERF);
+	}
+}
+
+
+static void ReenterCurrentPState(const Info& info)
+{
+	// the NB mapping of the current P-state only takes effect after a P-state transition
+	const int currentPState = info.GetCurrentPState();
+	const int tempPState = (currentPState == info.NumPStates - 1 ? 0 : info.NumPStates - 1);
+	info.SetCurrentPState(tempPState);
+	Sleep(1);
+	info.SetCurrentPState(currentPState);
+}
+
+void NBGovernor::SetFast(bool fast)
+{
+	const Info& info = *_info;
+
+	// family 0x15: let NB_P1 run at NB_P0 speed while memory-bound
+	if (info.Family == 0x15)
+	{
+		NBPStateInfo nbp1 = (fast ? _originalNBP0 : _originalNBP1);
+		nbp1.Index = 1;
+		info.WriteNBPState(nbp1);
+	}
+
+	// family 0x10: NB_P0 needs the highest NB voltage of all P-states mapped to it
+	int fastNBVID = -1;
+	if (info.Family == 0x10)
+	{
+		for (size_t i = 0; i < _originalPStates.size(); i++)
+		{
+			const PStateInfo& psi = _originalPStates[i];
+			if (psi.NBPState == 0 && (fastNBVID < 0 || psi.NBVID < fastNBVID))
+				fastNBVID = psi.NBVID;
+		}
+	}
+
+	const int numLogicalCPUs = GetNumLogicalCPUs();
+
+	for (int j = 0; j < numLogicalCPUs; j++)
+	{
+		SwitchTo(j);
+
+		for (int i = 0; i < info.NumPStates; i++)
+		{
+			const PStateInfo& original = _originalPStates[i];
+
+			PStateInfo psi;
+			psi.Index = i;
+			psi.Multi = psi.VID = psi.NBVID = -1;
+
+			if (fast)
+				psi.NBPState = 0;
+			else if (_nbLow >= 0)
+				psi.NBPState = (i < _nbLow ? 0 : 1);
+			else
+				psi.NBPState = original.NBPState;
+
+			if (info.Family == 0x10)
+				psi.NBVID = (psi.NBPState == 0 && fastNBVID >= 0 ? fastNBVID : original.NBVID);
+
+			info.WritePState(psi);
+		}
+
+		ReenterCurrentPState(info);
+	}
+
+	_isFast = fast;
+}
+
+void NBGovernor::Restore()
+{
+	const Info& info = *_info;
+
+	if (info.Family == 0x15)
+		info.WriteNBPState(_originalNBP1);
+
+	const int numLogicalCPUs = GetNumLogicalCPUs();
+
+	for (int j = 0; j < numLogicalCPUs; j++)
+	{
+		SwitchTo(j);
+
+		for (size_t i = 0; i < _originalPStates.size(); i++)
+		{
+			PStateInfo psi = _originalPStates[i];
+			psi.Multi = psi.VID = -1;
+			info.WritePState(psi);
+		}
+
+		ReenterCurrentPState(info);
+	}
+
+	_isFast = false;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <vector>
+#include "Info.h"
+#include "RecordWriter.h"
+
+
+// Switches the NorthBridge between a fast and a slow configuration at runtime,
+// depending on how memory-bound the current workload is.
+// Memory-boundness is estimated via the core performance counters (L2 misses
+// per 1000 retired instructions, IPC) and the APERF/MPERF ratio.
+class NBGovernor
+{
+public:
+
+	NBGovernor(const Info& info)
+		: _info(&info)
+		, _interval(250)
+		, _nbLow(-1)
+		, _mpkiHigh(8.0)
+		, _mpkiLow(2.0)
+		, _maxIPC(1.0)
+		, _format(FORMAT_TEXT)
+		, _isFast(false)
+	{ }
+
+	bool ParseParams(int argc, const char* argv[]);
+
+	// runs until a key is pressed, then restores the original configuration
+	void Run();
+
+
+private:
+
+	struct CoreCounters
+	{
+		unsigned long long Instructions, Cycles, L2Misses;
+		unsigned long long APerf, MPerf;
+	};
+
+	const Info* _info;
+	int _interval;     // sampling interval in ms
+	int _nbLow;        // first P-state using NB_P1 in slow mode (-1: keep the current mapping)
+	double _mpkiHigh;  // L2 misses per 1000 instructions above which a phase is memory-bound
+	double _mpkiLow;   // ... and below which it is compute-bound again
+	double _maxIPC;    // memory-bound phases need an IPC below this limit
+	OutputFormat _format; // JSON/CSV: one record per sample instead of printing transitions
+	bool _isFast;
+
+	std::vector<PStateInfo> _originalPStates;
+	NBPStateInfo _originalNBP0, _originalNBP1;
+	std::vector<unsigned long long> _originalControls; // PERF_CTL0..2 for each logical CPU
+	std::vector<CoreCounters> _lastCounters;
+
+	void StartCounters();
+	void StopCounters();
+	void ReadCounters(std::vector<CoreCounters>& counters) const;
+
+	void SetFast(bool fast);
+	void Restore();
+};
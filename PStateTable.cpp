@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include <algorithm>
+#include <exception>
+#include <string>
+#include "PStateTable.h"
+#include "Threads.h"
+#include "WinRing0.h"
+
+using std::min;
+using std::string;
+using std::vector;
+
+
+struct ReadTask
+{
+	PStateTable* Table;
+	DWORD StatusIndex;
+	int FirstCPU, Stride;
+	string Error;
+};
+
+// reads every Stride-th logical CPU, starting at FirstCPU
+static DWORD WINAPI ReadThread(LPVOID param)
+{
+	ReadTask& task = *static_cast<ReadTask*>(param);
+	PStateTable& table = *task.Table;
+
+	try
+	{
+		for (int cpu = task.FirstCPU; cpu < table.NumCPUs; cpu += task.Stride)
+		{
+			SwitchTo(cpu);
+
+			unsigned long long* pStates = &table.PStates[cpu * table.NumPStates];
+			for (int i = 0; i < table.NumPStates; i++)
+				pStates[i] = Rdmsr(0xc0010064 + i);
+
+			table.PStateStatus[cpu] = Rdmsr(task.StatusIndex);
+			table.HWCR[cpu] = Rdmsr(0xc0010015);
+		}
+	}
+	catch (const std::exception& e)
+	{
+		task.Error = e.what();
+	}
+
+	return 0;
+}
+
+
+void PStateTable::Read(const Info& info)
+{
+	NumCPUs = GetNumLogicalCPUs();
+	NumPStates = info.NumPStates;
+
+	PStates.assign(NumCPUs * NumPStates, 0);
+	PStateStatus.assign(NumCPUs, 0);
+	HWCR.assign(NumCPUs, 0);
+
+	// WaitForMultipleObjects() handles at most 64 threads
+	const int numThreads = min(NumCPUs, (int)MAXIMUM_WAIT_OBJECTS);
+	vector<ReadTask> tasks(numThreads);
+	ThreadGroup threads;
+
+	for (int t = 0; t < numThreads; t++)
+	{
+		ReadTask& task = tasks[t];
+		task.Table = this;
+		task.StatusIndex = info.GetPStateStatusIndex();
+		task.FirstCPU = t;
+		task.Stride = numThreads;
+
+		threads.Start(ReadThread, &task);
+	}
+
+	threads.Wait();
+
+	// unbind this thread if it had to read on its own
+	if (threads.GetNumThreads() < numThreads)
+		SwitchTo(-1);
+
+	for (int t = 0; t < numThreads; t++)
+	{
+		if (!tasks[t].Error.empty())
+			throw std::exception(tasks[t].Error.c_str());
+	}
+
+	Decode(info);
+}
+
+
+void PStateTable::Decode(const Info& info)
+{
+	const int n = (int)PStates.size();
+
+	FIDs.resize(n);
+	DIDs.resize(n);
+	VIDs.resize(n);
+	NBPStates.resize(n);
+	NBVIDs.resize(n);
+	IsEnabled.resize(n);
+
+	const unsigned long long* msrs = (n > 0 ? &PStates[0] : NULL);
+
+	// the layout depends on the family only, so each column is decoded in
+	// a separate branch-free loop
+	const int vidShift = (info.Family == 0x17 ? 14 : 9);
+	const int vidMask = (info.IsSVI2() ? 0xff : 0x7f);
+
+	if (info.Family == 0x12 || info.Family == 0x14)
+	{
+		// DID MSD in FID column, DID LSD in DID column
+		for (int i = 0; i < n; i++)
+			FIDs[i] = (int)(msrs[i] >> 4) & 0x1f;
+		for (int i = 0; i < n; i++)
+			DIDs[i] = (int)msrs[i] & 0xf;
+		for (int i = 0; i < n; i++)
+			NBPStates[i] = -1;
+	}
+	else if (info.Family == 0x17)
+	{
+		// CpuFid and CpuDfsId
+		for (int i = 0; i < n; i++)
+			FIDs[i] = (int)msrs[i] & 0xff;
+		for (int i = 0; i < n; i++)
+			DIDs[i] = (int)(msrs[i] >> 8) & 0x3f;
+		for (int i = 0; i < n; i++)
+			NBPStates[i] = -1;
+	}
+	else
+	{
+		for (int i = 0; i < n; i++)
+			FIDs[i] = (int)msrs[i] & 0x3f;
+		for (int i = 0; i < n; i++)
+			DIDs[i] = (int)(msrs[i] >> 6) & 0x7;
+		for (int i = 0; i < n; i++)
+			NBPStates[i] = (int)(msrs[i] >> 22) & 0x1;
+	}
+
+	for (int i = 0; i < n; i++)
+		VIDs[i] = (int)(msrs[i] >> vidShift) & vidMask;
+
+	if (info.Family == 0x10)
+	{
+		for (int i = 0; i < n; i++)
+			NBVIDs[i] = (int)(msrs[i] >> 25) & 0x7f;
+	}
+	else
+	{
+		for (int i = 0; i < n; i++)
+			NBVIDs[i] = -1;
+	}
+
+	for (int i = 0; i < n; i++)
+		IsEnabled[i] = (unsigned char)(msrs[i] >> 63);
+
+	CurrentPStates.resize(PStateStatus.size());
+	for (size_t j = 0; j < PStateStatus.size(); j++)
+		CurrentPStates[j] = info.DecodeCurrentPState(PStateStatus[j]);
+}
+
+
+PStateInfo PStateTable::GetPState(const Info& info, int cpu, int index) const
+{
+	const int i = cpu * NumPStates + index;
+
+	PStateInfo result;
+	result.Index = index;
+	result.Multi = info.DecodeMulti(FIDs[i], DIDs[i]);
+	result.VID = VIDs[i];
+	result.NBPState = NBPStates[i];
+	result.NBVID = NBVIDs[i];
+
+	return result;
+}
+
+int PStateTable::GetCurrentPState(int cpu) const
+{
+	return CurrentPStates[cpu];
+}
+
+bool PStateTable::IsCPBDisabled(int cpu) const
+{
+	return (GetBits(HWCR[cpu], 25, 1) == 1);
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <vector>
+#include "Info.h"
+
+
+// P-state related MSRs of all logical CPUs, read in one parallel pass.
+// Stored column by column; P-state columns are indexed by
+// cpu * NumPStates + index, the others by cpu.
+class PStateTable
+{
+public:
+
+	int NumCPUs;
+	int NumPStates;
+
+	// raw registers
+	std::vector<unsigned long long> PStates;      // MSRC001_0064 + index
+	std::vector<unsigned long long> PStateStatus; // MSRC001_0071 (MSRC001_0063 on family 0x17)
+	std::vector<unsigned long long> HWCR;         // MSRC001_0015
+
+	// decoded P-state columns (NBPState and NBVID -1 if not supported)
+	std::vector<int> FIDs, DIDs, VIDs, NBPStates, NBVIDs;
+	std::vector<unsigned char> IsEnabled;
+	std::vector<int> CurrentPStates; // hardware index, per CPU
+
+	PStateTable()
+		: NumCPUs(0)
+		, NumPStates(0)
+	{ }
+
+	// reads and decodes the registers of all logical CPUs
+	void Read(const Info& info);
+
+	// decodes the raw P-state registers into the other columns
+	void Decode(const Info& info);
+
+	PStateInfo GetPState(const Info& info, int cpu, int index) const;
+	int GetCurrentPState(int cpu) const;
+	bool IsCPBDisabled(int cpu) const;
+};
@@ -0,0 +1,373 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <iostream>
+#include <conio.h>
+#include "PowerCap.h"
+#include "StringUtils.h"
+#include "WinRing0.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::min;
+using std::max;
+using std::string;
+using std::vector;
+
+
+void PowerEstimator::Initialize()
+{
+	const Info& info = *_info;
+
+	_pStates.clear();
+	for (int i = 0; i < info.NumPStates; i++)
+		_pStates.push_back(info.ReadPState(i));
+
+	// the TDP running average registers are available on family 0x15 models 0x00 - 0x3F
+	_isMeasured = (info.Family == 0x15 && info.Model < 0x40);
+
+	if (_isMeasured)
+	{
+		const DWORD processorTdp = ReadPciConfig(AMD_CPU_DEVICE, 4, 0x1b8);
+		_baseTdp = GetBits(processorTdp, 16, 16);
+
+		const DWORD tdpLimit3 = ReadPciConfig(AMD_CPU_DEVICE, 5, 0xe8);
+		_tdpToWatts = (GetBits(tdpLimit3, 0, 10) << 6) | GetBits(tdpLimit3, 10, 6);
+
+		if (_tdpToWatts == 0)
+			_isMeasured = false;
+	}
+}
+
+double PowerEstimator::Measure() const
+{
+	if (!_isMeasured)
+		throw std::exception("package power measurement not supported");
+
+	const DWORD runningAverage = ReadPciConfig(AMD_CPU_DEVICE, 5, 0xe0);
+	const int range = GetBits(runningAverage, 0, 4) + 1;
+	int capture = GetBits(runningAverage, 4, 22);
+	if (capture & (1 << 21))
+		capture -= (1 << 22); // sign-extend the 22-bit accumulated capacitance
+
+	const DWORD tdpLimit3 = ReadPciConfig(AMD_CPU_DEVICE, 5, 0xe8);
+	const int tdpLimit = GetBits(tdpLimit3, 16, 13);
+
+	// power in units of 15.625 mW * (tdpToWatts / 1024)
+	const double scale = pow(2.0, range);
+	const double units = (tdpLimit + _baseTdp) * scale - capture;
+	return units * _tdpToWatts * 15625.0 / (1024.0 * scale) / 1e6;
+}
+
+double PowerEstimator::Model(const vector<int>& pStates) const
+{
+	const Info& info = *_info;
+
+	double power = 0.0;
+	for (size_t j = 0; j < pStates.size(); j++)
+	{
+		const PStateInfo& psi = _pStates[pStates[j]];
+		const double vid = info.DecodeVID(psi.VID);
+		const double ghz = psi.Multi / 10.0; // internal multi for 100 MHz reference
+
+		power += Cdyn * vid * vid * ghz + StaticPower;
+	}
+
+	return power;
+}
+
+
+
+double PIController::Update(double error, double dt)
+{
+	const double proportional = _kp * error;
+	const double output = proportional + _integral + _ki * error * dt;
+
+	// anti-windup: stop integrating while the output is saturated
+	if (output > _maxOutput)
+	{
+		_integral = max(_minOutput, min(_maxOutput, _maxOutput - proportional));
+		return _maxOutput;
+	}
+	if (output < _minOutput)
+	{
+		_integral = max(_minOutput, min(_maxOutput, _minOutput - proportional));
+		return _minOutput;
+	}
+
+	_integral += _ki * error * dt;
+	return output;
+}
+
+
+
+bool PowerCapGovernor::ParseParams(int argc, const char* argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const string param(argv[i]);
+
+		string key, value;
+		StringUtils::SplitPair(key, value, param, '=');
+
+		if (!value.empty())
+		{
+			const double number = atof(value.c_str());
+
+			if (_stricmp(key.c_str(), "Target") == 0 && number > 0)
+			{
+				_target = number;
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Kp") == 0 && number >= 0)
+			{
+				_kp = number;
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Ki") == 0 && number >= 0)
+			{
+				_ki = number;
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Interval") == 0 && number > 0)
+			{
+				_interval = (int)number;
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Cdyn") == 0 && number > 0)
+			{
+				_estimator.Cdyn = number;
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Static") == 0 && number >= 0)
+			{
+				_estimator.StaticPower = number;
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Simulate") == 0 && number > 0)
+			{
+				_simulate = true;
+				_simSteps = (int)number;
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "SimGain") == 0 && number > 0)
+			{
+				_simGain = number;
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "SimTolerance") == 0 && number > 0)
+			{
+				_simTolerance = number;
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Format") == 0)
+			{
+				if (ParseOutputFormat(value.c_str(), _format))
+					continue;
+			}
+		}
+
+		cerr << "ERROR: invalid parameter " << param.c_str() << endl;
+		return false;
+	}
+
+	if (_target <= 0)
+	{
+		cerr << "ERROR: missing power target (Target=W)" << endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+int PowerCapGovernor::GetMaxLevel(int numLogicalCPUs) const
+{
+	// each logical CPU can be raised from the slowest to the fastest software P-state
+	const int numSteps = _info->NumPStates - _info->NumBoostStates - 1;
+	return numLogicalCPUs * max(0, numSteps);
+}
+
+void PowerCapGovernor::Distribute(int level, vector<int>& pStates) const
+{
+	// spread the level as evenly as possible across all logical CPUs;
+	// as power is convex in frequency, this maximizes the aggregate frequency for a given budget
+	const int numLogicalCPUs = (int)pStates.size();
+	const int base = level / numLogicalCPUs;
+	const int remainder = level % numLogicalCPUs;
+
+	for (int j = 0; j < numLogicalCPUs; j++)
+	{
+		const int steps = base + (j < remainder ? 1 : 0);
+		pStates[j] = _info->NumPStates - 1 - steps;
+	}
+}
+
+void PowerCapGovernor::Apply(const vector<int>& pStates, vector<int>& currentPStates) const
+{
+	for (size_t j = 0; j < pStates.size(); j++)
+	{
+		if (pStates[j] == currentPStates[j])
+			continue;
+
+		SwitchTo((int)j);
+		_info->SetCurrentPState(pStates[j]);
+		currentPStates[j] = pStates[j];
+	}
+}
+
+
+void PowerCapGovernor::Run()
+{
+	const Info& info = *_info;
+
+	const int numLogicalCPUs = GetNumLogicalCPUs();
+	const int maxLevel = GetMaxLevel(numLogicalCPUs);
+	if (maxLevel == 0)
+		throw std::exception("power capping requires at least 2 software P-states");
+
+	_estimator.Initialize();
+
+	const bool isMeasured = (!_simulate && _estimator.IsMeasured());
+	const double dt = _interval / 1000.0;
+
+	PIController controller(_kp, _ki, 0.0, maxLevel);
+
+	vector<double> multis;
+	for (int i = 0; i < info.NumPStates; i++)
+		multis.push_back(info.ReadPState(i).Multi);
+
+	vector<int> pStates(numLogicalCPUs);
+	vector<int> currentPStates(numLogicalCPUs, -1);
+	vector<int> originalPStates(numLogicalCPUs);
+
+	if (!_simulate)
+	{
+		for (int j = 0; j < numLogicalCPUs; j++)
+		{
+			SwitchTo(j);
+			originalPStates[j] = info.GetCurrentPState();
+		}
+	}
+
+	// the simulated plant starts at full speed and follows the modeled power with a lag
+	Distribute(0, pStates);
+	const double minSimulatedPower = _estimator.Model(pStates) * _simGain;
+	Distribute(maxLevel, pStates);
+	const double maxSimulatedPower = _estimator.Model(pStates) * _simGain;
+	double simulatedPower = maxSimulatedPower;
+
+	// simulated power of the last quarter of the steps, after settling
+	const int settledStep = _simSteps - max(1, _simSteps / 4);
+	double settledPower = 0.0;
+	int numSettledSteps = 0;
+
+	// keep stdout clean for machine-readable output
+	std::ostream& status = (_format == FORMAT_TEXT ? cout : cerr);
+	status << "Power cap " << _target << " W, " << (_simulate ? "simulated plant" : (isMeasured ? "measured power" : "modeled power"));
+	status << (_simulate ? "" : ", press any key to stop...") << endl;
+
+	RecordWriter writer(stdout, _format);
+
+	try
+	{
+		for (int step = 0; _simulate ? step < _simSteps : !_kbhit(); step++)
+		{
+			double power;
+			if (_simulate)
+			{
+				power = simulatedPower;
+				if (step >= settledStep)
+				{
+					settledPower += power;
+					numSettledSteps++;
+				}
+			}
+			else if (isMeasured)
+				power = _estimator.Measure();
+			else
+				power = (currentPStates[0] < 0 ? _estimator.Model(pStates) : _estimator.Model(currentPStates));
+
+			const double output = controller.Update(_target - power, dt);
+			const int level = min(maxLevel, (int)(output + 0.5));
+			Distribute(level, pStates);
+
+			if (_simulate)
+			{
+				const double alpha = min(1.0, dt / 1.0); // 1 s time constant
+				simulatedPower += (_estimator.Model(pStates) * _simGain - simulatedPower) * alpha;
+			}
+			else
+			{
+				Apply(pStates, currentPStates);
+				Sleep(_interval);
+			}
+
+			double sumMultis = 0.0;
+			for (int j = 0; j < numLogicalCPUs; j++)
+				sumMultis += multis[pStates[j]];
+
+			if (_format != FORMAT_TEXT)
+			{
+				writer.BeginRecord("powercap");
+				writer.Field("time_s", (step + 1) * dt);
+				writer.Field("power_w", power);
+				writer.Field("target_w", _target);
+				writer.Field("level", level);
+				writer.Field("max_level", maxLevel);
+				writer.Field("avg_mhz", sumMultis / numLogicalCPUs * 100);
+				writer.EndRecord();
+				writer.Flush();
+			}
+			else
+			{
+				cout << "  " << (step + 1) * dt << " s: " << power << " W, level " << level << "/" << maxLevel
+				     << ", avg " << (sumMultis / numLogicalCPUs * 100) << " MHz" << endl;
+			}
+		}
+
+		if (!_simulate)
+			_getch();
+	}
+	catch (...)
+	{
+		if (!_simulate)
+			Apply(originalPStates, currentPStates);
+		throw;
+	}
+
+	if (!_simulate)
+	{
+		Apply(originalPStates, currentPStates);
+		return;
+	}
+
+	// a target out of the plant's range can only be approached by the slowest/fastest level
+	const double reachableTarget = max(minSimulatedPower, min(_target, maxSimulatedPower));
+
+	settledPower /= numSettledSteps;
+	const double deviation = 100.0 * fabs(settledPower - reachableTarget) / reachableTarget;
+
+	status << "Settled at " << settledPower << " W (reachable target " << reachableTarget << " W), "
+	       << deviation << "% off, tolerance " << _simTolerance << "%" << endl;
+
+	if (deviation > _simTolerance)
+		throw std::exception("simulated power did not settle at the target");
+}
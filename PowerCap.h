@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <vector>
+#include "Info.h"
+#include "RecordWriter.h"
+
+
+// Estimates the package power, either via the family 0x15 TDP running
+// average registers or via a C*V^2*f model of the active P-states.
+class PowerEstimator
+{
+public:
+
+	PowerEstimator(const Info& info)
+		: Cdyn(4.0)
+		, StaticPower(1.0)
+		, _info(&info)
+		, _isMeasured(false)
+		, _baseTdp(0)
+		, _tdpToWatts(0)
+	{ }
+
+	void Initialize();
+
+	bool IsMeasured() const { return _isMeasured; }
+
+	// current package power in W read from the running average registers
+	double Measure() const;
+
+	// modeled package power in W if the logical CPUs run the specified hardware P-states
+	double Model(const std::vector<int>& pStates) const;
+
+	double Cdyn;        // effective switched capacitance per core in W/(V^2*GHz)
+	double StaticPower; // static power per core in W
+
+private:
+
+	const Info* _info;
+	bool _isMeasured;
+	int _baseTdp;
+	int _tdpToWatts;
+	std::vector<PStateInfo> _pStates;
+};
+
+
+class PIController
+{
+public:
+
+	PIController(double kp, double ki, double minOutput, double maxOutput)
+		: _kp(kp), _ki(ki)
+		, _minOutput(minOutput), _maxOutput(maxOutput)
+		, _integral(maxOutput)
+	{ }
+
+	// returns the new (clamped) output for the specified error (set point - measurement)
+	double Update(double error, double dt);
+
+private:
+
+	double _kp, _ki;
+	double _minOutput, _maxOutput;
+	double _integral;
+};
+
+
+// Selects per-core P-states so that the package power tracks a set point
+// while maximizing the aggregate frequency.
+class PowerCapGovernor
+{
+public:
+
+	PowerCapGovernor(const Info& info)
+		: _info(&info)
+		, _estimator(info)
+		, _target(-1.0)
+		, _kp(0.1)
+		, _ki(0.5)
+		, _interval(500)
+		, _simulate(false)
+		, _simSteps(100)
+		, _simGain(1.2)
+		, _simTolerance(5.0)
+		, _format(FORMAT_TEXT)
+	{ }
+
+	bool ParseParams(int argc, const char* argv[]);
+
+	// runs until a key is pressed (or for the number of simulated steps);
+	// throws an exception if the simulated plant does not settle at the target
+	void Run();
+
+
+private:
+
+	const Info* _info;
+	PowerEstimator _estimator;
+	double _target;   // set point in W
+	double _kp, _ki;  // controller gains in levels/W and levels/(W*s)
+	int _interval;    // control interval in ms
+	bool _simulate;   // run against a simulated plant instead of the hardware
+	int _simSteps;
+	double _simGain;  // simulated plant power = model power * gain
+	double _simTolerance; // % of the target the settled simulated power may deviate
+	OutputFormat _format;
+
+	int GetMaxLevel(int numLogicalCPUs) const;
+	void Distribute(int level, std::vector<int>& pStates) const;
+	void Apply(const std::vector<int>& pStates, std::vector<int>& currentPStates) const;
+};
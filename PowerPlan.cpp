@@ -0,0 +1,309 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <exception>
+#include <iostream>
+#include <conio.h>
+#include <powrprof.h>
+#include "PowerPlan.h"
+#include "PStateTable.h"
+#include "StringUtils.h"
+#include "WinRing0.h"
+
+#pragma comment(lib, "powrprof.lib")
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+// returned by CallNtPowerInformation(), not declared by the SDK headers
+struct PROCESSOR_POWER_INFORMATION
+{
+	ULONG Number;
+	ULONG MaxMhz;
+	ULONG CurrentMhz;
+	ULONG MhzLimit;
+	ULONG MaxIdleState;
+	ULONG CurrentIdleState;
+};
+
+
+bool PowerPlanSync::ParseParams(int argc, const char* argv[])
+{
+	const Info& info = *_info;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const string param(argv[i]);
+
+		string key, value;
+		StringUtils::SplitPair(key, value, param, '=');
+
+		if (!value.empty())
+		{
+			if (_stricmp(key.c_str(), "Tolerance") == 0 && atoi(value.c_str()) >= 0)
+			{
+				_tolerance = atoi(value.c_str());
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Pause") == 0)
+			{
+				const int flag = atoi(value.c_str());
+				if (flag == 0 || flag == 1)
+				{
+					_pause = (flag == 1);
+					continue;
+				}
+			}
+
+			if (_stricmp(key.c_str(), "PState") == 0)
+			{
+				// the OS only knows the software P-states
+				const int index = atoi(value.c_str() + (tolower(value[0]) == 'p' ? 1 : 0));
+				if (index >= info.NumBoostStates && index < info.NumPStates)
+				{
+					_pState = index;
+					continue;
+				}
+			}
+
+			if (_stricmp(key.c_str(), "Format") == 0)
+			{
+				if (ParseOutputFormat(value.c_str(), _format))
+					continue;
+			}
+		}
+
+		cerr << "ERROR: invalid parameter " << param.c_str() << endl;
+		return false;
+	}
+
+	// forcing a P-state implies holding the OS
+	if (_pState >= 0)
+		_pause = true;
+
+	return true;
+}
+
+
+void PowerPlanSync::ReadProcessors(vector<Processor>& processors) const
+{
+	const int numLogicalCPUs = GetNumLogicalCPUs();
+
+	vector<PROCESSOR_POWER_INFORMATION> infos(numLogicalCPUs);
+	const ULONG size = (ULONG)(infos.size() * sizeof(PROCESSOR_POWER_INFORMATION));
+	if (CallNtPowerInformation(ProcessorInformation, NULL, 0, &infos[0], size) != 0)
+		throw std::exception("cannot query the processor power information");
+
+	processors.resize(numLogicalCPUs);
+	for (int j = 0; j < numLogicalCPUs; j++)
+	{
+		processors[j].MaxMHz = (int)infos[j].MaxMhz;
+		processors[j].CurrentMHz = (int)infos[j].CurrentMhz;
+		processors[j].LimitMHz = (int)infos[j].MhzLimit;
+	}
+}
+
+
+int PowerPlanSync::Compare(const vector<Processor>& processors, RecordWriter& writer) const
+{
+	const Info& info = *_info;
+
+	// the programmed P-states of all logical CPUs
+	PStateTable table;
+	table.Read(info);
+	info.LoadRegisters(table);
+
+	int numMismatches = 0;
+
+	// written after all processor records (one record type after the other)
+	vector<int> mismatches;
+
+	for (int j = 0; j < (int)processors.size(); j++)
+	{
+		const Processor& processor = processors[j];
+
+		if (_format == FORMAT_TEXT)
+		{
+			cout << "  CPU " << j << ": OS maximum " << processor.MaxMHz << " MHz, current " << processor.CurrentMHz
+			     << " MHz, limit " << processor.LimitMHz << " MHz" << endl;
+		}
+		else
+		{
+			writer.BeginRecord("processor");
+			writer.Field("cpu", j);
+			writer.Field("max_mhz", processor.MaxMHz);
+			writer.Field("current_mhz", processor.CurrentMHz);
+			writer.Field("limit_mhz", processor.LimitMHz);
+			writer.EndRecord();
+		}
+
+		// the OS maximum is the frequency of the first ACPI P-state, i.e., software P0
+		const double programmedMHz = table.GetPState(info, j, info.NumBoostStates).Multi * 100;
+		if (fabs(processor.MaxMHz - programmedMHz) <= _tolerance)
+			continue;
+
+		numMismatches++;
+
+		if (_format == FORMAT_TEXT)
+		{
+			cout << "    P" << info.NumBoostStates << ": OS " << processor.MaxMHz << " MHz, programmed " << programmedMHz << " MHz" << endl;
+			continue;
+		}
+
+		mismatches.push_back(j);
+	}
+
+	for (size_t k = 0; k < mismatches.size(); k++)
+	{
+		const int j = mismatches[k];
+		writer.BeginRecord("mismatch");
+		writer.Field("cpu", j);
+		writer.Field("pstate", info.NumBoostStates);
+		writer.Field("os_mhz", (double)processors[j].MaxMHz);
+		writer.Field("programmed_mhz", table.GetPState(info, j, info.NumBoostStates).Multi * 100);
+		writer.EndRecord();
+	}
+
+	writer.Flush();
+
+	return numMismatches;
+}
+
+
+void PowerPlanSync::ReadLimits(const GUID& scheme, Limits& limits)
+{
+	const GUID* subgroup = &GUID_PROCESSOR_SETTINGS_SUBGROUP;
+
+	if (PowerReadACValueIndex(NULL, &scheme, subgroup, &GUID_PROCESSOR_THROTTLE_MINIMUM, &limits.MinAC) != ERROR_SUCCESS
+	    || PowerReadACValueIndex(NULL, &scheme, subgroup, &GUID_PROCESSOR_THROTTLE_MAXIMUM, &limits.MaxAC) != ERROR_SUCCESS
+	    || PowerReadDCValueIndex(NULL, &scheme, subgroup, &GUID_PROCESSOR_THROTTLE_MINIMUM, &limits.MinDC) != ERROR_SUCCESS
+	    || PowerReadDCValueIndex(NULL, &scheme, subgroup, &GUID_PROCESSOR_THROTTLE_MAXIMUM, &limits.MaxDC) != ERROR_SUCCESS)
+		throw std::exception("cannot read the processor state range of the power plan");
+}
+
+void PowerPlanSync::WriteLimits(const GUID& scheme, const Limits& limits)
+{
+	const GUID* subgroup = &GUID_PROCESSOR_SETTINGS_SUBGROUP;
+
+	// keep min <= max at every step
+	const bool ok = (PowerWriteACValueIndex(NULL, &scheme, subgroup, &GUID_PROCESSOR_THROTTLE_MINIMUM, 0) == ERROR_SUCCESS
+		&& PowerWriteACValueIndex(NULL, &scheme, subgroup, &GUID_PROCESSOR_THROTTLE_MAXIMUM, limits.MaxAC) == ERROR_SUCCESS
+		&& PowerWriteACValueIndex(NULL, &scheme, subgroup, &GUID_PROCESSOR_THROTTLE_MINIMUM, limits.MinAC) == ERROR_SUCCESS
+		&& PowerWriteDCValueIndex(NULL, &scheme, subgroup, &GUID_PROCESSOR_THROTTLE_MINIMUM, 0) == ERROR_SUCCESS
+		&& PowerWriteDCValueIndex(NULL, &scheme, subgroup, &GUID_PROCESSOR_THROTTLE_MAXIMUM, limits.MaxDC) == ERROR_SUCCESS
+		&& PowerWriteDCValueIndex(NULL, &scheme, subgroup, &GUID_PROCESSOR_THROTTLE_MINIMUM, limits.MinDC) == ERROR_SUCCESS);
+
+	// the changed values only take effect when the plan is activated again
+	if (!ok || PowerSetActiveScheme(NULL, &scheme) != ERROR_SUCCESS)
+		throw std::exception("cannot write the processor state range of the power plan");
+}
+
+
+void PowerPlanSync::Hold(const GUID& scheme, const Limits& limits) const
+{
+	const Info& info = *_info;
+
+	// the OS selects the slowest P-state at or above the processor state,
+	// in % of the P0 frequency
+	DWORD percent = 100;
+	if (_pState >= 0)
+	{
+		const double p0Multi = info.ReadPState(info.NumBoostStates).Multi;
+		const double multi = info.ReadPState(_pState).Multi;
+		percent = (DWORD)std::min(100.0, ceil(100 * multi / p0Multi));
+	}
+
+	Limits held = limits;
+	held.MinAC = held.MaxAC = held.MinDC = held.MaxDC = percent;
+	WriteLimits(scheme, held);
+
+	if (_pState >= 0)
+	{
+		for (int j = 0; j < GetNumLogicalCPUs(); j++)
+		{
+			SwitchTo(j);
+			info.SetCurrentPState(_pState);
+		}
+
+		SwitchTo(-1);
+	}
+}
+
+
+void PowerPlanSync::Run()
+{
+	vector<Processor> processors;
+	ReadProcessors(processors);
+
+	GUID* activeScheme;
+	if (PowerGetActiveScheme(NULL, &activeScheme) != ERROR_SUCCESS)
+		throw std::exception("cannot get the active power plan");
+	const GUID scheme = *activeScheme;
+	LocalFree(activeScheme);
+
+	Limits limits;
+	ReadLimits(scheme, limits);
+
+	RecordWriter writer(stdout, _format);
+
+	if (_format == FORMAT_TEXT)
+	{
+		cout << "Active power plan: processor state " << limits.MinAC << "-" << limits.MaxAC << "% (AC), "
+		     << limits.MinDC << "-" << limits.MaxDC << "% (DC)" << endl;
+	}
+	else
+	{
+		writer.BeginRecord("plan");
+		writer.Field("min_ac", (int)limits.MinAC);
+		writer.Field("max_ac", (int)limits.MaxAC);
+		writer.Field("min_dc", (int)limits.MinDC);
+		writer.Field("max_dc", (int)limits.MaxDC);
+		writer.EndRecord();
+	}
+
+	const int numMismatches = Compare(processors, writer);
+
+	// keep stdout clean for machine-readable output
+	std::ostream& status = (_format == FORMAT_TEXT ? cout : cerr);
+
+	if (numMismatches > 0)
+		status << numMismatches << " OS maximum frequencies differ from the programmed P0 by more than " << _tolerance << " MHz" << endl;
+
+	if (!_pause)
+	{
+		if (numMismatches > 0)
+			throw std::exception("OS maximum frequency differs from P0");
+		return;
+	}
+
+	try
+	{
+		Hold(scheme, limits);
+
+		const int pState = (_pState >= 0 ? _pState : _info->NumBoostStates);
+		status << "OS held at P" << pState << ", press any key to restore the power plan..." << endl;
+
+		while (!_kbhit())
+			Sleep(250);
+
+		_getch();
+	}
+	catch (...)
+	{
+		WriteLimits(scheme, limits);
+		throw;
+	}
+
+	WriteLimits(scheme, limits);
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <vector>
+#include "Info.h"
+#include "RecordWriter.h"
+
+
+// "PowerPlan" command: coexistence with the Windows processor power
+// management. Reads the OS view of each logical CPU (maximum frequency from
+// the ACPI tables at boot, current frequency and limit) and the processor
+// state range of the active power plan, and compares the OS maximum with the
+// programmed P0. Can hold the OS at one performance state (minimum = maximum
+// processor state) while the tool's own governor or a forced P-state is active.
+class PowerPlanSync
+{
+public:
+
+	PowerPlanSync(const Info& info)
+		: _info(&info)
+		, _tolerance(10)
+		, _pause(false)
+		, _pState(-1)
+		, _format(FORMAT_TEXT)
+	{ }
+
+	bool ParseParams(int argc, const char* argv[]);
+
+	// throws an exception if the OS maximum frequencies differ from P0
+	// (unless the OS is held)
+	void Run();
+
+
+private:
+
+	struct Processor
+	{
+		int MaxMHz, CurrentMHz, LimitMHz;
+	};
+
+	// minimum and maximum processor state of the power plan, in % of the maximum frequency
+	struct Limits
+	{
+		DWORD MinAC, MaxAC;
+		DWORD MinDC, MaxDC;
+	};
+
+	const Info* _info;
+	int _tolerance;    // MHz
+	bool _pause;
+	int _pState;       // forced P-state the OS is held at (-1: none)
+	OutputFormat _format;
+
+	void ReadProcessors(std::vector<Processor>& processors) const;
+	int Compare(const std::vector<Processor>& processors, RecordWriter& writer) const; // number of mismatches
+
+	static void ReadLimits(const GUID& scheme, Limits& limits);
+	static void WriteLimits(const GUID& scheme, const Limits& limits); // and activates them
+
+	void Hold(const GUID& scheme, const Limits& limits) const;
+};
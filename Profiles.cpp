@@ -0,0 +1,442 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include <cctype>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <conio.h>
+#include <windows.h>
+#include <tlhelp32.h>
+#include "Profiles.h"
+#include "StringUtils.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+
+bool ProfileSwitcher::ParseParams(int argc, const char* argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const string param(argv[i]);
+
+		string key, value;
+		StringUtils::SplitPair(key, value, param, '=');
+
+		if (!value.empty())
+		{
+			if (_stricmp(key.c_str(), "Rules") == 0)
+			{
+				_rulesPath = value;
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Interval") == 0)
+			{
+				const int interval = atoi(value.c_str());
+				if (interval > 0)
+				{
+					_interval = interval;
+					continue;
+				}
+			}
+
+			if (_stricmp(key.c_str(), "Target") == 0)
+			{
+				const int target = atoi(value.c_str());
+				if (target > 0)
+				{
+					_target = target;
+					continue;
+				}
+			}
+
+			if (_stricmp(key.c_str(), "Format") == 0)
+			{
+				if (ParseOutputFormat(value.c_str(), _format))
+					continue;
+			}
+		}
+
+		cerr << "ERROR: invalid parameter " << param.c_str() << endl;
+		return false;
+	}
+
+	if (_rulesPath.empty())
+	{
+		cerr << "ERROR: Rules=<file> required" << endl;
+		return false;
+	}
+
+	return LoadRules(_rulesPath.c_str());
+}
+
+
+bool ProfileSwitcher::LoadRules(const char* path)
+{
+	std::ifstream file(path);
+	if (!file)
+	{
+		cerr << "ERROR: cannot read rules " << path << endl;
+		return false;
+	}
+
+	string line;
+	int lineNumber = 0;
+	while (std::getline(file, line))
+	{
+		lineNumber++;
+
+		vector<string> tokens;
+		StringUtils::Tokenize(tokens, line.c_str(), " \t\r", true);
+		if (tokens.empty() || tokens[0][0] == '#')
+			continue;
+
+		const char* keyword = tokens[0].c_str();
+
+		if (_stricmp(keyword, "profile") == 0 && tokens.size() >= 2 && FindProfile(tokens[1]) < 0)
+		{
+			Profile profile;
+			profile.Name = tokens[1];
+			profile.Params.assign(tokens.begin() + 2, tokens.end());
+
+			// validate the command line now rather than when switching
+			vector<const char*> argv;
+			argv.push_back("");
+			for (size_t i = 0; i < profile.Params.size(); i++)
+				argv.push_back(profile.Params[i].c_str());
+
+			Worker worker(*_info);
+			if (!worker.ParseParams((int)argv.size(), &argv[0]))
+			{
+				cerr << "ERROR: invalid profile " << profile.Name.c_str() << " (line " << lineNumber << ")" << endl;
+				return false;
+			}
+
+			_profiles.push_back(profile);
+			continue;
+		}
+
+		if (_stricmp(keyword, "rule") == 0 && tokens.size() == 3 && FindProfile(tokens[2]) >= 0)
+		{
+			Rule rule;
+			rule.Pattern = tokens[1];
+			rule.Profile = FindProfile(tokens[2]);
+			_rules.push_back(rule);
+			continue;
+		}
+
+		if (_stricmp(keyword, "default") == 0 && tokens.size() == 2 && FindProfile(tokens[1]) >= 0)
+		{
+			_defaultProfile = FindProfile(tokens[1]);
+			continue;
+		}
+
+		cerr << "ERROR: invalid rule in line " << lineNumber << ": " << line.c_str() << endl;
+		return false;
+	}
+
+	if (_rules.empty())
+	{
+		cerr << "ERROR: no rules in " << path << endl;
+		return false;
+	}
+
+	return true;
+}
+
+int ProfileSwitcher::FindProfile(const string& name) const
+{
+	for (size_t i = 0; i < _profiles.size(); i++)
+	{
+		if (_stricmp(_profiles[i].Name.c_str(), name.c_str()) == 0)
+			return (int)i;
+	}
+
+	return -1;
+}
+
+
+void ProfileSwitcher::ListProcesses(vector<Process>& processes)
+{
+	processes.clear();
+
+	const HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+	if (snapshot == INVALID_HANDLE_VALUE)
+		throw std::exception("cannot list processes");
+
+	PROCESSENTRY32 entry;
+	entry.dwSize = sizeof(entry);
+
+	if (Process32First(snapshot, &entry))
+	{
+		do
+		{
+			Process process;
+			process.ID = entry.th32ProcessID;
+			process.Name = entry.szExeFile;
+			processes.push_back(process);
+		}
+		while (Process32Next(snapshot, &entry));
+	}
+
+	CloseHandle(snapshot);
+}
+
+double ProfileSwitcher::GetProcessAge(unsigned long id)
+{
+	const HANDLE process = OpenProcess(PROCESS_QUERY_INFORMATION, FALSE, id);
+	if (process == NULL)
+		return -1.0;
+
+	FILETIME creation, exit, kernel, user, now;
+	const BOOL ok = GetProcessTimes(process, &creation, &exit, &kernel, &user);
+	CloseHandle(process);
+
+	if (!ok)
+		return -1.0;
+
+	GetSystemTimeAsFileTime(&now);
+
+	// 100 ns units
+	ULARGE_INTEGER start, end;
+	start.LowPart = creation.dwLowDateTime;
+	start.HighPart = creation.dwHighDateTime;
+	end.LowPart = now.dwLowDateTime;
+	end.HighPart = now.dwHighDateTime;
+
+	return (end.QuadPart - start.QuadPart) / 10000.0;
+}
+
+
+// case-insensitive, * matches any sequence, ? any character
+static bool MatchesPattern(const char* pattern, const char* name)
+{
+	for (; *pattern != 0; pattern++, name++)
+	{
+		if (*pattern == '*')
+		{
+			for (; ; name++)
+			{
+				if (MatchesPattern(pattern + 1, name))
+					return true;
+				if (*name == 0)
+					return false;
+			}
+		}
+
+		if (*name == 0 || (*pattern != '?' && tolower(*pattern) != tolower(*name)))
+			return false;
+	}
+
+	return (*name == 0);
+}
+
+
+// the current configuration (of the current core) as regular parameters
+void ProfileSwitcher::ReadBaseline()
+{
+	const Info& info = *_info;
+
+	_baseline.clear();
+
+	vector<PStateInfo> pStates;
+	for (int i = 0; i < info.NumPStates; i++)
+	{
+		pStates.push_back(info.ReadPState(i));
+		const PStateInfo& psi = pStates.back();
+
+		// reserved encodings (unused P-states) cannot be written back
+		if (psi.Multi <= 0)
+			continue;
+
+		_baseline.push_back("P" + StringUtils::ToString(i) + "=" + StringUtils::ToString(psi.Multi / info.multiScaleFactor)
+		                    + "@" + StringUtils::ToString(info.DecodeVID(psi.VID)));
+	}
+
+	if (info.Family == 0x15)
+	{
+		for (int i = 0; i < info.NumNBPStates; i++)
+		{
+			const NBPStateInfo nbpsi = info.ReadNBPState(i);
+			_baseline.push_back("NB_P" + StringUtils::ToString(i) + "=" + StringUtils::ToString(nbpsi.Multi)
+			                    + "@" + StringUtils::ToString(info.DecodeVID(nbpsi.VID)));
+		}
+
+		_baseline.push_back(string("APM=") + (info.IsAPMEnabled() ? "1" : "0"));
+	}
+
+	if (info.Family == 0x10 || info.Family == 0x15)
+	{
+		// NB_low only expresses a mapping of the fastest P-states to NB_P0
+		int nbLow = 0;
+		while (nbLow < info.NumPStates && pStates[nbLow].NBPState == 0)
+			nbLow++;
+
+		bool isMonotonic = true;
+		for (int i = nbLow; i < info.NumPStates; i++)
+			isMonotonic &= (pStates[i].NBPState == 1);
+
+		if (isMonotonic)
+			_baseline.push_back("NB_low=" + StringUtils::ToString(nbLow));
+		else
+			cerr << "WARNING: the NB P-state mapping of the P-states is not restored" << endl;
+	}
+
+	if (info.Family == 0x10)
+	{
+		// the NB voltage is per P-state; restorable if the same for all P-states of an NB P-state
+		for (int k = 0; k < info.NumNBPStates; k++)
+		{
+			int nbVID = -1;
+			bool isUniform = true;
+			for (int i = 0; i < info.NumPStates; i++)
+			{
+				if (pStates[i].NBPState != k)
+					continue;
+				isUniform &= (nbVID < 0 || nbVID == pStates[i].NBVID);
+				nbVID = pStates[i].NBVID;
+			}
+
+			if (nbVID >= 0 && isUniform)
+				_baseline.push_back("NB_P" + StringUtils::ToString(k) + "=@" + StringUtils::ToString(info.DecodeVID(nbVID)));
+		}
+	}
+
+	if (info.IsBoostSupported)
+		_baseline.push_back(string("Turbo=") + (info.IsBoostEnabled ? "1" : "0"));
+	if (info.IsC1ESupported())
+		_baseline.push_back(string("C1E=") + (info.IsC1EEnabled() ? "1" : "0"));
+}
+
+void ProfileSwitcher::Apply(const vector<string>& params)
+{
+	// later parameters override the baseline ones
+	vector<const char*> argv;
+	argv.push_back("");
+	for (size_t i = 0; i < _baseline.size(); i++)
+		argv.push_back(_baseline[i].c_str());
+	for (size_t i = 0; i < params.size(); i++)
+		argv.push_back(params[i].c_str());
+
+	if (!_worker.ParseParams((int)argv.size(), &argv[0]))
+		throw std::exception("invalid profile");
+
+	// other tools may have changed the registers since the last switch
+	_info->InvalidateRegisters();
+
+	// only registers whose values change are written
+	_worker.ApplyChanges();
+}
+
+void ProfileSwitcher::Apply(int profile)
+{
+	Apply(profile >= 0 ? _profiles[profile].Params : vector<string>());
+	_activeProfile = profile;
+}
+
+void ProfileSwitcher::Run()
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	// keep stdout clean for machine-readable output
+	(_format == FORMAT_TEXT ? cout : cerr) << "profile switcher running (" << _interval << " ms interval), press any key to stop..." << endl;
+
+	ReadBaseline();
+
+	RecordWriter writer(stdout, _format);
+	vector<Process> processes;
+	bool isFirst = true;
+
+	try
+	{
+		while (!_kbhit())
+		{
+			ListProcesses(processes);
+
+			// the first rule matching any process wins; without a default
+			// profile, the original configuration applies if none matches
+			int profile = _defaultProfile;
+			const Process* trigger = NULL;
+
+			for (size_t r = 0; r < _rules.size() && trigger == NULL; r++)
+			{
+				for (size_t k = 0; k < processes.size(); k++)
+				{
+					if (MatchesPattern(_rules[r].Pattern.c_str(), processes[k].Name.c_str()))
+					{
+						profile = _rules[r].Profile;
+						trigger = &processes[k];
+						break;
+					}
+				}
+			}
+
+			if (profile != _activeProfile)
+			{
+				LARGE_INTEGER start, end;
+				QueryPerformanceCounter(&start);
+				Apply(profile);
+				QueryPerformanceCounter(&end);
+
+				const double applyMs = (end.QuadPart - start.QuadPart) * 1000.0 / frequency.QuadPart;
+
+				// from the start of a newly seen process until now
+				const bool isNew = (!isFirst && trigger != NULL && _knownProcesses.count(trigger->ID) == 0);
+				const double latencyMs = (isNew ? GetProcessAge(trigger->ID) : -1.0);
+				const char* name = (profile >= 0 ? _profiles[profile].Name.c_str() : "(original)");
+
+				if (_format == FORMAT_TEXT)
+				{
+					cout << "  profile " << name << " applied";
+					if (trigger != NULL)
+						cout << " for " << trigger->Name.c_str() << " (PID " << trigger->ID << ")";
+					cout << " in " << applyMs << " ms";
+					if (latencyMs >= 0)
+						cout << ", " << latencyMs << " ms after the process start";
+					cout << endl;
+				}
+				else
+				{
+					writer.BeginRecord("profile");
+					writer.Field("profile", name);
+					writer.Field("process", trigger != NULL ? trigger->Name.c_str() : "");
+					writer.Field("pid", trigger != NULL ? (int)trigger->ID : -1);
+					writer.Field("apply_ms", applyMs);
+					writer.Field("latency_ms", latencyMs);
+					writer.EndRecord();
+					writer.Flush();
+				}
+
+				if (latencyMs > _target)
+					cerr << "WARNING: profile applied " << latencyMs << " ms after the process start (target " << _target << " ms)" << endl;
+			}
+
+			_knownProcesses.clear();
+			for (size_t k = 0; k < processes.size(); k++)
+				_knownProcesses.insert(processes[k].ID);
+
+			isFirst = false;
+			Sleep(_interval);
+		}
+
+		_getch();
+	}
+	catch (...)
+	{
+		Apply(vector<string>());
+		throw;
+	}
+
+	// back to the original configuration
+	Apply(vector<string>());
+}
\ No newline at end of file
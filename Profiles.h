@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <set>
+#include <string>
+#include <vector>
+#include "Info.h"
+#include "RecordWriter.h"
+#include "Worker.h"
+
+
+// "Profiles" command: polls the running processes and applies the profile
+// (a regular command line) of the first rule matching any of them.
+// Profiles are absolute: each one is applied on top of the configuration
+// found at the start, which is restored on exit.
+// Rules file:
+//   profile <name> <params...>
+//   rule <process name pattern, * and ? wildcards> <profile name>
+//   default <profile name>   (applied if no rule matches)
+class ProfileSwitcher
+{
+public:
+
+	ProfileSwitcher(const Info& info)
+		: _info(&info)
+		, _worker(info)
+		, _interval(50)
+		, _target(100)
+		, _format(FORMAT_TEXT)
+		, _defaultProfile(-1)
+		, _activeProfile(-1)
+	{ }
+
+	bool ParseParams(int argc, const char* argv[]);
+
+	// runs until a key is pressed
+	void Run();
+
+
+private:
+
+	struct Profile
+	{
+		std::string Name;
+		std::vector<std::string> Params;
+	};
+
+	struct Rule
+	{
+		std::string Pattern;
+		int Profile;
+	};
+
+	struct Process
+	{
+		unsigned long ID;
+		std::string Name;
+	};
+
+	const Info* _info;
+	Worker _worker; // reused for all profiles
+	std::string _rulesPath;
+	int _interval; // polling interval in ms
+	int _target;   // max. ms from process start to applied profile
+	OutputFormat _format;
+
+	std::vector<std::string> _baseline; // original configuration as parameters
+	std::vector<Profile> _profiles;
+	std::vector<Rule> _rules;
+	int _defaultProfile;
+	int _activeProfile;
+	std::set<unsigned long> _knownProcesses;
+
+	bool LoadRules(const char* path);
+	int FindProfile(const std::string& name) const;
+
+	static void ListProcesses(std::vector<Process>& processes);
+	static double GetProcessAge(unsigned long id); // ms, < 0 if unknown
+
+	void ReadBaseline();
+	void Apply(const std::vector<std::string>& params); // on top of the baseline
+	void Apply(int profile); // -1: the baseline
+};
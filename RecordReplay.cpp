@@ -0,0 +1,457 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include "Info.h"
+#include "Kernels.h"
+#include "MappedFile.h"
+#include "RecordReplay.h"
+#include "StringUtils.h"
+#include "Worker.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::min;
+using std::string;
+using std::vector;
+
+static const unsigned int LOG_VERSION = 1;
+
+
+static DWORD PciAddress(DWORD device, DWORD function, DWORD regAddress)
+{
+	return (device << 16) | (function << 12) | (regAddress & 0xfff);
+}
+
+static string Describe(RegisterOp op, int cpu, DWORD address)
+{
+	string result;
+
+	if (op == OP_READ_PCI || op == OP_WRITE_PCI)
+	{
+		result = "F" + StringUtils::ToString((address >> 12) & 0xf) + "x" + StringUtils::ToHexString(address & 0xfff);
+		return result;
+	}
+
+	result = (op == OP_CPUID ? "CPUID 0x" : "MSR 0x") + StringUtils::ToHexString(address);
+	if (cpu >= 0)
+		result += " on CPU " + StringUtils::ToString(cpu);
+
+	return result;
+}
+
+
+RecordingBackend::~RecordingBackend()
+{
+	Close();
+	DeleteCriticalSection(&_lock);
+}
+
+bool RecordingBackend::Open(const char* path, const vector<string>& commandLine)
+{
+	Close();
+
+	string args;
+	for (size_t i = 0; i < commandLine.size(); i++)
+	{
+		if (i > 0)
+			args += '\n';
+		args += commandLine[i];
+	}
+
+	_file = fopen(path, "wb");
+	if (!_file)
+		return false;
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	RegisterLogHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.Magic, "AMRL", 4);
+	header.Version = LOG_VERSION;
+	header.CommandLineLength = (unsigned int)args.length();
+	header.TimerFrequency = frequency.QuadPart;
+
+	_start = GetTimerTicks();
+
+	return (fwrite(&header, sizeof(header), 1, _file) == 1
+	        && fwrite(args.c_str(), 1, args.length(), _file) == args.length());
+}
+
+bool RecordingBackend::Close()
+{
+	if (!_file)
+		return true;
+
+	const bool success = (fclose(_file) == 0);
+	_file = NULL;
+
+	return success;
+}
+
+
+void RecordingBackend::Log(RegisterOp op, DWORD address, QWORD value0, QWORD value1)
+{
+	RegisterLogEntry entry;
+	entry.Op = op;
+	entry.CPU = (op == OP_READ_PCI || op == OP_WRITE_PCI || op == OP_NUM_CPUS ? -1 : GetCurrentCPU());
+	entry.Address = address;
+	entry.Reserved = 0;
+	entry.Value[0] = value0;
+	entry.Value[1] = value1;
+	entry.Time = (QWORD)(GetTimerTicks() - _start);
+
+	EnterCriticalSection(&_lock);
+	if (_file)
+		fwrite(&entry, sizeof(entry), 1, _file);
+	LeaveCriticalSection(&_lock);
+}
+
+DWORD RecordingBackend::ReadPciConfig(DWORD device, DWORD function, DWORD regAddress)
+{
+	const DWORD result = _inner->ReadPciConfig(device, function, regAddress);
+	Log(OP_READ_PCI, PciAddress(device, function, regAddress), result);
+	return result;
+}
+
+void RecordingBackend::WritePciConfig(DWORD device, DWORD function, DWORD regAddress, DWORD value)
+{
+	_inner->WritePciConfig(device, function, regAddress, value);
+	Log(OP_WRITE_PCI, PciAddress(device, function, regAddress), value);
+}
+
+QWORD RecordingBackend::Rdmsr(DWORD index)
+{
+	const QWORD result = _inner->Rdmsr(index);
+	Log(OP_RDMSR, index, result);
+	return result;
+}
+
+void RecordingBackend::Wrmsr(DWORD index, const QWORD& value)
+{
+	_inner->Wrmsr(index, value);
+	Log(OP_WRMSR, index, value);
+}
+
+CpuidRegs RecordingBackend::Cpuid(DWORD index)
+{
+	const CpuidRegs result = _inner->Cpuid(index);
+	Log(OP_CPUID, index, result.eax | ((QWORD)result.ebx << 32), result.ecx | ((QWORD)result.edx << 32));
+	return result;
+}
+
+int RecordingBackend::GetNumLogicalCPUs()
+{
+	const int result = _inner->GetNumLogicalCPUs();
+	Log(OP_NUM_CPUS, 0, result);
+	return result;
+}
+
+void RecordingBackend::SwitchTo(int logicalCPUIndex)
+{
+	_inner->SwitchTo(logicalCPUIndex);
+}
+
+bool RecordingBackend::IsOnline(int logicalCPUIndex)
+{
+	// not a register access, not logged
+	return _inner->IsOnline(logicalCPUIndex);
+}
+
+
+void ReplayBackend::Load(const vector<RegisterLogEntry>& entries)
+{
+	_queues.clear();
+
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		const RegisterLogEntry& entry = entries[i];
+
+		if (entry.Op == OP_NUM_CPUS)
+			_numCPUs = (int)entry.Value[0];
+
+		Key key;
+		key.Op = entry.Op;
+		key.CPU = entry.CPU;
+		key.Address = entry.Address;
+
+		_queues[key].Entries.push_back(entry);
+	}
+
+	Rewind();
+}
+
+void ReplayBackend::Rewind()
+{
+	for (QueueMap::iterator it = _queues.begin(); it != _queues.end(); ++it)
+		it->second.Next = 0;
+
+	_mismatches.clear();
+}
+
+void ReplayBackend::Finish()
+{
+	for (QueueMap::const_iterator it = _queues.begin(); it != _queues.end(); ++it)
+	{
+		const Key& key = it->first;
+		const Queue& queue = it->second;
+
+		if ((key.Op == OP_WRITE_PCI || key.Op == OP_WRMSR) && queue.Next < queue.Entries.size())
+		{
+			_mismatches.push_back(Describe((RegisterOp)key.Op, key.CPU, key.Address) + ": "
+				+ StringUtils::ToString(queue.Entries.size() - queue.Next) + " recorded write(s) missing");
+		}
+	}
+}
+
+
+RegisterLogEntry ReplayBackend::Read(RegisterOp op, int cpu, DWORD address)
+{
+	Key key;
+	key.Op = op;
+	key.CPU = cpu;
+	key.Address = address;
+
+	EnterCriticalSection(&_lock);
+
+	QueueMap::iterator it = _queues.find(key);
+	if (it == _queues.end())
+	{
+		LeaveCriticalSection(&_lock);
+
+		const string msg = "no recorded value for " + Describe(op, cpu, address);
+		throw std::exception(msg.c_str());
+	}
+
+	Queue& queue = it->second;
+	const RegisterLogEntry entry = queue.Entries[min(queue.Next, queue.Entries.size() - 1)];
+	if (queue.Next < queue.Entries.size())
+		queue.Next++;
+
+	LeaveCriticalSection(&_lock);
+
+	return entry;
+}
+
+void ReplayBackend::Write(RegisterOp op, int cpu, DWORD address, QWORD value)
+{
+	Key key;
+	key.Op = op;
+	key.CPU = cpu;
+	key.Address = address;
+
+	EnterCriticalSection(&_lock);
+
+	QueueMap::iterator it = _queues.find(key);
+	if (it == _queues.end() || it->second.Next >= it->second.Entries.size())
+	{
+		_mismatches.push_back(Describe(op, cpu, address) + ": unexpected write of 0x" + StringUtils::ToHexString(value));
+	}
+	else
+	{
+		Queue& queue = it->second;
+		const QWORD expected = queue.Entries[queue.Next++].Value[0];
+
+		if (value != expected)
+		{
+			_mismatches.push_back(Describe(op, cpu, address) + ": wrote 0x" + StringUtils::ToHexString(value)
+				+ ", recorded 0x" + StringUtils::ToHexString(expected));
+		}
+	}
+
+	LeaveCriticalSection(&_lock);
+}
+
+DWORD ReplayBackend::ReadPciConfig(DWORD device, DWORD function, DWORD regAddress)
+{
+	return (DWORD)Read(OP_READ_PCI, -1, PciAddress(device, function, regAddress)).Value[0];
+}
+
+void ReplayBackend::WritePciConfig(DWORD device, DWORD function, DWORD regAddress, DWORD value)
+{
+	Write(OP_WRITE_PCI, -1, PciAddress(device, function, regAddress), value);
+}
+
+QWORD ReplayBackend::Rdmsr(DWORD index)
+{
+	return Read(OP_RDMSR, GetCurrentCPU(), index).Value[0];
+}
+
+void ReplayBackend::Wrmsr(DWORD index, const QWORD& value)
+{
+	Write(OP_WRMSR, GetCurrentCPU(), index, value);
+}
+
+CpuidRegs ReplayBackend::Cpuid(DWORD index)
+{
+	const RegisterLogEntry entry = Read(OP_CPUID, GetCurrentCPU(), index);
+
+	CpuidRegs result;
+	result.eax = (DWORD)entry.Value[0];
+	result.ebx = (DWORD)(entry.Value[0] >> 32);
+	result.ecx = (DWORD)entry.Value[1];
+	result.edx = (DWORD)(entry.Value[1] >> 32);
+
+	return result;
+}
+
+int ReplayBackend::GetNumLogicalCPUs()
+{
+	return _numCPUs;
+}
+
+void ReplayBackend::SwitchTo(int logicalCPUIndex)
+{
+	// the current CPU is tracked by the caller
+}
+
+
+bool ReplayRunner::ParseParams(int argc, const char* argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const string param(argv[i]);
+
+		string key, value;
+		StringUtils::SplitPair(key, value, param, '=');
+
+		if (!value.empty())
+		{
+			if (_stricmp(key.c_str(), "Log") == 0)
+			{
+				_path = value;
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Runs") == 0)
+			{
+				const int numRuns = atoi(value.c_str());
+				if (numRuns > 0)
+				{
+					_numRuns = numRuns;
+					continue;
+				}
+			}
+		}
+
+		cerr << "ERROR: invalid parameter " << param.c_str() << endl;
+		return false;
+	}
+
+	if (_path.empty())
+	{
+		cerr << "ERROR: missing log file (Log=path)" << endl;
+		return false;
+	}
+
+	return true;
+}
+
+void ReplayRunner::Run()
+{
+	MappedFile log;
+	if (!log.Open(_path.c_str()))
+		throw std::exception("cannot open log file");
+
+	RegisterLogHeader header;
+	if (log.GetSize() < sizeof(header))
+		throw std::exception("invalid log file");
+
+	memcpy(&header, log.GetData(), sizeof(header));
+	if (memcmp(header.Magic, "AMRL", 4) != 0 || header.Version != LOG_VERSION
+	    || sizeof(header) + header.CommandLineLength > log.GetSize())
+		throw std::exception("invalid log file");
+
+	const char* args = (const char*)log.GetData() + sizeof(header);
+	vector<string> commandLine;
+	StringUtils::Tokenize(commandLine, string(args, header.CommandLineLength).c_str(), "\n", true);
+
+	const size_t offset = sizeof(header) + header.CommandLineLength;
+	vector<RegisterLogEntry> entries((log.GetSize() - offset) / sizeof(RegisterLogEntry));
+	if (!entries.empty())
+		memcpy(&entries[0], log.GetData() + offset, entries.size() * sizeof(RegisterLogEntry));
+
+	ReplayBackend backend;
+	backend.Load(entries);
+
+	// the recorded command line without the program name
+	vector<const char*> argv;
+	argv.push_back("");
+	for (size_t i = 1; i < commandLine.size(); i++)
+		argv.push_back(commandLine[i].c_str());
+
+	cout << "Replaying";
+	for (size_t i = 1; i < argv.size(); i++)
+		cout << " " << argv[i];
+	cout << " (" << entries.size() << " accesses";
+	if (!entries.empty() && header.TimerFrequency > 0)
+		cout << " in " << entries.back().Time * 1000.0 / header.TimerFrequency << " ms";
+	cout << "), " << _numRuns << " run(s)" << endl;
+
+	static const char* PHASES[] = { "Initialize", "ParseParams", "ApplyChanges" };
+	static const int NUM_PHASES = sizeof(PHASES) / sizeof(PHASES[0]);
+	vector<double> minTimes(NUM_PHASES, 1e300), sumTimes(NUM_PHASES, 0.0);
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	for (int run = 0; run < _numRuns; run++)
+	{
+		backend.Rewind();
+		BackendScope scope(&backend);
+
+		// the recording starts on an unbound thread
+		SwitchTo(-1);
+
+		long long times[NUM_PHASES + 1];
+		times[0] = GetTimerTicks();
+
+		Info info;
+		if (!info.Initialize())
+			throw std::exception("unsupported CPU in log");
+		times[1] = GetTimerTicks();
+
+		Worker worker(info);
+		if (argv.size() > 1 && !worker.ParseParams((int)argv.size(), &argv[0]))
+			throw std::exception("cannot parse the recorded command line");
+		times[2] = GetTimerTicks();
+
+		if (argv.size() > 1)
+			worker.ApplyChanges();
+		times[3] = GetTimerTicks();
+
+		for (int p = 0; p < NUM_PHASES; p++)
+		{
+			const double us = (times[p + 1] - times[p]) * 1000000.0 / frequency.QuadPart;
+			minTimes[p] = min(minTimes[p], us);
+			sumTimes[p] += us;
+		}
+
+		backend.Finish();
+		if (!backend.GetMismatches().empty())
+			break;
+	}
+
+	const vector<string>& mismatches = backend.GetMismatches();
+	if (!mismatches.empty())
+	{
+		for (size_t i = 0; i < mismatches.size(); i++)
+			cerr << "  " << mismatches[i].c_str() << endl;
+
+		throw std::exception("replay does not match the log");
+	}
+
+	for (int p = 0; p < NUM_PHASES; p++)
+		cout << "  " << PHASES[p] << ": min " << minTimes[p] << " us, avg " << sumTimes[p] / _numRuns << " us" << endl;
+
+	cout << "All writes match the log." << endl;
+}
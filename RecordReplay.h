@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+#include "Backend.h"
+
+
+// Binary register traffic log:
+//   RegisterLogHeader, the recorded command line (CommandLineLength bytes,
+//   arguments separated by '\n'), then one RegisterLogEntry per access.
+struct RegisterLogHeader
+{
+	char Magic[4]; // "AMRL"
+	unsigned int Version;
+	unsigned int CommandLineLength;
+	unsigned int Reserved;
+	unsigned long long TimerFrequency; // of the entry timestamps
+};
+
+enum RegisterOp
+{
+	OP_READ_PCI,
+	OP_WRITE_PCI,
+	OP_RDMSR,
+	OP_WRMSR,
+	OP_CPUID,
+	OP_NUM_CPUS
+};
+
+struct RegisterLogEntry
+{
+	unsigned int Op;
+	int CPU;                        // logical CPU (-1: not bound)
+	unsigned int Address;           // MSR index, CPUID function or (device << 16 | function << 12 | register)
+	unsigned int Reserved;
+	unsigned long long Value[2];    // CPUID: eax | ebx << 32, ecx | edx << 32
+	unsigned long long Time;        // timer ticks since the start of the recording
+};
+
+
+// Forwards to another backend and logs every access.
+class RecordingBackend : public Backend
+{
+public:
+
+	RecordingBackend(Backend* inner)
+		: _inner(inner)
+		, _file(NULL)
+		, _start(0)
+	{
+		InitializeCriticalSection(&_lock);
+	}
+
+	~RecordingBackend();
+
+	bool Open(const char* path, const std::vector<std::string>& commandLine);
+	bool Close();
+
+	DWORD ReadPciConfig(DWORD device, DWORD function, DWORD regAddress);
+	void WritePciConfig(DWORD device, DWORD function, DWORD regAddress, DWORD value);
+	QWORD Rdmsr(DWORD index);
+	void Wrmsr(DWORD index, const QWORD& value);
+	CpuidRegs Cpuid(DWORD index);
+	int GetNumLogicalCPUs();
+	void SwitchTo(int logicalCPUIndex);
+	bool IsOnline(int logicalCPUIndex);
+
+
+private:
+
+	Backend* _inner;
+	FILE* _file;
+	long long _start;
+	CRITICAL_SECTION _lock;
+
+	RecordingBackend(const RecordingBackend&);
+	RecordingBackend& operator=(const RecordingBackend&);
+
+	void Log(RegisterOp op, DWORD address, QWORD value0, QWORD value1 = 0);
+};
+
+
+// Serves the reads of a log and checks the writes against it.
+// The reads of each register are served in the recorded order, the last value
+// is repeated once they are used up. Writes must match the recorded writes to
+// the same register in order; mismatches are collected, not thrown.
+class ReplayBackend : public Backend
+{
+public:
+
+	ReplayBackend()
+		: _numCPUs(1)
+	{
+		InitializeCriticalSection(&_lock);
+	}
+
+	~ReplayBackend()
+	{
+		DeleteCriticalSection(&_lock);
+	}
+
+	void Load(const std::vector<RegisterLogEntry>& entries);
+	void Rewind(); // restarts serving the log from the beginning
+
+	// reports writes which were recorded but not replayed
+	void Finish();
+
+	const std::vector<std::string>& GetMismatches() const { return _mismatches; }
+
+	DWORD ReadPciConfig(DWORD device, DWORD function, DWORD regAddress);
+	void WritePciConfig(DWORD device, DWORD function, DWORD regAddress, DWORD value);
+	QWORD Rdmsr(DWORD index);
+	void Wrmsr(DWORD index, const QWORD& value);
+	CpuidRegs Cpuid(DWORD index);
+	int GetNumLogicalCPUs();
+	void SwitchTo(int logicalCPUIndex);
+
+
+private:
+
+	// op, CPU, address
+	struct Key
+	{
+		unsigned int Op;
+		int CPU;
+		unsigned int Address;
+
+		bool operator<(const Key& other) const
+		{
+			if (Op != other.Op) return Op < other.Op;
+			if (CPU != other.CPU) return CPU < other.CPU;
+			return Address < other.Address;
+		}
+	};
+
+	struct Queue
+	{
+		std::vector<RegisterLogEntry> Entries;
+		size_t Next;
+	};
+
+	typedef std::map<Key, Queue> QueueMap;
+
+	QueueMap _queues;
+	int _numCPUs;
+	std::vector<std::string> _mismatches;
+	CRITICAL_SECTION _lock;
+
+	ReplayBackend(const ReplayBackend&);
+	ReplayBackend& operator=(const ReplayBackend&);
+
+	RegisterLogEntry Read(RegisterOp op, int cpu, DWORD address);
+	void Write(RegisterOp op, int cpu, DWORD address, QWORD value);
+};
+
+
+// "Replay" command: runs Info::Initialize() and the recorded command line
+// (parameters of a regular command) against a log, checking all writes and
+// timing each phase.
+class ReplayRunner
+{
+public:
+
+	ReplayRunner()
+		: _numRuns(1)
+	{ }
+
+	bool ParseParams(int argc, const char* argv[]);
+
+	// throws an exception if the replay does not match the log
+	void Run();
+
+
+private:
+
+	std::string _path;
+	int _numRuns;
+};
@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include <cstring>
+#include <float.h>
+#include "RecordWriter.h"
+
+
+bool ParseOutputFormat(const char* name, OutputFormat& format)
+{
+	if (_stricmp(name, "text") == 0)
+		format = FORMAT_TEXT;
+	else if (_stricmp(name, "json") == 0)
+		format = FORMAT_JSON;
+	else if (_stricmp(name, "csv") == 0)
+		format = FORMAT_CSV;
+	else
+		return false;
+
+	return true;
+}
+
+
+RecordWriter::RecordWriter(FILE* file, OutputFormat format)
+	: _file(file)
+	, _format(format)
+	, _length(0)
+	, _recordLength(0)
+	, _headerLength(0)
+	, _lastHeaderLength(0)
+	, _isFirstField(true)
+{
+}
+
+RecordWriter::~RecordWriter()
+{
+	Flush();
+}
+
+
+void RecordWriter::BeginRecord(const char* type)
+{
+	_recordLength = 0;
+	_headerLength = 0;
+	_isFirstField = true;
+
+	if (_format == FORMAT_JSON)
+		Append("{", 1);
+
+	Field("type", type);
+}
+
+void RecordWriter::EndRecord()
+{
+	if (_format == FORMAT_JSON)
+	{
+		Append("}\n", 2);
+	}
+	else
+	{
+		// emit a new header whenever the record layout changes
+		if (_headerLength != _lastHeaderLength || memcmp(_header, _lastHeader, _headerLength) != 0)
+		{
+			Write(_header, _headerLength);
+			Write("\n", 1);
+
+			memcpy(_lastHeader, _header, _headerLength);
+			_lastHeaderLength = _headerLength;
+		}
+
+		Write(_record, _recordLength);
+		Write("\n", 1);
+	}
+
+	if (_length > sizeof(_buffer) / 2)
+		Flush();
+}
+
+void RecordWriter::Flush()
+{
+	if (_length > 0)
+	{
+		fwrite(_buffer, 1, _length, _file);
+		_length = 0;
+	}
+
+	fflush(_file);
+}
+
+
+void RecordWriter::BeginField(const char* name)
+{
+	if (_format == FORMAT_JSON)
+	{
+		if (!_isFirstField)
+			Append(",", 1);
+
+		Append("\"", 1);
+		Append(name, strlen(name));
+		Append("\":", 2);
+	}
+	else
+	{
+		if (!_isFirstField)
+		{
+			Append(_header, _headerLength, sizeof(_header), ",", 1);
+			Append(_record, _recordLength, sizeof(_record), ",", 1);
+		}
+
+		Append(_header, _headerLength, sizeof(_header), name, strlen(name));
+	}
+
+	_isFirstField = false;
+}
+
+void RecordWriter::Field(const char* name, int value)
+{
+	BeginField(name);
+
+	char str[16];
+	const int length = _snprintf(str, sizeof(str), "%d", value);
+	Append(str, length);
+}
+
+void RecordWriter::Field(const char* name, double value)
+{
+	BeginField(name);
+
+	// JSON has no NaN or infinity (e.g. ratios of zero deltas); CSV leaves the field empty
+	if (!_finite(value))
+	{
+		if (_format == FORMAT_JSON)
+			Append("null", 4);
+		return;
+	}
+
+	char str[32];
+	const int length = _snprintf(str, sizeof(str), "%.10g", value);
+	Append(str, length);
+}
+
+void RecordWriter::Field(const char* name, bool value)
+{
+	BeginField(name);
+
+	if (_format == FORMAT_JSON)
+		Append(value ? "true" : "false", value ? 4 : 5);
+	else
+		Append(value ? "1" : "0", 1);
+}
+
+void RecordWriter::Field(const char* name, const char* value)
+{
+	BeginField(name);
+	AppendString(value);
+}
+
+void RecordWriter::HexField(const char* name, unsigned long long value)
+{
+	BeginField(name);
+
+	// as string, JSON numbers cannot hold all 64 bits
+	char str[24];
+	_snprintf(str, sizeof(str), "0x%llx", value);
+	str[sizeof(str) - 1] = 0;
+
+	AppendString(str);
+}
+
+
+void RecordWriter::Append(const char* str, size_t length)
+{
+	// CSV values are collected until the header of the record is known
+	if (_format == FORMAT_CSV)
+		Append(_record, _recordLength, sizeof(_record), str, length);
+	else
+		Write(str, length);
+}
+
+void RecordWriter::Write(const char* str, size_t length)
+{
+	if (_length + length > sizeof(_buffer))
+		Flush();
+
+	Append(_buffer, _length, sizeof(_buffer), str, length);
+}
+
+void RecordWriter::AppendString(const char* str)
+{
+	// quoted and escaped (JSON: backslash escapes, CSV: doubled quotes)
+	Append("\"", 1);
+
+	for (const char* c = str; *c != 0; c++)
+	{
+		if (*c == '"')
+			Append(_format == FORMAT_JSON ? "\\\"" : "\"\"", 2);
+		else if (*c == '\\' && _format == FORMAT_JSON)
+			Append("\\\\", 2);
+		else if ((unsigned char)*c < 0x20)
+			Append(" ", 1);
+		else
+			Append(c, 1);
+	}
+
+	Append("\"", 1);
+}
+
+void RecordWriter::Append(char* buffer, size_t& length, size_t size, const char* str, size_t strLength)
+{
+	// silently truncates overlong records
+	if (length + strLength > size)
+		strLength = size - length;
+
+	memcpy(buffer + length, str, strLength);
+	length += strLength;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <cstdio>
+
+
+enum OutputFormat
+{
+	FORMAT_TEXT,
+	FORMAT_JSON, // one object per line
+	FORMAT_CSV   // a header line precedes each change of the record layout
+};
+
+// parses "text", "json" or "csv"
+bool ParseOutputFormat(const char* name, OutputFormat& format);
+
+
+// Streams flat records (all with a "type" field) as JSON lines or CSV.
+// Fields are formatted into fixed buffers, nothing is allocated per field.
+class RecordWriter
+{
+public:
+
+	RecordWriter(FILE* file, OutputFormat format);
+	~RecordWriter();
+
+	void BeginRecord(const char* type);
+	void Field(const char* name, int value);
+	void Field(const char* name, double value);
+	void Field(const char* name, bool value);
+	void Field(const char* name, const char* value);
+	void HexField(const char* name, unsigned long long value);
+	void EndRecord();
+
+	void Flush();
+
+
+private:
+
+	FILE* _file;
+	OutputFormat _format;
+
+	char _buffer[8192];    // formatted records not yet written
+	size_t _length;
+	char _record[1024];    // CSV: values of the current record
+	size_t _recordLength;
+	char _header[1024];    // CSV: field names of the current record
+	size_t _headerLength;
+	char _lastHeader[1024];
+	size_t _lastHeaderLength;
+	bool _isFirstField;
+
+	RecordWriter(const RecordWriter&);
+	RecordWriter& operator=(const RecordWriter&);
+
+	void BeginField(const char* name);
+	void Append(const char* str, size_t length);
+	void Write(const char* str, size_t length);
+	void AppendString(const char* str);
+	static void Append(char* buffer, size_t& length, size_t size, const char* str, size_t strLength);
+};
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include "RegisterCache.h"
+
+
+bool RegisterCache::GetMsr(int cpu, DWORD index, QWORD& value) const
+{
+	EnterCriticalSection(&_lock);
+
+	MsrMap::const_iterator it = _msrs.find(GetMsrKey(cpu, index));
+	const bool found = (it != _msrs.end()
+		&& (it->second.Epoch == 0 || (_depth > 0 && it->second.Epoch == _epoch)));
+	if (found)
+		value = it->second.Value;
+
+	LeaveCriticalSection(&_lock);
+
+	return found;
+}
+
+void RegisterCache::SetMsr(int cpu, DWORD index, const QWORD& value, bool isVolatile)
+{
+	EnterCriticalSection(&_lock);
+
+	if (!isVolatile || _depth > 0)
+	{
+		Entry& entry = _msrs[GetMsrKey(cpu, index)];
+		entry.Value = value;
+		entry.Epoch = (isVolatile ? _epoch : 0);
+	}
+
+	LeaveCriticalSection(&_lock);
+}
+
+void RegisterCache::UpdateMsr(int cpu, DWORD index, const QWORD& value, bool isVolatile)
+{
+	EnterCriticalSection(&_lock);
+
+	if (cpu >= 0)
+	{
+		// an unbound thread may read this CPU's register
+		_msrs.erase(GetMsrKey(-1, index));
+	}
+	else
+	{
+		// the write went to an unknown CPU
+		for (MsrMap::iterator it = _msrs.begin(); it != _msrs.end(); )
+		{
+			if ((DWORD)it->first == index)
+				_msrs.erase(it++);
+			else
+				++it;
+		}
+	}
+
+	if (!isVolatile || _depth > 0)
+	{
+		Entry& entry = _msrs[GetMsrKey(cpu, index)];
+		entry.Value = value;
+		entry.Epoch = (isVolatile ? _epoch : 0);
+	}
+	else
+		_msrs.erase(GetMsrKey(cpu, index));
+
+	LeaveCriticalSection(&_lock);
+}
+
+void RegisterCache::RemoveMsr(int cpu, DWORD index)
+{
+	EnterCriticalSection(&_lock);
+
+	if (cpu >= 0)
+	{
+		_msrs.erase(GetMsrKey(cpu, index));
+		_msrs.erase(GetMsrKey(-1, index));
+	}
+	else
+	{
+		for (MsrMap::iterator it = _msrs.begin(); it != _msrs.end(); )
+		{
+			if ((DWORD)it->first == index)
+				_msrs.erase(it++);
+			else
+				++it;
+		}
+	}
+
+	LeaveCriticalSection(&_lock);
+}
+
+
+bool RegisterCache::GetPci(DWORD device, DWORD function, DWORD regAddress, DWORD& value) const
+{
+	EnterCriticalSection(&_lock);
+
+	PciMap::const_iterator it = _pci.find(GetPciKey(device, function, regAddress));
+	const bool found = (it != _pci.end());
+	if (found)
+		value = it->second;
+
+	LeaveCriticalSection(&_lock);
+
+	return found;
+}
+
+void RegisterCache::SetPci(DWORD device, DWORD function, DWORD regAddress, DWORD value)
+{
+	EnterCriticalSection(&_lock);
+	_pci[GetPciKey(device, function, regAddress)] = value;
+	LeaveCriticalSection(&_lock);
+}
+
+
+void RegisterCache::BeginEpoch()
+{
+	EnterCriticalSection(&_lock);
+	_depth++;
+	LeaveCriticalSection(&_lock);
+}
+
+void RegisterCache::EndEpoch()
+{
+	EnterCriticalSection(&_lock);
+	if (--_depth == 0)
+		_epoch++;
+	LeaveCriticalSection(&_lock);
+}
+
+void RegisterCache::RemoveMsrs(int cpu)
+{
+	EnterCriticalSection(&_lock);
+
+	// the keys of a CPU are contiguous
+	_msrs.erase(_msrs.lower_bound(GetMsrKey(cpu, 0)), _msrs.lower_bound(GetMsrKey(cpu + 1, 0)));
+	_msrs.erase(_msrs.lower_bound(GetMsrKey(-1, 0)), _msrs.lower_bound(GetMsrKey(0, 0)));
+
+	LeaveCriticalSection(&_lock);
+}
+
+
+void RegisterCache::Clear()
+{
+	EnterCriticalSection(&_lock);
+	_msrs.clear();
+	_pci.clear();
+	_epoch++;
+	LeaveCriticalSection(&_lock);
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <map>
+#include "WinRing0.h"
+
+
+// Shadow copies of the MSRs (per logical CPU) and PCI configuration
+// registers (per node) owned by Info. Volatile registers (e.g. the P-state
+// status) are only kept while an epoch is open and dropped at its end.
+// Copies start empty.
+class RegisterCache
+{
+public:
+
+	RegisterCache()
+		: _epoch(1)
+		, _depth(0)
+	{
+		InitializeCriticalSection(&_lock);
+	}
+
+	RegisterCache(const RegisterCache&)
+		: _epoch(1)
+		, _depth(0)
+	{
+		InitializeCriticalSection(&_lock);
+	}
+
+	~RegisterCache()
+	{
+		DeleteCriticalSection(&_lock);
+	}
+
+	RegisterCache& operator=(const RegisterCache&)
+	{
+		Clear();
+		return *this;
+	}
+
+	// logical CPU -1: thread not bound to any CPU
+	// volatile values are ignored unless an epoch is open
+	bool GetMsr(int cpu, DWORD index, QWORD& value) const;
+	void SetMsr(int cpu, DWORD index, const QWORD& value, bool isVolatile);
+	// after a write: the value of the other slot (bound/unbound) is unknown
+	void UpdateMsr(int cpu, DWORD index, const QWORD& value, bool isVolatile);
+	void RemoveMsr(int cpu, DWORD index); // cpu -1: of all CPUs
+	void RemoveMsrs(int cpu); // all of the CPU (and of unbound threads)
+
+	bool GetPci(DWORD device, DWORD function, DWORD regAddress, DWORD& value) const;
+	void SetPci(DWORD device, DWORD function, DWORD regAddress, DWORD value);
+
+	// may be nested; the volatile registers are dropped at the outermost end
+	void BeginEpoch();
+	void EndEpoch();
+
+	void Clear();
+
+
+private:
+
+	struct Entry
+	{
+		QWORD Value;
+		unsigned int Epoch; // 0: not volatile
+	};
+
+	typedef std::map<QWORD, Entry> MsrMap; // (cpu + 1) << 32 | index
+	typedef std::map<DWORD, DWORD> PciMap; // device << 16 | function << 12 | register
+
+	MsrMap _msrs;
+	PciMap _pci;
+	unsigned int _epoch;
+	int _depth; // of nested epochs
+	mutable CRITICAL_SECTION _lock;
+
+	static QWORD GetMsrKey(int cpu, DWORD index)
+	{
+		return ((QWORD)(cpu + 1) << 32) | index;
+	}
+
+	static DWORD GetPciKey(DWORD device, DWORD function, DWORD regAddress)
+	{
+		return (device << 16) | (function << 12) | regAddress;
+	}
+};
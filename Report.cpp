@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include <cstdio>
+#include <exception>
+#include <iostream>
+#include "Report.h"
+#include "StringUtils.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+
+
+void PrintInfo(const Info& info)
+{
+	cout << endl;
+	cout << "AmdMsrTweaker v1.1" << endl;
+	cout << endl;
+
+	cout << ".:. General" << endl << "---" << endl;
+	cout << "  AMD family 0x" << std::hex << info.Family << ", model 0x" << info.Model << std::dec << " CPU, " << info.NumCores << " cores" << endl;
+	cout << "  Default reference clock: " << info.multiScaleFactor * 100 << " MHz" << endl;
+	cout << "  Available multipliers: " << (info.MinMulti / info.multiScaleFactor) << " .. " << (info.MaxSoftwareMulti / info.multiScaleFactor) << endl;
+	cout << "  Available voltage IDs: " << info.MinVID << " .. " << info.MaxVID << " (" << info.VIDStep << " steps)" << endl;
+	cout << endl;
+
+	cout << ".:. Turbo" << endl << "---" << endl;
+	if (!info.IsBoostSupported)
+		cout << "  not supported" << endl;
+	else
+	{
+		cout << "  " << (info.IsBoostEnabled ? "enabled" : "disabled") << endl;
+		cout << "  " << (info.IsBoostLocked ? "locked" : "unlocked") << endl;
+
+		if (info.MaxMulti != info.MaxSoftwareMulti)
+			cout << "  Max multiplier: " << (info.MaxMulti / info.multiScaleFactor) << endl;
+	}
+	cout << endl;
+
+	cout << ".:. C1E" << endl << "---" << endl;
+	if (!info.IsC1ESupported())
+		cout << "  not supported" << endl;
+	else
+		cout << "  " << (info.IsC1EEnabled() ? "enabled" : "disabled") << endl;
+	cout << endl;
+
+	cout << ".:. P-states" << endl << "---" << endl;
+	cout << "  " << info.NumPStates << " of " << (info.Family == 0x10 ? 5 : 8) << " enabled (P0 .. P" << (info.NumPStates - 1) << ")" << endl;
+
+	if (info.IsBoostSupported && info.NumBoostStates > 0)
+	{
+		cout << "  Turbo P-states:";
+		for (int i = 0; i < info.NumBoostStates; i++)
+			cout << " P" << i;
+		cout << endl;
+	}
+
+	cout << "  ---" << endl;
+
+	for (int i = 0; i < info.NumPStates; i++)
+	{
+		const PStateInfo pi = info.ReadPState(i);
+
+		cout << "  P" << i << ": " << (pi.Multi / info.multiScaleFactor) << "x at " << info.DecodeVID(pi.VID) << "V" << endl;
+
+		if (pi.NBPState >= 0)
+		{
+			cout << "      NorthBridge in NB_P" << pi.NBPState;
+			if (pi.NBVID >= 0)
+				cout << " at " << info.DecodeVID(pi.NBVID) << "V";
+			cout << endl;
+		}
+	}
+
+	if (info.Family == 0x15)
+	{
+		cout << "  ---" << endl;
+
+		for (int i = 0; i < info.NumNBPStates; i++)
+		{
+			const NBPStateInfo pi = info.ReadNBPState(i);
+			cout << "  NB_P" << i << ": " << pi.Multi << "x at " << info.DecodeVID(pi.VID) << "V" << endl;
+		}
+	}
+}
+
+
+void WriteInfo(const Info& info, RecordWriter& writer)
+{
+	writer.BeginRecord("general");
+	writer.Field("family", info.Family);
+	writer.Field("model", info.Model);
+	writer.Field("cores", info.NumCores);
+	writer.Field("ref_clock_mhz", info.multiScaleFactor * 100);
+	writer.Field("min_multi", info.MinMulti / info.multiScaleFactor);
+	writer.Field("max_multi", info.MaxSoftwareMulti / info.multiScaleFactor);
+	writer.Field("min_vid", info.MinVID);
+	writer.Field("max_vid", info.MaxVID);
+	writer.Field("vid_step", info.VIDStep);
+	writer.EndRecord();
+
+	writer.BeginRecord("turbo");
+	writer.Field("supported", info.IsBoostSupported);
+	writer.Field("enabled", info.IsBoostSupported && info.IsBoostEnabled);
+	writer.Field("locked", info.IsBoostSupported && info.IsBoostLocked);
+	writer.Field("boost_states", info.IsBoostSupported ? info.NumBoostStates : 0);
+	writer.Field("max_multi", info.MaxMulti / info.multiScaleFactor);
+	writer.EndRecord();
+
+	writer.BeginRecord("c1e");
+	writer.Field("supported", info.IsC1ESupported());
+	writer.Field("enabled", info.IsC1ESupported() && info.IsC1EEnabled());
+	writer.EndRecord();
+
+	for (int i = 0; i < info.NumPStates; i++)
+	{
+		const PStateInfo pi = info.ReadPState(i);
+
+		writer.BeginRecord("pstate");
+		writer.Field("index", i);
+		writer.Field("multi", pi.Multi / info.multiScaleFactor);
+		writer.Field("voltage", info.DecodeVID(pi.VID));
+		writer.Field("vid", pi.VID);
+		writer.Field("boost", info.IsBoostSupported && i < info.NumBoostStates);
+		writer.Field("nb_pstate", pi.NBPState);
+		writer.Field("nb_voltage", pi.NBVID >= 0 ? info.DecodeVID(pi.NBVID) : 0.0);
+		writer.EndRecord();
+	}
+
+	if (info.Family == 0x15)
+	{
+		for (int i = 0; i < info.NumNBPStates; i++)
+		{
+			const NBPStateInfo pi = info.ReadNBPState(i);
+
+			writer.BeginRecord("nbpstate");
+			writer.Field("index", i);
+			writer.Field("multi", pi.Multi);
+			writer.Field("voltage", info.DecodeVID(pi.VID));
+			writer.Field("vid", pi.VID);
+			writer.EndRecord();
+		}
+	}
+
+	writer.Flush();
+}
+
+
+bool InfoReport::ParseParams(int argc, const char* argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const string param(argv[i]);
+
+		string key, value;
+		StringUtils::SplitPair(key, value, param, '=');
+
+		if (_stricmp(key.c_str(), "Format") == 0)
+		{
+			if (ParseOutputFormat(value.c_str(), _format))
+				continue;
+		}
+		else if (_stricmp(key.c_str(), "File") == 0)
+		{
+			if (!value.empty())
+			{
+				_path = value;
+				continue;
+			}
+		}
+
+		cerr << "ERROR: invalid parameter " << param.c_str() << endl;
+		return false;
+	}
+
+	if (_format == FORMAT_TEXT && !_path.empty())
+	{
+		cerr << "ERROR: File requires Format=json or Format=csv" << endl;
+		return false;
+	}
+
+	return true;
+}
+
+void InfoReport::Run()
+{
+	if (_format == FORMAT_TEXT)
+	{
+		PrintInfo(*_info);
+		return;
+	}
+
+	FILE* file = stdout;
+	if (!_path.empty())
+	{
+		file = fopen(_path.c_str(), "w");
+		if (!file)
+			throw std::exception("cannot open output file");
+	}
+
+	{
+		RecordWriter writer(file, _format);
+		WriteInfo(*_info, writer);
+	}
+
+	if (file != stdout)
+		fclose(file);
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <string>
+#include "Info.h"
+#include "RecordWriter.h"
+
+
+// prints the general, turbo, P-state and NB P-state info
+void PrintInfo(const Info& info);
+
+// writes the same info as general, turbo, pstate and nbpstate records
+void WriteInfo(const Info& info, RecordWriter& writer);
+
+
+// "Info" command: non-interactive report, optionally machine-readable
+class InfoReport
+{
+public:
+
+	InfoReport(const Info& info)
+		: _info(&info)
+		, _format(FORMAT_TEXT)
+	{ }
+
+	bool ParseParams(int argc, const char* argv[]);
+	void Run();
+
+
+private:
+
+	const Info* _info;
+	OutputFormat _format;
+	std::string _path; // empty => stdout
+};
@@ -0,0 +1,473 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include "Hotplug.h"
+#include "Info.h"
+#include "Report.h"
+#include "Sim.h"
+#include "StringUtils.h"
+#include "Worker.h"
+
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+// register images of the simulated CPUs
+struct SimImage
+{
+	int Family, Model;
+	int NumPStates, NumBoostStates;
+	int FIDs[8], DIDs[8], VIDs[8];
+	bool IsBoostSupported;
+};
+
+static const SimImage IMAGES[] =
+{
+	// Piledriver: multi = (fid + 16) / 2 (200 MHz reference), SVI1 VIDs (12.5 mV steps)
+	{ 0x15, 0x02, 7, 2,
+	  { 0x1a, 0x18, 0x14, 0x10, 0x0c, 0x08, 0x04 },
+	  { 0, 0, 0, 0, 0, 0, 0 },
+	  { 12, 16, 20, 28, 36, 44, 52 },
+	  true },
+
+	// Kabini: multi = (fid + 16) / 2^did, SVI2 VIDs (6.25 mV steps), no boost
+	{ 0x16, 0x00, 5, 0,
+	  { 0x04, 0x01, 0x0c, 0x06, 0x00 },
+	  { 0, 0, 1, 1, 1 },
+	  { 56, 64, 72, 88, 104 },
+	  false },
+
+	// Zen: multi = 2 * CpuFid / CpuDfsId, SVI2 VIDs, boost beyond P0
+	{ 0x17, 0x01, 3, 0,
+	  { 0x78, 0x60, 0x7c },
+	  { 0x08, 0x08, 0x10 },
+	  { 0x3a, 0x58, 0x78 },
+	  true }
+};
+
+
+SimBackend::SimBackend(int numLogicalCPUs, int family)
+	: _numLogicalCPUs(numLogicalCPUs)
+	, _image(NULL)
+	, _msrDelay(0)
+	, _pciDelay(0)
+	, _numMsrAccesses(0)
+	, _numPciAccesses(0)
+{
+	for (size_t i = 0; i < sizeof(IMAGES) / sizeof(IMAGES[0]); i++)
+	{
+		if (IMAGES[i].Family == family)
+			_image = &IMAGES[i];
+	}
+
+	if (_image == NULL)
+		throw std::exception("no simulated CPU of this family");
+
+	InitializeCriticalSection(&_pciLock);
+	Reset();
+}
+
+SimBackend::~SimBackend()
+{
+	DeleteCriticalSection(&_pciLock);
+}
+
+
+void SimBackend::Reset()
+{
+	const SimImage& image = *_image;
+	const int lowest = image.NumPStates - image.NumBoostStates - 1; // software index
+
+	MsrMap msrs;
+
+	for (int i = 0; i < 8; i++)
+	{
+		QWORD msr = 0;
+
+		if (i < image.NumPStates)
+		{
+			if (image.Family == 0x17)
+			{
+				SetBits(msr, image.FIDs[i], 0, 8);
+				SetBits(msr, image.DIDs[i], 8, 6);
+				SetBits(msr, image.VIDs[i], 14, 8);
+			}
+			else
+			{
+				SetBits(msr, image.FIDs[i], 0, 6);
+				SetBits(msr, image.DIDs[i], 6, 3);
+				SetBits(msr, image.VIDs[i], 9, 8);
+				SetBits(msr, (i < 3 ? 0 : 1), 22, 1); // NB_P1 from P3 on
+			}
+
+			SetBits(msr, 1, 63, 1); // PstateEn
+		}
+
+		msrs[0xc0010064 + i] = msr;
+	}
+
+	// running at the lowest P-state
+	msrs[0xc0010061] = (QWORD)lowest << 4; // limits
+	msrs[0xc0010062] = lowest;             // control
+	msrs[0xc0010063] = lowest;             // status
+	msrs[0xc0010015] = 0;                  // HWCR
+
+	// COFVID status and interrupt pending message with C1E (not on family 0x17)
+	if (image.Family != 0x17)
+	{
+		msrs[0xc0010071] = (QWORD)(image.NumPStates - 1) << 16;
+		msrs[0xc0010055] = (QWORD)1 << 28;
+	}
+
+	_initialMsrs = msrs;
+	_msrs.assign(_numLogicalCPUs, msrs);
+	_online.assign(_numLogicalCPUs, true);
+
+	// family 0x17 has a different PCI register layout, none is simulated
+	_pci.clear();
+	if (image.Family != 0x17)
+	{
+		_pci[(3 << 12) | 0xdc] = (image.NumPStates - 1) << 8;      // F3xDC: HwPstateMaxVal
+		_pci[(3 << 12) | 0xd4] = 0x14;                              // F3xD4: MaxSwPstateCpuCof
+		_pci[(3 << 12) | 0x1f0] = 0;
+		_pci[(4 << 12) | 0x15c] = 1 | (image.NumBoostStates << 2); // F4x15C: BoostSrc, NumBoostStates
+	}
+	if (image.Family == 0x15)
+	{
+		_pci[(5 << 12) | 0x170] = 1;                            // F5x170: NbPstateMaxVal
+		_pci[(5 << 12) | 0x160] = 1 | (0x0e << 1) | (20 << 10); // F5x160: NB_P0
+		_pci[(5 << 12) | 0x164] = 1 | (0x08 << 1) | (28 << 10); // F5x164: NB_P1
+		_pci[(5 << 12) | 0x168] = 0;
+		_pci[(5 << 12) | 0x16c] = 0;
+	}
+}
+
+void SimBackend::SetLatencies(int msrLatencyNs, int pciLatencyNs)
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	_msrDelay = (long long)(msrLatencyNs * (double)frequency.QuadPart / 1e9);
+	_pciDelay = (long long)(pciLatencyNs * (double)frequency.QuadPart / 1e9);
+}
+
+void SimBackend::SetOnline(int logicalCPUIndex, bool online)
+{
+	if (logicalCPUIndex < 0 || logicalCPUIndex >= _numLogicalCPUs)
+		throw std::exception("logical CPU index out of range");
+
+	if (online && !_online[logicalCPUIndex])
+		_msrs[logicalCPUIndex] = _initialMsrs;
+
+	_online[logicalCPUIndex] = online;
+}
+
+void SimBackend::ResetCounters()
+{
+	_numMsrAccesses = _numPciAccesses = 0;
+}
+
+
+DWORD SimBackend::ReadPciConfig(DWORD device, DWORD function, DWORD regAddress)
+{
+	InterlockedIncrement64(&_numPciAccesses);
+	Delay(_pciDelay);
+
+	EnterCriticalSection(&_pciLock);
+	PciMap::const_iterator it = _pci.find((function << 12) | regAddress);
+	const bool found = (device == AMD_CPU_DEVICE && it != _pci.end());
+	const DWORD result = (found ? it->second : 0);
+	LeaveCriticalSection(&_pciLock);
+
+	if (!found)
+	{
+		const string msg = "cannot read from PCI configuration space (F" + StringUtils::ToString(function)
+			+ "x" + StringUtils::ToHexString(regAddress) + ")";
+		throw std::exception(msg.c_str());
+	}
+
+	return result;
+}
+
+// one access for the whole block, like a read of the configuration space file
+void SimBackend::ReadPciConfigBlock(DWORD device, DWORD function, DWORD regAddress, DWORD* values, int count)
+{
+	InterlockedIncrement64(&_numPciAccesses);
+	Delay(_pciDelay);
+
+	int missing = -1;
+
+	EnterCriticalSection(&_pciLock);
+	for (int i = 0; i < count; i++)
+	{
+		PciMap::const_iterator it = _pci.find((function << 12) | (regAddress + i * 4));
+		const bool found = (device == AMD_CPU_DEVICE && it != _pci.end());
+		values[i] = (found ? it->second : 0);
+		if (!found && missing < 0)
+			missing = i;
+	}
+	LeaveCriticalSection(&_pciLock);
+
+	if (missing >= 0)
+	{
+		const string msg = "cannot read from PCI configuration space (F" + StringUtils::ToString(function)
+			+ "x" + StringUtils::ToHexString(regAddress + missing * 4) + ")";
+		throw std::exception(msg.c_str());
+	}
+}
+
+void SimBackend::WritePciConfig(DWORD device, DWORD function, DWORD regAddress, DWORD value)
+{
+	InterlockedIncrement64(&_numPciAccesses);
+	Delay(_pciDelay);
+
+	EnterCriticalSection(&_pciLock);
+	PciMap::iterator it = _pci.find((function << 12) | regAddress);
+	const bool found = (device == AMD_CPU_DEVICE && it != _pci.end());
+	if (found)
+		it->second = value;
+	LeaveCriticalSection(&_pciLock);
+
+	if (!found)
+	{
+		const string msg = "cannot write to PCI configuration space (F" + StringUtils::ToString(function)
+			+ "x" + StringUtils::ToHexString(regAddress) + ")";
+		throw std::exception(msg.c_str());
+	}
+}
+
+
+QWORD SimBackend::Rdmsr(DWORD index)
+{
+	InterlockedIncrement64(&_numMsrAccesses);
+	Delay(_msrDelay);
+
+	const MsrMap& msrs = GetMsrs();
+	MsrMap::const_iterator it = msrs.find(index);
+	if (it == msrs.end())
+	{
+		const string msg = "cannot read from MSR (0x" + StringUtils::ToHexString(index) + ")";
+		throw std::exception(msg.c_str());
+	}
+
+	return it->second;
+}
+
+void SimBackend::Wrmsr(DWORD index, const QWORD& value)
+{
+	InterlockedIncrement64(&_numMsrAccesses);
+	Delay(_msrDelay);
+
+	MsrMap& msrs = GetMsrs();
+	MsrMap::iterator it = msrs.find(index);
+	if (it == msrs.end())
+	{
+		const string msg = "cannot write to MSR (0x" + StringUtils::ToHexString(index) + ")";
+		throw std::exception(msg.c_str());
+	}
+
+	it->second = value;
+
+	// P-state transitions complete immediately
+	if (index == 0xc0010062)
+	{
+		const int pState = (int)GetBits(value, 0, 3);
+		msrs[0xc0010063] = pState;
+
+		it = msrs.find(0xc0010071);
+		if (it != msrs.end())
+			SetBits(it->second, pState + _image->NumBoostStates, 16, 3);
+	}
+}
+
+
+CpuidRegs SimBackend::Cpuid(DWORD index)
+{
+	CpuidRegs result = { 0, 0, 0, 0 };
+
+	switch (index)
+	{
+		case 0x80000000:
+			result.eax = 0x8000001e;
+			result.ebx = 0x68747541; // "Auth"
+			result.edx = 0x69746e65; // "enti"
+			result.ecx = 0x444d4163; // "cAMD"
+			break;
+
+		case 0x80000001:
+			// base family 0xf + extended family
+			result.eax = (0xf << 8) | ((_image->Family - 0xf) << 20)
+				| ((_image->Model & 0xf) << 4) | ((_image->Model >> 4) << 16);
+			break;
+
+		case 0x80000007:
+			result.edx = (_image->IsBoostSupported ? (1 << 9) : 0); // CPB
+			break;
+
+		case 0x80000008:
+			result.ecx = (_numLogicalCPUs > 256 ? 255 : _numLogicalCPUs - 1);
+			break;
+	}
+
+	return result;
+}
+
+int SimBackend::GetNumLogicalCPUs()
+{
+	return _numLogicalCPUs;
+}
+
+bool SimBackend::IsOnline(int logicalCPUIndex)
+{
+	return (logicalCPUIndex >= 0 && logicalCPUIndex < _numLogicalCPUs && _online[logicalCPUIndex]);
+}
+
+void SimBackend::SwitchTo(int logicalCPUIndex)
+{
+	if (logicalCPUIndex >= _numLogicalCPUs)
+		throw std::exception("logical CPU index out of range");
+}
+
+
+SimBackend::MsrMap& SimBackend::GetMsrs()
+{
+	// unbound threads run on the first CPU
+	const int cpu = GetCurrentCPU();
+	return _msrs[cpu < 0 || cpu >= _numLogicalCPUs ? 0 : cpu];
+}
+
+void SimBackend::Delay(long long ticks)
+{
+	if (ticks <= 0)
+		return;
+
+	LARGE_INTEGER start, now;
+	QueryPerformanceCounter(&start);
+
+	do
+		QueryPerformanceCounter(&now);
+	while (now.QuadPart - start.QuadPart < ticks);
+}
+
+
+
+bool Simulator::ParseParams(int argc, const char* argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const string param(argv[i]);
+
+		string key, value;
+		StringUtils::SplitPair(key, value, param, '=');
+
+		if (_stricmp(key.c_str(), "Family") == 0)
+		{
+			const int family = (int)strtol(value.c_str(), NULL, 0);
+			if (family == 0x15 || family == 0x16 || family == 0x17)
+			{
+				_family = family;
+				continue;
+			}
+
+			cerr << "ERROR: invalid parameter " << param.c_str() << endl;
+			return false;
+		}
+
+		if (_stricmp(key.c_str(), "CPUs") == 0)
+		{
+			const int numCPUs = atoi(value.c_str());
+			if (numCPUs >= 1 && numCPUs <= 256)
+			{
+				_numCPUs = numCPUs;
+				continue;
+			}
+
+			cerr << "ERROR: invalid parameter " << param.c_str() << endl;
+			return false;
+		}
+
+		if (_stricmp(key.c_str(), "Hotplug") == 0)
+		{
+			vector<string> tokens;
+			StringUtils::Tokenize(tokens, value, ",", true);
+
+			_hotplugCPUs.clear();
+			for (size_t j = 0; j < tokens.size(); j++)
+				_hotplugCPUs.push_back(atoi(tokens[j].c_str()));
+
+			if (!_hotplugCPUs.empty())
+				continue;
+
+			cerr << "ERROR: invalid parameter " << param.c_str() << endl;
+			return false;
+		}
+
+		// everything else is passed on to the simulated run
+		_params.push_back(param);
+	}
+
+	return true;
+}
+
+void Simulator::Run()
+{
+	SimBackend sim(_numCPUs, _family);
+	BackendScope scope(&sim);
+
+	Info info;
+	if (!info.Initialize())
+		throw std::exception("simulated CPU not supported");
+
+	if (!_params.empty())
+	{
+		vector<const char*> argv;
+		argv.push_back("");
+		for (size_t i = 0; i < _params.size(); i++)
+			argv.push_back(_params[i].c_str());
+
+		Worker worker(info);
+		if (!worker.ParseParams((int)argv.size(), &argv[0]))
+			throw std::exception("invalid parameters");
+
+		worker.ApplyChanges();
+
+		if (!worker.Verify())
+			throw std::exception("changes not in effect on the simulated CPU");
+
+		// hotplug events: the CPUs come back online with the initial settings
+		if (!_hotplugCPUs.empty())
+		{
+			HotplugDaemon daemon(info);
+			if (!daemon.ParseParams((int)argv.size(), &argv[0]))
+				throw std::exception("invalid parameters");
+
+			daemon.Start();
+			RecordWriter writer(stdout, FORMAT_TEXT);
+
+			for (size_t k = 0; k < _hotplugCPUs.size(); k++)
+				sim.SetOnline(_hotplugCPUs[k], false);
+			daemon.Poll(writer);
+
+			for (size_t k = 0; k < _hotplugCPUs.size(); k++)
+				sim.SetOnline(_hotplugCPUs[k], true);
+
+			if (daemon.Poll(writer) != (int)_hotplugCPUs.size() || !worker.Verify())
+				throw std::exception("changes not in effect on the CPUs brought online");
+		}
+
+		// the boost state may have changed
+		SwitchTo(-1);
+		if (!info.Initialize())
+			throw std::exception("simulated CPU not supported");
+	}
+
+	PrintInfo(info);
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <map>
+#include <vector>
+#include <string>
+#include "Backend.h"
+
+struct SimImage;
+
+// Simulated AMD family 0x15 (Piledriver), 0x16 (Kabini) or 0x17 (Zen) CPU
+// with an arbitrary number of logical CPUs. Each MSR and PCI access can be delayed by a busy wait to model
+// the cost of the driver round trip; all accesses are counted.
+// MSRs are private to each logical CPU, PCI registers are shared.
+// Logical CPUs can be taken offline and back online; a CPU coming online
+// starts with the initial MSRs, as after a firmware reset.
+class SimBackend : public Backend
+{
+public:
+
+	SimBackend(int numLogicalCPUs, int family = 0x15);
+	~SimBackend();
+
+	// restores the initial register image
+	void Reset();
+
+	void SetLatencies(int msrLatencyNs, int pciLatencyNs);
+
+	// hotplug event
+	void SetOnline(int logicalCPUIndex, bool online);
+
+	void ResetCounters();
+	long long GetNumMsrAccesses() const { return _numMsrAccesses; }
+	long long GetNumPciAccesses() const { return _numPciAccesses; }
+
+	DWORD ReadPciConfig(DWORD device, DWORD function, DWORD regAddress);
+	void WritePciConfig(DWORD device, DWORD function, DWORD regAddress, DWORD value);
+	void ReadPciConfigBlock(DWORD device, DWORD function, DWORD regAddress, DWORD* values, int count);
+	QWORD Rdmsr(DWORD index);
+	void Wrmsr(DWORD index, const QWORD& value);
+	CpuidRegs Cpuid(DWORD index);
+	int GetNumLogicalCPUs();
+	void SwitchTo(int logicalCPUIndex);
+	bool IsOnline(int logicalCPUIndex);
+
+
+private:
+
+	typedef std::map<DWORD, QWORD> MsrMap;
+	typedef std::map<DWORD, DWORD> PciMap;
+
+	int _numLogicalCPUs;
+	const SimImage* _image;
+	MsrMap _initialMsrs;
+	std::vector<MsrMap> _msrs; // per logical CPU
+	std::vector<bool> _online;
+	PciMap _pci;               // function << 12 | register
+	CRITICAL_SECTION _pciLock;
+
+	long long _msrDelay, _pciDelay; // timer ticks
+	volatile long long _numMsrAccesses, _numPciAccesses;
+
+	SimBackend(const SimBackend&);
+	SimBackend& operator=(const SimBackend&);
+
+	MsrMap& GetMsrs();
+	static void Delay(long long ticks);
+};
+
+
+// "Simulate" command: applies a regular command line to a simulated CPU,
+// verifies it and prints the resulting info. Optionally takes logical CPUs
+// offline and back online, to be brought in line by the hotplug daemon.
+class Simulator
+{
+public:
+
+	Simulator()
+		: _numCPUs(4)
+		, _family(0x15)
+	{ }
+
+	bool ParseParams(int argc, const char* argv[]);
+
+	// throws an exception if the changes are not in effect
+	void Run();
+
+
+private:
+
+	int _numCPUs;
+	int _family;
+	std::vector<std::string> _params; // command line to apply
+	std::vector<int> _hotplugCPUs;
+};
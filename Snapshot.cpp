@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include "Snapshot.h"
+#include "StringUtils.h"
+#include "WinRing0.h"
+
+using std::endl;
+using std::ifstream;
+using std::ofstream;
+using std::string;
+
+// P-state MSRs C001_0064-C001_006B, NB P-state registers F5x160-F5x17C
+static const int MAX_PSTATES = 8;
+
+
+void Snapshot::Read(const Info& info)
+{
+	PStates.clear();
+	for (int i = 0; i < info.NumPStates; i++)
+		PStates.push_back(Rdmsr(0xc0010064 + i));
+
+	NBPStates.clear();
+	if (info.Family == 0x15)
+	{
+		for (int i = 0; i < info.NumNBPStates; i++)
+			NBPStates.push_back(ReadPciConfig(AMD_CPU_DEVICE, 5, 0x160 + i * 4));
+	}
+
+	HWCR = Rdmsr(0xc0010015);
+	BoostControl = (info.Family == 0x17 ? 0 : ReadPciConfig(AMD_CPU_DEVICE, 4, 0x15c));
+}
+
+
+bool Snapshot::Save(const char* path, const Info& info) const
+{
+	ofstream file(path);
+	if (!file)
+		return false;
+
+	file << std::setprecision(10);
+
+	file << "# AmdMsrTweaker snapshot" << endl;
+	file << "Family=0x" << std::hex << info.Family << endl;
+	file << "Model=0x" << info.Model << std::dec << endl;
+	file << "NumCores=" << info.NumCores << endl;
+	file << "NumPStates=" << info.NumPStates << endl;
+	file << "NumNBPStates=" << info.NumNBPStates << endl;
+	file << "MinMulti=" << info.MinMulti << endl;
+	file << "MaxMulti=" << info.MaxMulti << endl;
+	file << "MaxSoftwareMulti=" << info.MaxSoftwareMulti << endl;
+	file << "MinVID=" << info.MinVID << endl;
+	file << "MaxVID=" << info.MaxVID << endl;
+	file << "VIDStep=" << info.VIDStep << endl;
+	file << "MultiScaleFactor=" << info.multiScaleFactor << endl;
+	file << "IsBoostSupported=" << (info.IsBoostSupported ? 1 : 0) << endl;
+	file << "IsBoostEnabled=" << (info.IsBoostEnabled ? 1 : 0) << endl;
+	file << "IsBoostLocked=" << (info.IsBoostLocked ? 1 : 0) << endl;
+	file << "NumBoostStates=" << info.NumBoostStates << endl;
+
+	file << std::hex;
+	for (size_t i = 0; i < PStates.size(); i++)
+		file << "PState" << i << "=0x" << PStates[i] << endl;
+	for (size_t i = 0; i < NBPStates.size(); i++)
+		file << "NBPState" << i << "=0x" << NBPStates[i] << endl;
+	file << "HWCR=0x" << HWCR << endl;
+	file << "BoostControl=0x" << BoostControl << endl;
+
+	return file.good();
+}
+
+
+bool Snapshot::Load(const char* path, Info& info)
+{
+	ifstream file(path, std::ios::binary);
+	if (!file)
+		return false;
+
+	const string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	return Parse(data.c_str(), data.size(), info);
+}
+
+bool Snapshot::Parse(const char* data, size_t size, Info& info)
+{
+	PStates.clear();
+	NBPStates.clear();
+	info.Family = 0;
+
+	const char* end = data + size;
+	while (data < end)
+	{
+		const char* lineEnd = data;
+		while (lineEnd < end && *lineEnd != '\n')
+			lineEnd++;
+
+		string line(data, lineEnd);
+		data = (lineEnd < end ? lineEnd + 1 : end);
+
+		if (!line.empty() && line[line.length() - 1] == '\r')
+			line.erase(line.length() - 1);
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		string key, value;
+		StringUtils::SplitPair(key, value, line, '=');
+
+		const char* v = value.c_str();
+
+		if (key == "Family") info.Family = (int)strtol(v, NULL, 0);
+		else if (key == "Model") info.Model = (int)strtol(v, NULL, 0);
+		else if (key == "NumCores") info.NumCores = atoi(v);
+		else if (key == "NumPStates") info.NumPStates = atoi(v);
+		else if (key == "NumNBPStates") info.NumNBPStates = atoi(v);
+		else if (key == "MinMulti") info.MinMulti = atof(v);
+		else if (key == "MaxMulti") info.MaxMulti = atof(v);
+		else if (key == "MaxSoftwareMulti") info.MaxSoftwareMulti = atof(v);
+		else if (key == "MinVID") info.MinVID = atof(v);
+		else if (key == "MaxVID") info.MaxVID = atof(v);
+		else if (key == "VIDStep") info.VIDStep = atof(v);
+		else if (key == "MultiScaleFactor") info.multiScaleFactor = atof(v);
+		else if (key == "IsBoostSupported") info.IsBoostSupported = (atoi(v) != 0);
+		else if (key == "IsBoostEnabled") info.IsBoostEnabled = (atoi(v) != 0);
+		else if (key == "IsBoostLocked") info.IsBoostLocked = (atoi(v) != 0);
+		else if (key == "NumBoostStates") info.NumBoostStates = atoi(v);
+		else if (key == "HWCR") HWCR = _strtoui64(v, NULL, 0);
+		else if (key == "BoostControl") BoostControl = strtoul(v, NULL, 0);
+		else if (key.compare(0, 8, "NBPState") == 0)
+		{
+			const int index = atoi(key.c_str() + 8);
+			if (index < 0 || index >= MAX_PSTATES)
+				return false;
+			if (index >= (int)NBPStates.size())
+				NBPStates.resize(index + 1, 0);
+			NBPStates[index] = strtoul(v, NULL, 0);
+		}
+		else if (key.compare(0, 6, "PState") == 0)
+		{
+			const int index = atoi(key.c_str() + 6);
+			if (index < 0 || index >= MAX_PSTATES)
+				return false;
+			if (index >= (int)PStates.size())
+				PStates.resize(index + 1, 0);
+			PStates[index] = _strtoui64(v, NULL, 0);
+		}
+	}
+
+	return (info.Family != 0 && info.NumPStates == (int)PStates.size());
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Info.h"
+
+
+// Raw P-state related registers of a machine (as seen by one core),
+// together with the CPU description needed to decode them offline.
+class Snapshot
+{
+public:
+
+	std::vector<unsigned long long> PStates; // MSRC001_0064 + i
+	std::vector<unsigned long> NBPStates;    // F5x160 + i*4 (family 0x15)
+	unsigned long long HWCR;                 // MSRC001_0015 (CpbDis)
+	unsigned long BoostControl;              // F4x15C
+
+	Snapshot()
+		: HWCR(0)
+		, BoostControl(0)
+	{ }
+
+	// reads the registers of the current core
+	void Read(const Info& info);
+
+	bool Save(const char* path, const Info& info) const;
+
+	// restores the CPU description into info
+	bool Load(const char* path, Info& info);
+	bool Parse(const char* data, size_t size, Info& info);
+};
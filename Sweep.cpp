@@ -0,0 +1,570 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <exception>
+#include <iostream>
+#include "Sweep.h"
+#include "Kernels.h"
+#include "Ladder.h"
+#include "StringUtils.h"
+#include "Threads.h"
+#include "WinRing0.h"
+#include "Worker.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::min;
+using std::max;
+using std::string;
+using std::vector;
+
+static const DWORD APERF = 0xe8;
+static const DWORD MPERF = 0xe7;
+
+
+bool ParetoSweep::ParseParams(int argc, const char* argv[])
+{
+	const Info& info = *_info;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const string param(argv[i]);
+
+		string key, value;
+		StringUtils::SplitPair(key, value, param, '=');
+
+		if (!value.empty())
+		{
+			const double number = atof(value.c_str());
+
+			if (_stricmp(key.c_str(), "PState") == 0)
+			{
+				// a software P-state other than P0, which is the reference of MPERF
+				const int index = atoi(value.c_str() + (tolower(value[0]) == 'p' ? 1 : 0));
+				if (index > info.NumBoostStates && index < info.NumPStates)
+				{
+					_pState = index;
+					continue;
+				}
+			}
+
+			if (_stricmp(key.c_str(), "MinMulti") == 0 && number > 0)
+			{
+				_minMulti = number;
+				continue;
+			}
+			if (_stricmp(key.c_str(), "MaxMulti") == 0 && number > 0)
+			{
+				_maxMulti = number;
+				continue;
+			}
+			if (_stricmp(key.c_str(), "MultiStep") == 0 && number > 0)
+			{
+				_multiStep = number;
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "MinVoltage") == 0 && number > 0)
+			{
+				_minVoltage = number;
+				continue;
+			}
+			if (_stricmp(key.c_str(), "MaxVoltage") == 0 && number > 0)
+			{
+				_maxVoltage = number;
+				continue;
+			}
+			if (_stricmp(key.c_str(), "VoltageStep") == 0 && number > 0)
+			{
+				_voltageStep = number;
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Duration") == 0 && atoi(value.c_str()) > 0)
+			{
+				_duration = atoi(value.c_str());
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Threads") == 0 && atoi(value.c_str()) > 0)
+			{
+				_numThreads = atoi(value.c_str());
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Cdyn") == 0 && number > 0)
+			{
+				_estimator.Cdyn = number;
+				continue;
+			}
+			if (_stricmp(key.c_str(), "Static") == 0 && number >= 0)
+			{
+				_estimator.StaticPower = number;
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Apply") == 0)
+			{
+				const int flag = atoi(value.c_str());
+				if (flag == 0 || flag == 1)
+				{
+					_apply = (flag == 1);
+					continue;
+				}
+			}
+
+			if (_stricmp(key.c_str(), "Format") == 0)
+			{
+				if (ParseOutputFormat(value.c_str(), _format))
+					continue;
+			}
+		}
+
+		cerr << "ERROR: invalid parameter " << param.c_str() << endl;
+		return false;
+	}
+
+	if (_pState < 0)
+		_pState = info.NumPStates - 1;
+
+	if (_pState <= info.NumBoostStates)
+	{
+		cerr << "ERROR: no software P-state other than P0 available as scratch P-state" << endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+void ParetoSweep::GetMultis(vector<double>& multis) const
+{
+	const Info& info = *_info;
+
+	const double minMulti = (_minMulti > 0 ? max(info.MinMulti, _minMulti * info.multiScaleFactor) : info.MinMulti);
+	const double maxMulti = (_maxMulti > 0 ? min(info.MaxSoftwareMulti, _maxMulti * info.multiScaleFactor) : info.MaxSoftwareMulti);
+	const double step = _multiStep * info.multiScaleFactor;
+
+	// only multis which can actually be encoded, each once
+	multis.clear();
+	for (double multi = minMulti; multi <= maxMulti + 1e-9; multi += step)
+	{
+		int fid, did;
+		info.EncodeMulti(multi, fid, did);
+		const double encoded = info.DecodeMulti(fid, did);
+
+		if (encoded < minMulti - 1e-9 || encoded > maxMulti + 1e-9)
+			continue;
+		if (!multis.empty() && fabs(multis.back() - encoded) < 1e-9)
+			continue;
+
+		multis.push_back(encoded);
+	}
+}
+
+static bool IsLowerMulti(const PStateInfo& a, const PStateInfo& b)
+{
+	return (a.Multi < b.Multi);
+}
+
+void ParetoSweep::ReadStockPStates()
+{
+	const Info& info = *_info;
+
+	_stockPStates.clear();
+	for (int i = info.NumBoostStates; i < info.NumPStates; i++)
+	{
+		const PStateInfo psi = info.ReadPState(i);
+		if (psi.Multi > 0)
+			_stockPStates.push_back(psi);
+	}
+
+	std::sort(_stockPStates.begin(), _stockPStates.end(), IsLowerMulti);
+}
+
+double ParetoSweep::GetVoltageFloor(double multi) const
+{
+	const Info& info = *_info;
+
+	if (_stockPStates.empty())
+		return info.MaxVID;
+
+	// the lowest / highest stock voltage outside the range of the stock multis
+	const PStateInfo& lowest = _stockPStates.front();
+	if (multi <= lowest.Multi)
+		return info.DecodeVID(lowest.VID);
+
+	for (size_t i = 1; i < _stockPStates.size(); i++)
+	{
+		const PStateInfo& upper = _stockPStates[i];
+		if (multi > upper.Multi)
+			continue;
+
+		const PStateInfo& lower = _stockPStates[i - 1];
+		const double lowerVoltage = info.DecodeVID(lower.VID);
+		const double upperVoltage = info.DecodeVID(upper.VID);
+		if (upper.Multi - lower.Multi < 1e-9)
+			return max(lowerVoltage, upperVoltage);
+
+		return lowerVoltage + (upperVoltage - lowerVoltage) * (multi - lower.Multi) / (upper.Multi - lower.Multi);
+	}
+
+	return info.DecodeVID(_stockPStates.back().VID);
+}
+
+void ParetoSweep::GetVIDs(double multi, vector<int>& vids) const
+{
+	const Info& info = *_info;
+
+	vids.clear();
+
+	// by default, stay at or above the stock voltage of the multi
+	const double minVoltage = (_minVoltage > 0 ? _minVoltage : GetVoltageFloor(multi));
+
+	double maxVoltage = _maxVoltage;
+	if (maxVoltage < 0)
+	{
+		maxVoltage = 0.0;
+		for (size_t i = 0; i < _stockPStates.size(); i++)
+			maxVoltage = max(maxVoltage, info.DecodeVID(_stockPStates[i].VID));
+	}
+
+	if (maxVoltage < minVoltage - 1e-9)
+		return;
+
+	// the floor itself, rounded up to the next encodable voltage (lower VID)
+	int floorVID = info.EncodeVID(minVoltage);
+	if (info.DecodeVID(floorVID) < minVoltage - 1e-9)
+		floorVID--;
+
+	// from the highest voltage down
+	for (double voltage = maxVoltage; voltage >= minVoltage - 1e-9; voltage -= _voltageStep)
+	{
+		const int vid = min(info.EncodeVID(voltage), floorVID);
+		if (vids.empty() || vids.back() != vid)
+			vids.push_back(vid);
+	}
+
+	if (vids.back() != floorVID && info.DecodeVID(floorVID) <= maxVoltage + 1e-9)
+		vids.push_back(floorVID);
+}
+
+
+// programs the scratch P-state on all cores and switches the benchmark cores to it
+void ParetoSweep::Program(const PStateInfo& psi, int numCPUs) const
+{
+	const Info& info = *_info;
+
+	// the new definition takes effect on the next transition
+	const int otherPState = info.NumBoostStates;
+
+	for (int j = 0; j < GetNumLogicalCPUs(); j++)
+	{
+		SwitchTo(j);
+		info.WritePState(psi);
+
+		if (j < numCPUs)
+		{
+			info.SetCurrentPState(otherPState);
+			info.SetCurrentPState(_pState);
+		}
+	}
+
+	SwitchTo(-1);
+
+	// let the voltage settle
+	Sleep(10);
+}
+
+
+void ParetoSweep::Restore(const vector<PStateInfo>& originals, const vector<int>& currentPStates) const
+{
+	const Info& info = *_info;
+
+	for (int j = 0; j < (int)originals.size(); j++)
+	{
+		SwitchTo(j);
+		info.WritePState(originals[j]);
+		info.SetCurrentPState(info.NumBoostStates);
+		info.SetCurrentPState(currentPStates[j]);
+	}
+
+	SwitchTo(-1);
+}
+
+
+struct KernelTask
+{
+	int CPU;
+	unsigned long long Iterations;
+	double Seconds;
+	QWORD APerf, MPerf; // deltas
+	double Checksum;
+};
+
+static DWORD WINAPI KernelThread(LPVOID param)
+{
+	KernelTask& task = *static_cast<KernelTask*>(param);
+
+	SwitchTo(task.CPU);
+
+	const QWORD aperf = Rdmsr(APERF);
+	const QWORD mperf = Rdmsr(MPERF);
+	const double start = GetSeconds();
+
+	task.Checksum = RunComputeKernel(task.Iterations);
+
+	task.Seconds = GetSeconds() - start;
+	task.APerf = Rdmsr(APERF) - aperf;
+	task.MPerf = Rdmsr(MPERF) - mperf;
+
+	SwitchTo(-1);
+	return 0;
+}
+
+void ParetoSweep::Measure(Point& point, unsigned long long iterations)
+{
+	const Info& info = *_info;
+
+	vector<KernelTask> tasks(_numThreads);
+	ThreadGroup threads;
+
+	for (int t = 0; t < _numThreads; t++)
+	{
+		tasks[t].CPU = t;
+		tasks[t].Iterations = iterations;
+
+		threads.Start(KernelThread, &tasks[t]);
+	}
+
+	// the running average power is sampled while the kernels are still running
+	if (_estimator.IsMeasured() && threads.GetNumThreads() > 0)
+	{
+		threads.Wait(_duration * 3 / 4);
+		point.Power = _estimator.Measure();
+	}
+
+	threads.Wait();
+
+	if (!_estimator.IsMeasured())
+	{
+		// the model reads the scratch P-state's new definition
+		_estimator.Initialize();
+		point.Power = _estimator.Model(vector<int>(_numThreads, _pState));
+	}
+
+	// MPERF counts at the P0 frequency
+	const double p0MHz = info.ReadPState(info.NumBoostStates).Multi * 100;
+
+	volatile double checksum = 0.0;
+	point.Throughput = point.EffectiveMHz = 0.0;
+
+	for (int t = 0; t < _numThreads; t++)
+	{
+		const KernelTask& task = tasks[t];
+		checksum += task.Checksum;
+
+		point.Throughput += task.Iterations / max(task.Seconds, 1e-9) / 1e6;
+		if (task.MPerf > 0)
+			point.EffectiveMHz += p0MHz * task.APerf / task.MPerf / _numThreads;
+	}
+}
+
+
+void ParetoSweep::FindParetoFrontier(vector<Point>& points)
+{
+	// on the frontier unless another point is at least as fast and frugal, and better in one
+	for (size_t i = 0; i < points.size(); i++)
+	{
+		Point& p = points[i];
+		p.IsPareto = true;
+
+		for (size_t k = 0; k < points.size() && p.IsPareto; k++)
+		{
+			const Point& q = points[k];
+			if (q.Throughput >= p.Throughput && q.Power <= p.Power
+			    && (q.Throughput > p.Throughput || q.Power < p.Power))
+				p.IsPareto = false;
+		}
+	}
+}
+
+
+void ParetoSweep::Run()
+{
+	const Info& info = *_info;
+
+	const int numLogicalCPUs = GetNumLogicalCPUs();
+	if (_numThreads == 0 || _numThreads > numLogicalCPUs)
+		_numThreads = numLogicalCPUs;
+	_numThreads = min(_numThreads, (int)MAXIMUM_WAIT_OBJECTS);
+
+	ReadStockPStates();
+
+	vector<double> multis;
+	GetMultis(multis);
+
+	// the voltages of each multi
+	vector<vector<int> > vids(multis.size());
+	size_t numPoints = 0;
+	for (size_t m = 0; m < multis.size(); m++)
+	{
+		GetVIDs(multis[m], vids[m]);
+		numPoints += vids[m].size();
+	}
+
+	if (numPoints == 0)
+		throw std::exception("no points to sweep");
+
+	_estimator.Initialize();
+
+	// keep stdout clean for machine-readable output
+	std::ostream& status = (_format == FORMAT_TEXT ? cout : cerr);
+	status << "Sweeping " << numPoints << " points of " << multis.size() << " multis in P" << _pState
+	       << " on " << _numThreads << " cores (" << (_estimator.IsMeasured() ? "measured" : "modeled") << " power)" << endl;
+	if (_minVoltage > 0)
+		status << "WARNING: points below the stable voltage of a multiplier may crash the system" << endl;
+	else
+		status << "Voltages are kept at or above the stock P-states (MinVoltage= to go below)" << endl;
+
+	// the work per point, calibrated at the current speed
+	const unsigned long long iterations = CalibrateComputeKernel(_duration / 1000.0);
+
+	// original definitions and current P-states, restored afterwards
+	vector<PStateInfo> originals(numLogicalCPUs);
+	vector<int> currentPStates(numLogicalCPUs);
+	for (int j = 0; j < numLogicalCPUs; j++)
+	{
+		SwitchTo(j);
+		originals[j] = info.ReadPState(_pState);
+		currentPStates[j] = info.GetCurrentPState();
+	}
+	SwitchTo(-1);
+
+	RecordWriter writer(stdout, _format);
+	vector<Point> points;
+
+	try
+	{
+		for (size_t m = 0; m < multis.size(); m++)
+		{
+			for (size_t v = 0; v < vids[m].size(); v++)
+			{
+				PStateInfo psi = originals[0];
+				psi.Index = _pState;
+				psi.Multi = multis[m];
+				psi.VID = vids[m][v];
+
+				Program(psi, _numThreads);
+
+				Point point;
+				point.Multi = multis[m];
+				point.VID = vids[m][v];
+				Measure(point, iterations);
+				points.push_back(point);
+
+				if (_format == FORMAT_TEXT)
+				{
+					cout << "  " << (point.Multi / info.multiScaleFactor) << "x at " << info.DecodeVID(point.VID) << "V: "
+					     << point.Throughput << " Mops/s, " << point.EffectiveMHz << " MHz, " << point.Power << " W" << endl;
+				}
+			}
+		}
+	}
+	catch (...)
+	{
+		Restore(originals, currentPStates);
+		throw;
+	}
+
+	Restore(originals, currentPStates);
+
+	FindParetoFrontier(points);
+
+	LadderGenerator generator(info);
+	generator.SetPerfPerWatt(true);
+
+	if (_format == FORMAT_TEXT)
+		cout << endl << "Pareto frontier:" << endl;
+
+	for (size_t i = 0; i < points.size(); i++)
+	{
+		const Point& p = points[i];
+		const double voltage = info.DecodeVID(p.VID);
+
+		if (p.IsPareto)
+			generator.AddPoint(p.Multi / info.multiScaleFactor, voltage);
+
+		if (_format == FORMAT_TEXT)
+		{
+			if (p.IsPareto)
+				cout << "  " << (p.Multi / info.multiScaleFactor) << "x at " << voltage << "V: " << p.Throughput << " Mops/s, "
+				     << p.Power << " W, " << (p.Throughput / max(p.Power, 1e-9)) << " Mops/J" << endl;
+			continue;
+		}
+
+		writer.BeginRecord("point");
+		writer.Field("multi", p.Multi / info.multiScaleFactor);
+		writer.Field("voltage", voltage);
+		writer.Field("vid", p.VID);
+		writer.Field("throughput", p.Throughput);
+		writer.Field("effective_mhz", p.EffectiveMHz);
+		writer.Field("power", p.Power);
+		writer.Field("ops_per_joule", p.Throughput / max(p.Power, 1e-9));
+		writer.Field("pareto", p.IsPareto);
+		writer.EndRecord();
+	}
+
+	// the frontier as ladder of all software P-states
+	vector<PStateInfo> ladder;
+	generator.Generate(ladder);
+
+	vector<string> params;
+	for (size_t i = 0; i < ladder.size(); i++)
+	{
+		const PStateInfo& psi = ladder[i];
+		params.push_back("P" + StringUtils::ToString(psi.Index) + "=" + StringUtils::ToString(psi.Multi / info.multiScaleFactor)
+		                 + "@" + StringUtils::ToString(info.DecodeVID(psi.VID)));
+
+		if (_format != FORMAT_TEXT)
+		{
+			writer.BeginRecord("ladder");
+			writer.Field("pstate", psi.Index);
+			writer.Field("multi", psi.Multi / info.multiScaleFactor);
+			writer.Field("voltage", info.DecodeVID(psi.VID));
+			writer.EndRecord();
+		}
+	}
+
+	writer.Flush();
+
+	if (_format == FORMAT_TEXT)
+	{
+		cout << endl << "Ladder:" << endl << " ";
+		for (size_t i = 0; i < params.size(); i++)
+			cout << " " << params[i].c_str();
+		cout << endl;
+	}
+
+	if (_apply)
+	{
+		vector<const char*> argv;
+		argv.push_back("");
+		for (size_t i = 0; i < params.size(); i++)
+			argv.push_back(params[i].c_str());
+
+		Worker worker(info);
+		if (!worker.ParseParams((int)argv.size(), &argv[0]))
+			throw std::exception("cannot apply the generated ladder");
+
+		worker.ApplyChanges();
+	}
+}
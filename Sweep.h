@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <vector>
+#include "Info.h"
+#include "PowerCap.h"
+#include "RecordWriter.h"
+
+
+// "Sweep" command: programs every encodable (multi, voltage) point into a
+// scratch P-state, runs a calibrated compute kernel on all cores at that
+// P-state and records the throughput and the (measured or modeled) power.
+// Unless MinVoltage= is given, no multi is run below the voltage of the
+// stock P-states at that multi.
+// The Pareto frontier is turned into a P-state ladder (see Ladder.h).
+class ParetoSweep
+{
+public:
+
+	ParetoSweep(const Info& info)
+		: _info(&info)
+		, _estimator(info)
+		, _pState(-1)
+		, _minMulti(-1.0), _maxMulti(-1.0)
+		, _multiStep(1.0)
+		, _minVoltage(-1.0), _maxVoltage(-1.0)
+		, _voltageStep(0.025)
+		, _duration(200)
+		, _numThreads(0)
+		, _apply(false)
+		, _format(FORMAT_TEXT)
+	{ }
+
+	bool ParseParams(int argc, const char* argv[]);
+
+	void Run();
+
+	struct Point
+	{
+		double Multi;        // internal
+		int VID;
+		double Throughput;   // million kernel iterations per second, all threads
+		double EffectiveMHz; // average of all threads
+		double Power;        // W
+		bool IsPareto;
+	};
+
+
+private:
+
+	const Info* _info;
+	PowerEstimator _estimator;
+	int _pState;                  // scratch P-state (-1: the lowest one)
+	double _minMulti, _maxMulti;  // external, -1: MinMulti / MaxSoftwareMulti
+	double _multiStep;            // external
+	double _minVoltage, _maxVoltage; // -1: stock floor of the multi / highest software P-state voltage
+	double _voltageStep;
+	int _duration;                // per point in ms
+	int _numThreads;              // 0: one per logical CPU
+	bool _apply;
+	OutputFormat _format;
+	std::vector<PStateInfo> _stockPStates; // software P-states at the start, by ascending multi
+
+	void ReadStockPStates();
+	double GetVoltageFloor(double multi) const; // interpolated from the stock P-states
+	void GetMultis(std::vector<double>& multis) const;
+	void GetVIDs(double multi, std::vector<int>& vids) const;
+
+	void Program(const PStateInfo& psi, int numCPUs) const;
+	void Restore(const std::vector<PStateInfo>& originals, const std::vector<int>& currentPStates) const;
+	void Measure(Point& point, unsigned long long iterations);
+
+	static void FindParetoFrontier(std::vector<Point>& points);
+};
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include <algorithm>
+#include <exception>
+#include "Threads.h"
+
+
+ThreadGroup::~ThreadGroup()
+{
+	try
+	{
+		Wait();
+	}
+	catch (...)
+	{
+		// nothing left to do in a destructor
+	}
+}
+
+bool ThreadGroup::Start(LPTHREAD_START_ROUTINE function, void* param)
+{
+	const HANDLE thread = CreateThread(NULL, 0, function, param, 0, NULL);
+	if (thread == NULL)
+	{
+		function(param);
+		return false;
+	}
+
+	_threads.push_back(thread);
+	return true;
+}
+
+bool ThreadGroup::Wait(DWORD milliseconds)
+{
+	if (_threads.empty())
+		return true;
+
+	const DWORD start = GetTickCount();
+
+	for (size_t first = 0; first < _threads.size(); first += MAXIMUM_WAIT_OBJECTS)
+	{
+		const DWORD count = (DWORD)std::min(_threads.size() - first, (size_t)MAXIMUM_WAIT_OBJECTS);
+
+		// the timeout applies to all batches together
+		DWORD timeout = INFINITE;
+		if (milliseconds != INFINITE)
+		{
+			const DWORD elapsed = GetTickCount() - start;
+			timeout = (elapsed < milliseconds ? milliseconds - elapsed : 0);
+		}
+
+		const DWORD result = WaitForMultipleObjects(count, &_threads[first], TRUE, timeout);
+		if (result == WAIT_TIMEOUT)
+			return false;
+		if (result >= WAIT_OBJECT_0 + count)
+			throw std::exception("cannot wait for the worker threads");
+	}
+
+	for (size_t t = 0; t < _threads.size(); t++)
+		CloseHandle(_threads[t]);
+	_threads.clear();
+
+	return true;
+}
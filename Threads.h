@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <vector>
+#include "WinRing0.h"
+
+
+// Worker threads of a parallel phase. A task whose thread cannot be created
+// is run right away on the calling thread instead. The threads are waited
+// for in batches of MAXIMUM_WAIT_OBJECTS (the limit of WaitForMultipleObjects()).
+class ThreadGroup
+{
+public:
+
+	ThreadGroup() { }
+	~ThreadGroup();
+
+	// false if the task has been run on the calling thread
+	bool Start(LPTHREAD_START_ROUTINE function, void* param);
+
+	// true if all threads have finished; closes them
+	// throws an exception if they cannot be waited for (and keeps them)
+	bool Wait(DWORD milliseconds = INFINITE);
+
+	int GetNumThreads() const { return (int)_threads.size(); }
+
+	// runs the function for each task of the vector and waits for all of them
+	template <class Task>
+	static void Run(LPTHREAD_START_ROUTINE function, std::vector<Task>& tasks)
+	{
+		ThreadGroup group;
+		for (size_t t = 0; t < tasks.size(); t++)
+			group.Start(function, &tasks[t]);
+		group.Wait();
+	}
+
+
+private:
+
+	std::vector<HANDLE> _threads;
+
+	ThreadGroup(const ThreadGroup&);
+	ThreadGroup& operator=(const ThreadGroup&);
+};
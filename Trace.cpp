@@ -0,0 +1,682 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <conio.h>
+#include "MappedFile.h"
+#include "StringUtils.h"
+#include "Threads.h"
+#include "Trace.h"
+#include "WinRing0.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::max;
+using std::min;
+using std::string;
+using std::vector;
+
+static const unsigned int TRACE_VERSION = 1;
+
+static const DWORD APERF = 0xe8;
+static const DWORD MPERF = 0xe7;
+
+
+static unsigned long long ZigZag(long long value)
+{
+	return ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63);
+}
+
+static long long UnZigZag(unsigned long long value)
+{
+	return (long long)(value >> 1) ^ -(long long)(value & 1);
+}
+
+// returns false if the varint runs past the end
+static bool ReadVarint(const unsigned char*& data, const unsigned char* end, long long& value)
+{
+	unsigned long long result = 0;
+
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		if (data == end)
+			return false;
+
+		const unsigned char byte = *data++;
+		result |= (unsigned long long)(byte & 0x7f) << shift;
+
+		if ((byte & 0x80) == 0)
+		{
+			value = UnZigZag(result);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+bool TraceWriter::Open(const char* path, int numCPUs, int numPStates, unsigned long long intervalUs)
+{
+	Close();
+
+	_file = fopen(path, "wb");
+	if (!_file)
+		return false;
+
+	const string indexPath = string(path) + ".idx";
+	_index = fopen(indexPath.c_str(), "wb");
+	if (!_index)
+	{
+		fclose(_file);
+		_file = NULL;
+		return false;
+	}
+
+	TraceHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.Magic, "AMTR", 4);
+	header.Version = TRACE_VERSION;
+	header.NumCPUs = numCPUs;
+	header.NumPStates = numPStates;
+	header.IntervalUs = intervalUs;
+
+	_numCPUs = numCPUs;
+	_payload.clear();
+	_payload.reserve(CHUNK_SIZE + 64);
+	_numSamples = 0;
+	_lastTime = 0;
+
+	return (fwrite(&header, sizeof(header), 1, _file) == 1);
+}
+
+bool TraceWriter::Append(unsigned long long time, const vector<TraceSample>& samples)
+{
+	if (!_file || (int)samples.size() != _numCPUs)
+		return false;
+
+	if (_numSamples == 0)
+	{
+		// each chunk starts from scratch
+		_firstTime = time;
+		const TraceSample zero = { 0, 0, 0 };
+		_last.assign(_numCPUs, zero);
+	}
+
+	WriteVarint((long long)(time - _lastTime));
+
+	for (int j = 0; j < _numCPUs; j++)
+	{
+		const TraceSample& s = samples[j];
+		TraceSample& last = _last[j];
+
+		WriteVarint(s.PState - last.PState);
+		WriteVarint(s.VID - last.VID);
+		WriteVarint(s.MHz - last.MHz);
+
+		last = s;
+	}
+
+	_numSamples++;
+	_lastTime = time;
+
+	if (_payload.size() >= CHUNK_SIZE)
+		return FlushChunk();
+
+	return true;
+}
+
+bool TraceWriter::Close()
+{
+	bool success = true;
+
+	if (_file)
+	{
+		success = FlushChunk();
+		success = (fclose(_file) == 0) && success;
+		_file = NULL;
+	}
+
+	if (_index)
+	{
+		success = (fclose(_index) == 0) && success;
+		_index = NULL;
+	}
+
+	return success;
+}
+
+
+bool TraceWriter::FlushChunk()
+{
+	if (_numSamples == 0)
+		return true;
+
+	TraceChunkHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.Magic, "CHNK", 4);
+	header.NumSamples = _numSamples;
+	header.PayloadSize = (unsigned int)_payload.size();
+	header.FirstTime = _firstTime;
+	header.LastTime = _lastTime;
+
+	TraceIndexEntry entry;
+	entry.FirstTime = _firstTime;
+	entry.Offset = (unsigned long long)_ftelli64(_file);
+
+	const bool success = (fwrite(&header, sizeof(header), 1, _file) == 1
+	                      && fwrite(&_payload[0], 1, _payload.size(), _file) == _payload.size()
+	                      && fwrite(&entry, sizeof(entry), 1, _index) == 1);
+
+	// keep both files usable if the recording is interrupted
+	fflush(_file);
+	fflush(_index);
+
+	_payload.clear();
+	_numSamples = 0;
+
+	return success;
+}
+
+void TraceWriter::WriteVarint(long long value)
+{
+	unsigned long long v = ZigZag(value);
+
+	while (v >= 0x80)
+	{
+		_payload.push_back((unsigned char)(v | 0x80));
+		v >>= 7;
+	}
+
+	_payload.push_back((unsigned char)v);
+}
+
+
+bool TraceRecorder::ParseParams(int argc, const char* argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const string param(argv[i]);
+
+		string key, value;
+		StringUtils::SplitPair(key, value, param, '=');
+
+		if (!value.empty())
+		{
+			if (_stricmp(key.c_str(), "Out") == 0)
+			{
+				_path = value;
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Interval") == 0)
+			{
+				const int interval = atoi(value.c_str());
+				if (interval > 0)
+				{
+					_interval = interval;
+					continue;
+				}
+			}
+
+			if (_stricmp(key.c_str(), "Duration") == 0)
+			{
+				const int duration = atoi(value.c_str());
+				if (duration >= 0)
+				{
+					_duration = duration;
+					continue;
+				}
+			}
+		}
+
+		cerr << "ERROR: invalid parameter " << param.c_str() << endl;
+		return false;
+	}
+
+	if (_path.empty())
+	{
+		cerr << "ERROR: missing trace file (Out=path)" << endl;
+		return false;
+	}
+
+	return true;
+}
+
+void TraceRecorder::Run()
+{
+	const Info& info = *_info;
+	const int numLogicalCPUs = GetNumLogicalCPUs();
+
+	// VIDs of the P-state definitions, MPERF counts at the P0 frequency
+	vector<int> vids;
+	for (int i = 0; i < info.NumPStates; i++)
+		vids.push_back(info.ReadPState(i).VID);
+
+	const double p0MHz = info.ReadPState(info.NumBoostStates).Multi * 100;
+
+	TraceWriter writer;
+	if (!writer.Open(_path.c_str(), numLogicalCPUs, info.NumPStates, _interval * 1000ULL))
+		throw std::exception("cannot create trace file");
+
+	cout << "Tracing every " << _interval << " ms to " << _path.c_str() << ", press any key to stop..." << endl;
+
+	vector<TraceSample> samples(numLogicalCPUs);
+	vector<QWORD> aperf(numLogicalCPUs, 0), mperf(numLogicalCPUs, 0);
+
+	LARGE_INTEGER frequency, start, now;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&start);
+
+	unsigned long long numSamples = 0;
+
+	while (!_kbhit())
+	{
+		QueryPerformanceCounter(&now);
+		const unsigned long long time = (unsigned long long)((now.QuadPart - start.QuadPart) * 1000000.0 / frequency.QuadPart);
+
+		if (_duration > 0 && time >= _duration * 1000000ULL)
+			break;
+
+		for (int j = 0; j < numLogicalCPUs; j++)
+		{
+			SwitchTo(j);
+
+			TraceSample& s = samples[j];
+			s.PState = info.GetCurrentPState();
+			s.VID = (s.PState < info.NumPStates ? vids[s.PState] : 0);
+
+			const QWORD a = Rdmsr(APERF);
+			const QWORD m = Rdmsr(MPERF);
+			s.MHz = (numSamples == 0 || m == mperf[j] ? 0 : (int)(p0MHz * (a - aperf[j]) / (m - mperf[j]) + 0.5));
+			aperf[j] = a;
+			mperf[j] = m;
+		}
+
+		if (!writer.Append(time, samples))
+			throw std::exception("cannot write trace file");
+
+		numSamples++;
+		Sleep(_interval);
+	}
+
+	if (_kbhit())
+		_getch();
+
+	if (!writer.Close())
+		throw std::exception("cannot write trace file");
+
+	cout << numSamples << " samples written" << endl;
+}
+
+
+bool TraceAnalyzer::ParseParams(int argc, const char* argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const string param(argv[i]);
+
+		string key, value;
+		StringUtils::SplitPair(key, value, param, '=');
+
+		if (value.empty())
+		{
+			if (_path.empty())
+			{
+				_path = param;
+				continue;
+			}
+		}
+		else
+		{
+			if (_stricmp(key.c_str(), "Threads") == 0)
+			{
+				const int numThreads = atoi(value.c_str());
+				if (numThreads > 0)
+				{
+					_numThreads = numThreads;
+					continue;
+				}
+			}
+
+			if (_stricmp(key.c_str(), "Bucket") == 0)
+			{
+				const int bucket = atoi(value.c_str());
+				if (bucket > 0)
+				{
+					_bucket = bucket;
+					continue;
+				}
+			}
+
+			if (_stricmp(key.c_str(), "Format") == 0)
+			{
+				if (ParseOutputFormat(value.c_str(), _format))
+					continue;
+			}
+		}
+
+		cerr << "ERROR: invalid parameter " << param.c_str() << endl;
+		return false;
+	}
+
+	if (_path.empty())
+	{
+		cerr << "ERROR: missing trace file" << endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+// work item of an analyzer thread: a contiguous range of chunks
+struct AnalyzeTask
+{
+	const MappedFile* Trace;
+	const TraceHeader* Header;
+	const TraceIndexEntry* Index;
+	size_t FirstChunk, EndChunk;
+	unsigned long long BucketUs;
+
+	TraceAnalyzer::Stats Stats;
+	vector<int>* FirstPStates; // [chunk * NumCPUs + cpu]
+	vector<int>* LastPStates;
+	bool IsCorrupt;
+};
+
+static void AnalyzeChunk(AnalyzeTask& task, size_t chunk)
+{
+	const TraceHeader& header = *task.Header;
+	const int numCPUs = header.NumCPUs;
+	const int numPStates = header.NumPStates;
+
+	const unsigned long long offset = task.Index[chunk].Offset;
+	if (offset + sizeof(TraceChunkHeader) > task.Trace->GetSize())
+		throw std::exception("chunk offset out of range");
+
+	const unsigned char* data = task.Trace->GetData() + offset;
+	TraceChunkHeader chunkHeader;
+	memcpy(&chunkHeader, data, sizeof(chunkHeader));
+
+	if (memcmp(chunkHeader.Magic, "CHNK", 4) != 0
+	    || offset + sizeof(chunkHeader) + chunkHeader.PayloadSize > task.Trace->GetSize())
+		throw std::exception("invalid chunk header");
+
+	data += sizeof(chunkHeader);
+	const unsigned char* end = data + chunkHeader.PayloadSize;
+
+	vector<long long> last(numCPUs * 3, 0);
+	int* first = &(*task.FirstPStates)[chunk * numCPUs];
+	int* lastPStates = &(*task.LastPStates)[chunk * numCPUs];
+
+	unsigned long long time = 0;
+	for (unsigned int i = 0; i < chunkHeader.NumSamples; i++)
+	{
+		long long dt;
+		if (!ReadVarint(data, end, dt) || dt < 0)
+			throw std::exception("truncated chunk");
+
+		// the first delta refers to the last sample of the previous chunk
+		time = (i == 0 ? chunkHeader.FirstTime : time + dt);
+		const size_t bucket = (size_t)(time / task.BucketUs);
+
+		for (int j = 0; j < numCPUs; j++)
+		{
+			long long delta[3];
+			for (int k = 0; k < 3; k++)
+			{
+				if (!ReadVarint(data, end, delta[k]))
+					throw std::exception("truncated chunk");
+			}
+
+			const int previous = (int)last[j * 3];
+			for (int k = 0; k < 3; k++)
+				last[j * 3 + k] += delta[k];
+
+			const int pState = (int)last[j * 3];
+			if (pState < 0)
+				throw std::exception("P-state out of range");
+
+			// the recorder keeps current P-states beyond the defined ones
+			if (pState >= numPStates)
+				task.Stats.Unknown[j] += dt;
+			else
+				task.Stats.Residency[j * numPStates + pState] += dt;
+
+			if (i == 0)
+				first[j] = pState;
+			else if (pState != previous)
+			{
+				task.Stats.Transitions[j]++;
+				if (bucket < task.Stats.BucketTransitions.size())
+					task.Stats.BucketTransitions[bucket]++;
+			}
+
+			lastPStates[j] = pState;
+		}
+	}
+}
+
+static DWORD WINAPI AnalyzeThread(LPVOID param)
+{
+	AnalyzeTask& task = *static_cast<AnalyzeTask*>(param);
+
+	try
+	{
+		for (size_t chunk = task.FirstChunk; chunk < task.EndChunk; chunk++)
+			AnalyzeChunk(task, chunk);
+	}
+	catch (const std::exception&)
+	{
+		task.IsCorrupt = true;
+	}
+
+	return 0;
+}
+
+void TraceAnalyzer::Run()
+{
+	MappedFile trace, index;
+
+	if (!trace.Open(_path.c_str()))
+		throw std::exception("cannot open trace file");
+
+	const string indexPath = _path + ".idx";
+	if (!index.Open(indexPath.c_str()))
+		throw std::exception("cannot open trace index");
+
+	TraceHeader header;
+	if (trace.GetSize() < sizeof(header))
+		throw std::exception("invalid trace file");
+
+	memcpy(&header, trace.GetData(), sizeof(header));
+	if (memcmp(header.Magic, "AMTR", 4) != 0 || header.Version != TRACE_VERSION
+	    || header.NumCPUs == 0 || header.NumPStates == 0)
+		throw std::exception("invalid trace file");
+
+	const size_t numChunks = index.GetSize() / sizeof(TraceIndexEntry);
+	const TraceIndexEntry* entries = (const TraceIndexEntry*)index.GetData();
+
+	// the duration is the end of the last chunk
+	unsigned long long duration = 0;
+	if (numChunks > 0)
+	{
+		const unsigned long long offset = entries[numChunks - 1].Offset;
+		if (offset + sizeof(TraceChunkHeader) > trace.GetSize())
+			throw std::exception("invalid trace index");
+
+		TraceChunkHeader last;
+		memcpy(&last, trace.GetData() + offset, sizeof(last));
+		duration = last.LastTime;
+	}
+
+	const unsigned long long bucketUs = _bucket * 1000ULL;
+	const size_t numBuckets = (size_t)(duration / bucketUs) + 1;
+
+	Stats initial;
+	initial.Residency.assign(header.NumCPUs * header.NumPStates, 0);
+	initial.Unknown.assign(header.NumCPUs, 0);
+	initial.Transitions.assign(header.NumCPUs, 0);
+	initial.BucketTransitions.assign(numBuckets, 0);
+
+	vector<int> firstPStates(numChunks * header.NumCPUs), lastPStates(numChunks * header.NumCPUs);
+
+	// split the chunks into contiguous ranges, one per thread
+	const int numThreads = (int)max((size_t)1, min(numChunks, (size_t)min(_numThreads > 0 ? _numThreads : GetNumLogicalCPUs(), (int)MAXIMUM_WAIT_OBJECTS)));
+	vector<AnalyzeTask> tasks(numThreads);
+	ThreadGroup threads;
+
+	for (int t = 0; t < numThreads; t++)
+	{
+		AnalyzeTask& task = tasks[t];
+		task.Trace = &trace;
+		task.Header = &header;
+		task.Index = entries;
+		task.FirstChunk = numChunks * t / numThreads;
+		task.EndChunk = numChunks * (t + 1) / numThreads;
+		task.BucketUs = bucketUs;
+		task.Stats = initial;
+		task.FirstPStates = &firstPStates;
+		task.LastPStates = &lastPStates;
+		task.IsCorrupt = false;
+
+		threads.Start(AnalyzeThread, &task);
+	}
+
+	threads.Wait();
+
+	Stats stats = initial;
+	for (int t = 0; t < numThreads; t++)
+	{
+		if (tasks[t].IsCorrupt)
+			throw std::exception("corrupt trace file");
+
+		const Stats& s = tasks[t].Stats;
+		for (size_t i = 0; i < s.Residency.size(); i++)
+			stats.Residency[i] += s.Residency[i];
+		for (size_t i = 0; i < s.Unknown.size(); i++)
+			stats.Unknown[i] += s.Unknown[i];
+		for (size_t i = 0; i < s.Transitions.size(); i++)
+			stats.Transitions[i] += s.Transitions[i];
+		for (size_t i = 0; i < s.BucketTransitions.size(); i++)
+			stats.BucketTransitions[i] += s.BucketTransitions[i];
+	}
+
+	// transitions across chunk boundaries
+	for (size_t chunk = 1; chunk < numChunks; chunk++)
+	{
+		const size_t bucket = (size_t)(entries[chunk].FirstTime / bucketUs);
+
+		for (unsigned int j = 0; j < header.NumCPUs; j++)
+		{
+			if (firstPStates[chunk * header.NumCPUs + j] != lastPStates[(chunk - 1) * header.NumCPUs + j])
+			{
+				stats.Transitions[j]++;
+				if (bucket < numBuckets)
+					stats.BucketTransitions[bucket]++;
+			}
+		}
+	}
+
+	Print(header, stats, duration);
+}
+
+
+void TraceAnalyzer::Print(const TraceHeader& header, const Stats& stats, unsigned long long duration) const
+{
+	const double seconds = duration / 1000000.0;
+	const double bucketSeconds = _bucket / 1000.0;
+
+	if (_format != FORMAT_TEXT)
+	{
+		RecordWriter writer(stdout, _format);
+
+		for (unsigned int j = 0; j < header.NumCPUs; j++)
+		{
+			for (unsigned int i = 0; i < header.NumPStates; i++)
+			{
+				const double residency = stats.Residency[j * header.NumPStates + i] / 1000000.0;
+
+				writer.BeginRecord("residency");
+				writer.Field("cpu", (int)j);
+				writer.Field("pstate", (int)i);
+				writer.Field("seconds", residency);
+				writer.Field("percent", seconds > 0 ? residency / seconds * 100 : 0.0);
+				writer.EndRecord();
+			}
+
+			// P-states beyond the defined ones, as P-state -1
+			if (stats.Unknown[j] > 0)
+			{
+				const double residency = stats.Unknown[j] / 1000000.0;
+
+				writer.BeginRecord("residency");
+				writer.Field("cpu", (int)j);
+				writer.Field("pstate", -1);
+				writer.Field("seconds", residency);
+				writer.Field("percent", seconds > 0 ? residency / seconds * 100 : 0.0);
+				writer.EndRecord();
+			}
+		}
+
+		for (unsigned int j = 0; j < header.NumCPUs; j++)
+		{
+			writer.BeginRecord("transitions");
+			writer.Field("cpu", (int)j);
+			writer.Field("count", (double)stats.Transitions[j]);
+			writer.Field("per_second", seconds > 0 ? stats.Transitions[j] / seconds : 0.0);
+			writer.EndRecord();
+		}
+
+		for (size_t b = 0; b < stats.BucketTransitions.size(); b++)
+		{
+			writer.BeginRecord("rate");
+			writer.Field("time_s", b * bucketSeconds);
+			writer.Field("per_second", stats.BucketTransitions[b] / bucketSeconds);
+			writer.EndRecord();
+		}
+
+		return;
+	}
+
+	cout << "Trace: " << header.NumCPUs << " CPUs, " << header.NumPStates << " P-states, " << seconds << " s" << endl;
+	cout << endl;
+
+	cout << ".:. Residency (%)" << endl << "---" << endl;
+	for (unsigned int j = 0; j < header.NumCPUs; j++)
+	{
+		cout << "  CPU " << j << ":";
+		for (unsigned int i = 0; i < header.NumPStates; i++)
+		{
+			const double residency = stats.Residency[j * header.NumPStates + i] / 1000000.0;
+			cout << "  P" << i << " " << (seconds > 0 ? residency / seconds * 100 : 0.0);
+		}
+		if (stats.Unknown[j] > 0)
+			cout << "  unknown " << (seconds > 0 ? stats.Unknown[j] / 1000000.0 / seconds * 100 : 0.0);
+		cout << endl;
+	}
+	cout << endl;
+
+	cout << ".:. Transitions" << endl << "---" << endl;
+	for (unsigned int j = 0; j < header.NumCPUs; j++)
+	{
+		cout << "  CPU " << j << ": " << stats.Transitions[j];
+		if (seconds > 0)
+			cout << " (" << stats.Transitions[j] / seconds << "/s)";
+		cout << endl;
+	}
+	cout << endl;
+
+	cout << ".:. Transition rate (all CPUs, per s)" << endl << "---" << endl;
+	for (size_t b = 0; b < stats.BucketTransitions.size(); b++)
+		cout << "  " << b * bucketSeconds << " s: " << stats.BucketTransitions[b] / bucketSeconds << endl;
+}
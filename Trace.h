@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "Info.h"
+#include "RecordWriter.h"
+
+
+// Binary trace of sampled P-state telemetry:
+//   trace file: TraceHeader, then chunks (TraceChunkHeader + payload)
+//   index file (<trace>.idx): one TraceIndexEntry per chunk
+// A chunk payload is a sequence of samples; each sample is the time delta (us)
+// to the previous sample, followed by P-state, VID and effective MHz of each CPU
+// as deltas to the previous sample of the same CPU. All deltas are zigzag
+// encoded varints and start from 0 in each chunk, so chunks decode independently.
+struct TraceHeader
+{
+	char Magic[4]; // "AMTR"
+	unsigned int Version;
+	unsigned int NumCPUs;
+	unsigned int NumPStates;
+	unsigned long long IntervalUs;
+	unsigned long long Reserved;
+};
+
+struct TraceChunkHeader
+{
+	char Magic[4]; // "CHNK"
+	unsigned int NumSamples;
+	unsigned int PayloadSize;
+	unsigned int Reserved;
+	unsigned long long FirstTime; // us since the start of the trace
+	unsigned long long LastTime;
+};
+
+struct TraceIndexEntry
+{
+	unsigned long long FirstTime;
+	unsigned long long Offset; // of the chunk header in the trace file
+};
+
+struct TraceSample
+{
+	int PState;
+	int VID;
+	int MHz;
+};
+
+
+// Appends samples to a trace file and its index.
+class TraceWriter
+{
+public:
+
+	TraceWriter()
+		: _file(NULL)
+		, _index(NULL)
+		, _numCPUs(0)
+		, _numSamples(0)
+		, _firstTime(0)
+		, _lastTime(0)
+	{ }
+
+	~TraceWriter() { Close(); }
+
+	bool Open(const char* path, int numCPUs, int numPStates, unsigned long long intervalUs);
+	bool Append(unsigned long long time, const std::vector<TraceSample>& samples);
+	bool Close();
+
+
+private:
+
+	static const size_t CHUNK_SIZE = 64 * 1024; // payload bytes
+
+	FILE* _file;
+	FILE* _index;
+	int _numCPUs;
+
+	std::vector<unsigned char> _payload;
+	std::vector<TraceSample> _last;
+	unsigned int _numSamples;
+	unsigned long long _firstTime, _lastTime;
+
+	TraceWriter(const TraceWriter&);
+	TraceWriter& operator=(const TraceWriter&);
+
+	bool FlushChunk();
+	void WriteVarint(long long value);
+};
+
+
+// "Trace" command: samples all cores and writes a binary trace.
+class TraceRecorder
+{
+public:
+
+	TraceRecorder(const Info& info)
+		: _info(&info)
+		, _interval(10)
+		, _duration(0)
+	{ }
+
+	bool ParseParams(int argc, const char* argv[]);
+
+	// runs until a key is pressed or the duration has elapsed
+	void Run();
+
+
+private:
+
+	const Info* _info;
+	std::string _path;
+	int _interval; // ms
+	int _duration; // s (0: unlimited)
+};
+
+
+// "Analyze" command: offline statistics of a trace, decoding chunks in parallel.
+class TraceAnalyzer
+{
+public:
+
+	// per-thread (and finally overall) statistics
+	struct Stats
+	{
+		std::vector<unsigned long long> Residency;         // us, [cpu * NumPStates + pstate]
+		std::vector<unsigned long long> Unknown;           // us per cpu, P-states >= NumPStates
+		std::vector<unsigned long long> Transitions;       // per cpu
+		std::vector<unsigned long long> BucketTransitions; // per time bucket
+	};
+
+	TraceAnalyzer()
+		: _numThreads(0)
+		, _bucket(1000)
+		, _format(FORMAT_TEXT)
+	{ }
+
+	bool ParseParams(int argc, const char* argv[]);
+	void Run();
+
+
+private:
+
+	std::string _path;
+	int _numThreads; // 0: one per logical CPU
+	int _bucket;     // ms per transition-rate bucket
+	OutputFormat _format;
+
+	void Print(const TraceHeader& header, const Stats& stats, unsigned long long duration) const;
+};
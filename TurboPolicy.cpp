@@ -0,0 +1,447 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+// winsock2.h must precede windows.h
+#include <winsock2.h>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <conio.h>
+#include "TurboPolicy.h"
+#include "Kernels.h"
+#include "StringUtils.h"
+
+#pragma comment(lib, "ws2_32.lib")
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+static const DWORD MPERF = 0xe7;
+static const DWORD TSC = 0x10;
+
+
+bool TurboPolicy::ParseParams(int argc, const char* argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const string param(argv[i]);
+
+		string key, value;
+		StringUtils::SplitPair(key, value, param, '=');
+
+		if (!value.empty())
+		{
+			if (_stricmp(key.c_str(), "Signal") == 0)
+			{
+				_path = value;
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Port") == 0)
+			{
+				const int port = atoi(value.c_str());
+				if (port > 0 && port < 65536)
+				{
+					_port = port;
+					continue;
+				}
+			}
+
+			if (_stricmp(key.c_str(), "Interval") == 0)
+			{
+				const int interval = atoi(value.c_str());
+				if (interval > 0)
+				{
+					_interval = interval;
+					continue;
+				}
+			}
+
+			if (_stricmp(key.c_str(), "Busy") == 0)
+			{
+				const double busy = atof(value.c_str());
+				if (busy >= 0 && busy <= 100)
+				{
+					_busy = busy;
+					continue;
+				}
+			}
+
+			if (_stricmp(key.c_str(), "Format") == 0)
+			{
+				if (ParseOutputFormat(value.c_str(), _format))
+					continue;
+			}
+		}
+
+		cerr << "ERROR: invalid parameter " << param.c_str() << endl;
+		return false;
+	}
+
+	if (_path.empty() && _port == 0)
+	{
+		cerr << "ERROR: Signal=<file> and/or Port=<UDP port> required" << endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+DWORD WINAPI TurboPolicy::CoreThread(LPVOID param)
+{
+	Core& core = *static_cast<Core*>(param);
+
+	SwitchTo(core.Index);
+
+	while (true)
+	{
+		WaitForSingleObject(core.Request, INFINITE);
+
+		if (core.Command == COMMAND_STOP)
+			break;
+
+		try
+		{
+			if (core.Command == COMMAND_SAMPLE)
+			{
+				core.MPerf = Rdmsr(MPERF);
+				core.TSC = Rdmsr(TSC);
+			}
+			else
+			{
+				const long long start = GetTimerTicks();
+				core.CPUInfo->SetCPBDis(core.EnableCPB);
+				core.WriteTicks = GetTimerTicks() - start;
+				core.IsCPBEnabled = core.EnableCPB;
+			}
+		}
+		catch (const std::exception& e)
+		{
+			core.Error = e.what();
+		}
+
+		SetEvent(core.Done);
+	}
+
+	return 0;
+}
+
+
+void TurboPolicy::Start()
+{
+	const int numLogicalCPUs = GetNumLogicalCPUs();
+
+	_cores.resize(numLogicalCPUs);
+	_isCritical.assign(numLogicalCPUs, false);
+
+	for (int j = 0; j < numLogicalCPUs; j++)
+		_cores[j].Thread = _cores[j].Request = _cores[j].Done = NULL;
+
+	for (int j = 0; j < numLogicalCPUs; j++)
+	{
+		Core& core = _cores[j];
+		core.CPUInfo = _info;
+		core.Index = j;
+		core.Command = COMMAND_SAMPLE;
+		core.EnableCPB = false;
+		core.MPerf = core.TSC = core.LastMPerf = core.LastTSC = 0;
+		core.RequestTime = 0;
+		core.WriteTicks = 0;
+
+		SwitchTo(j);
+		core.WasCPBDisabled = _info->IsCPBDisabled();
+		core.IsCPBEnabled = !core.WasCPBDisabled;
+
+		core.Request = CreateEvent(NULL, FALSE, FALSE, NULL);
+		core.Done = CreateEvent(NULL, FALSE, FALSE, NULL);
+		core.Thread = CreateThread(NULL, 0, CoreThread, &core, 0, NULL);
+		if (core.Request == NULL || core.Done == NULL || core.Thread == NULL)
+			throw std::exception("cannot create core worker thread");
+	}
+
+	SwitchTo(-1);
+
+	if (_port == 0)
+		return;
+
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+		throw std::exception("Winsock initialization failed");
+
+	const SOCKET s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	_socket = s;
+
+	// local only
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons((u_short)_port);
+
+	u_long nonBlocking = 1;
+	if (s == INVALID_SOCKET
+	    || bind(s, (const sockaddr*)&address, sizeof(address)) != 0
+	    || ioctlsocket(s, FIONBIO, &nonBlocking) != 0)
+		throw std::exception("cannot bind to the specified port");
+}
+
+void TurboPolicy::Stop()
+{
+	for (size_t j = 0; j < _cores.size(); j++)
+	{
+		Core& core = _cores[j];
+
+		if (core.Thread != NULL)
+		{
+			core.Command = COMMAND_STOP;
+			SetEvent(core.Request);
+			WaitForSingleObject(core.Thread, INFINITE);
+			CloseHandle(core.Thread);
+		}
+
+		if (core.Request != NULL)
+			CloseHandle(core.Request);
+		if (core.Done != NULL)
+			CloseHandle(core.Done);
+	}
+
+	_cores.clear();
+
+	if (_port == 0)
+		return;
+
+	if ((SOCKET)_socket != INVALID_SOCKET)
+		closesocket((SOCKET)_socket);
+	_socket = INVALID_SOCKET;
+
+	WSACleanup();
+}
+
+
+// issues a command to the workers of the specified cores and waits for them
+void TurboPolicy::Execute(CoreCommand command, const vector<int>& cores)
+{
+	for (size_t k = 0; k < cores.size(); k++)
+	{
+		Core& core = _cores[cores[k]];
+		core.Command = command;
+		core.RequestTime = GetTimerTicks();
+		SetEvent(core.Request);
+	}
+
+	for (size_t k = 0; k < cores.size(); k++)
+	{
+		Core& core = _cores[cores[k]];
+		WaitForSingleObject(core.Done, INFINITE);
+
+		if (!core.Error.empty())
+			throw std::exception(core.Error.c_str());
+	}
+}
+
+
+// returns true if a new signal has been received
+bool TurboPolicy::ReadSignal()
+{
+	string signal = _lastSignal;
+
+	if (!_path.empty())
+	{
+		std::ifstream file(_path.c_str());
+		if (file)
+			signal.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	}
+
+	// the latest datagram wins
+	if (_port != 0)
+	{
+		char buffer[1024];
+		int length;
+		while ((length = recv((SOCKET)_socket, buffer, sizeof(buffer), 0)) >= 0)
+			signal.assign(buffer, length);
+	}
+
+	if (signal == _lastSignal)
+		return false;
+
+	_lastSignal = signal;
+	ParseSignal(signal);
+	return true;
+}
+
+void TurboPolicy::ParseSignal(const string& signal)
+{
+	_isCritical.assign(_cores.size(), false);
+
+	vector<string> tokens;
+	StringUtils::Tokenize(tokens, signal.c_str(), ", \t\r\n", true);
+
+	for (size_t k = 0; k < tokens.size(); k++)
+	{
+		const int j = atoi(tokens[k].c_str());
+		if (j >= 0 && j < (int)_cores.size())
+			_isCritical[j] = true;
+		else
+			cerr << "WARNING: ignoring logical CPU " << tokens[k].c_str() << " in the signal" << endl;
+	}
+}
+
+
+void TurboPolicy::Run()
+{
+	const Info& info = *_info;
+
+	if (!info.IsBoostSupported)
+		throw std::exception("CPB not supported");
+
+	// CpbDis only has an effect if the boost source is enabled
+	_wasBoostSourceEnabled = info.IsBoostSourceEnabled();
+	info.SetBoostSource(true);
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	const double usPerTick = 1000000.0 / frequency.QuadPart;
+
+	vector<int> allCores;
+
+	try
+	{
+		Start();
+
+		for (int j = 0; j < (int)_cores.size(); j++)
+			allCores.push_back(j);
+
+		Execute(COMMAND_SAMPLE, allCores);
+
+		// keep stdout clean for machine-readable output
+		(_format == FORMAT_TEXT ? cout : cerr) << "turbo policy running (" << _interval << " ms interval), press any key to stop..." << endl;
+
+		RecordWriter writer(stdout, _format);
+		const DWORD startTime = GetTickCount();
+
+		while (!_kbhit())
+		{
+			Sleep(_interval);
+
+			ReadSignal();
+
+			// C0 residency since the last sample (MPERF only counts in C0, at the TSC rate)
+			for (size_t j = 0; j < _cores.size(); j++)
+			{
+				_cores[j].LastMPerf = _cores[j].MPerf;
+				_cores[j].LastTSC = _cores[j].TSC;
+			}
+
+			Execute(COMMAND_SAMPLE, allCores);
+
+			vector<int> changed;
+			vector<double> busy(_cores.size());
+
+			for (size_t j = 0; j < _cores.size(); j++)
+			{
+				Core& core = _cores[j];
+
+				const unsigned long long tsc = core.TSC - core.LastTSC;
+				busy[j] = (tsc == 0 ? 0.0 : 100.0 * (core.MPerf - core.LastMPerf) / tsc);
+
+				core.EnableCPB = (_isCritical[j] && busy[j] >= _busy);
+				if (core.EnableCPB != core.IsCPBEnabled)
+					changed.push_back((int)j);
+			}
+
+			if (changed.empty())
+				continue;
+
+			Execute(COMMAND_SET_CPB, changed);
+
+			const long long now = GetTimerTicks();
+
+			for (size_t k = 0; k < changed.size(); k++)
+			{
+				const Core& core = _cores[changed[k]];
+
+				// from issuing the command until all changed cores are done
+				const double latencyUs = (now - core.RequestTime) * usPerTick;
+				const double writeUs = core.WriteTicks * usPerTick;
+
+				if (_format == FORMAT_TEXT)
+				{
+					cout << "  CPU " << core.Index << ": turbo " << (core.IsCPBEnabled ? "enabled" : "disabled")
+					     << " (busy " << (int)busy[core.Index] << "%, " << latencyUs << " us, MSR write " << writeUs << " us)" << endl;
+					continue;
+				}
+
+				writer.BeginRecord("turbo");
+				writer.Field("time_ms", (int)(GetTickCount() - startTime));
+				writer.Field("cpu", core.Index);
+				writer.Field("enabled", core.IsCPBEnabled);
+				writer.Field("critical", (bool)_isCritical[core.Index]);
+				writer.Field("busy_percent", busy[core.Index]);
+				writer.Field("latency_us", latencyUs);
+				writer.Field("write_us", writeUs);
+				writer.EndRecord();
+			}
+
+			writer.Flush();
+		}
+
+		_getch();
+	}
+	catch (...)
+	{
+		Restore();
+		throw;
+	}
+
+	Restore();
+}
+
+
+// restores the original boost source and CpbDis bits and stops the workers
+void TurboPolicy::Restore()
+{
+	try
+	{
+		// F4x15C may have been changed by other tools since the start
+		_info->InvalidateRegisters();
+		_info->SetBoostSource(_wasBoostSourceEnabled);
+	}
+	catch (const std::exception& e)
+	{
+		cerr << "ERROR: cannot restore the boost source: " << e.what() << endl;
+	}
+
+	vector<int> cores;
+	for (size_t j = 0; j < _cores.size(); j++)
+	{
+		Core& core = _cores[j];
+		core.Error.clear();
+
+		if (core.Thread != NULL && core.IsCPBEnabled != !core.WasCPBDisabled)
+		{
+			core.EnableCPB = !core.WasCPBDisabled;
+			cores.push_back((int)j);
+		}
+	}
+
+	try
+	{
+		Execute(COMMAND_SET_CPB, cores);
+	}
+	catch (const std::exception& e)
+	{
+		cerr << "ERROR: cannot restore CpbDis: " << e.what() << endl;
+	}
+
+	Stop();
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Info.h"
+#include "RecordWriter.h"
+#include "WinRing0.h"
+
+
+// Enables CPB only on the cores currently running latency-critical threads
+// while they are busy, and disables it on all others. The latency-critical
+// cores are read from a signal (a file and/or UDP datagrams on 127.0.0.1)
+// containing a comma separated list of logical CPU indices. Each core is
+// sampled and switched by its own pinned worker thread.
+class TurboPolicy
+{
+public:
+
+	TurboPolicy(const Info& info)
+		: _info(&info)
+		, _interval(100)
+		, _port(0)
+		, _busy(50.0)
+		, _format(FORMAT_TEXT)
+		, _wasBoostSourceEnabled(false)
+		, _socket(~(UINT_PTR)0)
+	{ }
+
+	bool ParseParams(int argc, const char* argv[]);
+
+	// enables the boost source and runs until a key is pressed, then restores
+	// the original boost source and CpbDis bits
+	void Run();
+
+
+private:
+
+	enum CoreCommand
+	{
+		COMMAND_SAMPLE,
+		COMMAND_SET_CPB,
+		COMMAND_STOP
+	};
+
+	// per logical CPU, shared with its worker thread
+	struct Core
+	{
+		const Info* CPUInfo;
+		int Index;
+		HANDLE Thread, Request, Done;
+		CoreCommand Command;
+		bool EnableCPB;         // COMMAND_SET_CPB
+		bool IsCPBEnabled;      // current state
+		bool WasCPBDisabled;    // original CpbDis
+		unsigned long long MPerf, TSC, LastMPerf, LastTSC;
+		long long RequestTime;  // timer ticks when the command was issued
+		long long WriteTicks;   // duration of the MSR write
+		std::string Error;
+	};
+
+	const Info* _info;
+	int _interval;         // ms
+	std::string _path;     // signal file (empty => none)
+	int _port;             // UDP port on 127.0.0.1 (0 => none)
+	double _busy;          // min. C0 residency in % for boosting
+	OutputFormat _format;
+
+	bool _wasBoostSourceEnabled;
+	std::vector<Core> _cores;
+	std::vector<bool> _isCritical; // per logical CPU, last signal
+	std::string _lastSignal;
+	UINT_PTR _socket; // SOCKET
+
+	void Start();
+	void Stop();
+	void Restore();
+
+	void Execute(CoreCommand command, const std::vector<int>& cores);
+	bool ReadSignal();
+	void ParseSignal(const std::string& signal);
+
+	static DWORD WINAPI CoreThread(LPVOID param);
+};
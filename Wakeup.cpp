@@ -0,0 +1,365 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <exception>
+#include <iostream>
+#include "Wakeup.h"
+#include "Kernels.h"
+#include "StringUtils.h"
+#include "WinRing0.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+
+bool WakeupBenchmark::ParseParams(int argc, const char* argv[])
+{
+	const Info& info = *_info;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const string param(argv[i]);
+
+		string key, value;
+		StringUtils::SplitPair(key, value, param, '=');
+
+		if (!value.empty())
+		{
+			if (_stricmp(key.c_str(), "CPUs") == 0)
+			{
+				string waker, sleeper;
+				StringUtils::SplitPair(waker, sleeper, value, ',');
+
+				const int numLogicalCPUs = GetNumLogicalCPUs();
+				_wakerCPU = atoi(waker.c_str());
+				_sleeperCPU = atoi(sleeper.c_str());
+
+				if (!sleeper.empty() && _wakerCPU != _sleeperCPU
+				    && _wakerCPU >= 0 && _wakerCPU < numLogicalCPUs
+				    && _sleeperCPU >= 0 && _sleeperCPU < numLogicalCPUs)
+					continue;
+			}
+
+			if (_stricmp(key.c_str(), "Idle") == 0)
+			{
+				vector<string> tokens;
+				StringUtils::Tokenize(tokens, value, ",", true);
+
+				_idlePeriods.clear();
+				for (size_t j = 0; j < tokens.size(); j++)
+				{
+					const int ms = atoi(tokens[j].c_str());
+					if (ms < 0)
+					{
+						_idlePeriods.clear();
+						break;
+					}
+
+					_idlePeriods.push_back(ms);
+				}
+
+				if (!_idlePeriods.empty())
+					continue;
+			}
+
+			if (_stricmp(key.c_str(), "PStates") == 0)
+			{
+				vector<string> tokens;
+				StringUtils::Tokenize(tokens, value, ",", true);
+
+				_pStates.clear();
+				for (size_t j = 0; j < tokens.size(); j++)
+				{
+					const char* token = tokens[j].c_str();
+					const int index = atoi(token + (tolower(token[0]) == 'p' ? 1 : 0));
+					if (index < info.NumBoostStates || index >= info.NumPStates)
+					{
+						_pStates.clear();
+						break;
+					}
+
+					_pStates.push_back(index);
+				}
+
+				if (!_pStates.empty())
+					continue;
+			}
+
+			if (_stricmp(key.c_str(), "Rounds") == 0 && atoi(value.c_str()) > 0)
+			{
+				_rounds = atoi(value.c_str());
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "C1E") == 0)
+			{
+				const int flag = atoi(value.c_str());
+				if (flag == 0 || flag == 1)
+				{
+					_c1e = flag;
+					continue;
+				}
+			}
+
+			if (_stricmp(key.c_str(), "Format") == 0)
+			{
+				if (ParseOutputFormat(value.c_str(), _format))
+					continue;
+			}
+		}
+
+		cerr << "ERROR: invalid parameter " << param.c_str() << endl;
+		return false;
+	}
+
+	if (_c1e >= 0 && !info.IsC1ESupported())
+	{
+		cerr << "ERROR: C1E not supported" << endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+struct Sleeper
+{
+	int CPU;
+	HANDLE Ping, Pong;
+	volatile bool Stop;
+	double WokenAt; // s
+};
+
+static DWORD WINAPI SleeperThread(LPVOID param)
+{
+	Sleeper& sleeper = *static_cast<Sleeper*>(param);
+
+	SwitchTo(sleeper.CPU);
+
+	for (;;)
+	{
+		// blocks, i.e., the core halts until it is woken up
+		WaitForSingleObject(sleeper.Ping, INFINITE);
+		sleeper.WokenAt = GetSeconds();
+
+		if (sleeper.Stop)
+			break;
+
+		SetEvent(sleeper.Pong);
+	}
+
+	SwitchTo(-1);
+	return 0;
+}
+
+void WakeupBenchmark::Measure(int idlePeriod, vector<double>& latencies) const
+{
+	Sleeper sleeper;
+	sleeper.CPU = _sleeperCPU;
+	sleeper.Ping = CreateEvent(NULL, FALSE, FALSE, NULL);
+	sleeper.Pong = CreateEvent(NULL, FALSE, FALSE, NULL);
+	sleeper.Stop = false;
+	sleeper.WokenAt = 0.0;
+
+	const HANDLE thread = (sleeper.Ping != NULL && sleeper.Pong != NULL
+		? CreateThread(NULL, 0, SleeperThread, &sleeper, 0, NULL) : NULL);
+
+	if (thread == NULL)
+	{
+		if (sleeper.Ping != NULL)
+			CloseHandle(sleeper.Ping);
+		if (sleeper.Pong != NULL)
+			CloseHandle(sleeper.Pong);
+		throw std::exception("cannot create the sleeping thread");
+	}
+
+	// the performance counter is consistent across cores
+	SwitchTo(_wakerCPU);
+
+	latencies.clear();
+	for (int round = 0; round < _rounds; round++)
+	{
+		// both cores idle (the waker blocks in Sleep())
+		Sleep(idlePeriod);
+
+		const double signaledAt = GetSeconds();
+		SetEvent(sleeper.Ping);
+		WaitForSingleObject(sleeper.Pong, INFINITE);
+
+		latencies.push_back(sleeper.WokenAt - signaledAt);
+	}
+
+	sleeper.Stop = true;
+	SetEvent(sleeper.Ping);
+	WaitForSingleObject(thread, INFINITE);
+
+	CloseHandle(thread);
+	CloseHandle(sleeper.Ping);
+	CloseHandle(sleeper.Pong);
+
+	SwitchTo(-1);
+}
+
+
+void WakeupBenchmark::SetPState(int pState) const
+{
+	SwitchTo(_wakerCPU);
+	_info->SetCurrentPState(pState);
+	SwitchTo(_sleeperCPU);
+	_info->SetCurrentPState(pState);
+	SwitchTo(-1);
+}
+
+void WakeupBenchmark::SetC1E(bool enabled) const
+{
+	// C1E is entered when all cores halt, so it is set everywhere
+	for (int j = 0; j < GetNumLogicalCPUs(); j++)
+	{
+		SwitchTo(j);
+		_info->SetC1E(enabled);
+	}
+	SwitchTo(-1);
+}
+
+
+void WakeupBenchmark::Run()
+{
+	const Info& info = *_info;
+
+	const int numLogicalCPUs = GetNumLogicalCPUs();
+	if (numLogicalCPUs < 2)
+		throw std::exception("at least 2 logical CPUs required");
+
+	if (_sleeperCPU < 0)
+		_sleeperCPU = (_wakerCPU == numLogicalCPUs - 1 ? 0 : numLogicalCPUs - 1);
+
+	if (_idlePeriods.empty())
+	{
+		_idlePeriods.push_back(1);
+		_idlePeriods.push_back(10);
+		_idlePeriods.push_back(100);
+	}
+
+	if (_pStates.empty())
+	{
+		for (int i = info.NumBoostStates; i < info.NumPStates; i++)
+			_pStates.push_back(i);
+	}
+
+	vector<int> c1eStates;
+	if (_c1e >= 0)
+		c1eStates.push_back(_c1e);
+	else if (info.IsC1ESupported())
+	{
+		c1eStates.push_back(0);
+		c1eStates.push_back(1);
+	}
+	else
+		c1eStates.push_back(-1); // as is
+
+	// original states, restored afterwards
+	vector<int> originalC1E(numLogicalCPUs, -1);
+	for (int j = 0; j < numLogicalCPUs && info.IsC1ESupported(); j++)
+	{
+		SwitchTo(j);
+		originalC1E[j] = (info.IsC1EEnabled() ? 1 : 0);
+	}
+	SwitchTo(_wakerCPU);
+	const int wakerPState = info.GetCurrentPState();
+	SwitchTo(_sleeperCPU);
+	const int sleeperPState = info.GetCurrentPState();
+	SwitchTo(-1);
+
+	if (_format == FORMAT_TEXT)
+	{
+		cout << "Wake-up latency of CPU " << _sleeperCPU << " woken by CPU " << _wakerCPU
+		     << ", " << _rounds << " rounds each [us]:" << endl;
+		cout << "  C1E  P-state  idle [ms]  min  median  p99  max" << endl;
+	}
+
+	RecordWriter writer(stdout, _format);
+	vector<double> latencies;
+
+	try
+	{
+		for (size_t c = 0; c < c1eStates.size(); c++)
+		{
+			if (c1eStates[c] >= 0)
+				SetC1E(c1eStates[c] == 1);
+
+			for (size_t p = 0; p < _pStates.size(); p++)
+			{
+				SetPState(_pStates[p]);
+
+				for (size_t k = 0; k < _idlePeriods.size(); k++)
+				{
+					Measure(_idlePeriods[k], latencies);
+					std::sort(latencies.begin(), latencies.end());
+
+					const size_t n = latencies.size();
+					const double minimum = latencies[0] * 1e6;
+					const double median = latencies[n / 2] * 1e6;
+					const double p99 = latencies[(n * 99 + 99) / 100 - 1] * 1e6;
+					const double maximum = latencies[n - 1] * 1e6;
+
+					const char* c1e = (c1eStates[c] < 0 ? "-" : (c1eStates[c] == 1 ? "on" : "off"));
+
+					if (_format == FORMAT_TEXT)
+					{
+						cout << "  " << c1e << "  P" << _pStates[p] << "  " << _idlePeriods[k] << "  "
+						     << minimum << "  " << median << "  " << p99 << "  " << maximum << endl;
+						continue;
+					}
+
+					writer.BeginRecord("wakeup");
+					writer.Field("c1e", c1e);
+					writer.Field("pstate", _pStates[p]);
+					writer.Field("idle_ms", _idlePeriods[k]);
+					writer.Field("min_us", minimum);
+					writer.Field("median_us", median);
+					writer.Field("p99_us", p99);
+					writer.Field("max_us", maximum);
+					writer.EndRecord();
+					writer.Flush();
+				}
+			}
+		}
+	}
+	catch (...)
+	{
+		Restore(originalC1E, wakerPState, sleeperPState);
+		throw;
+	}
+
+	Restore(originalC1E, wakerPState, sleeperPState);
+}
+
+
+void WakeupBenchmark::Restore(const vector<int>& originalC1E, int wakerPState, int sleeperPState) const
+{
+	const Info& info = *_info;
+
+	for (size_t j = 0; j < originalC1E.size(); j++)
+	{
+		if (originalC1E[j] < 0)
+			continue;
+
+		SwitchTo((int)j);
+		info.SetC1E(originalC1E[j] == 1);
+	}
+
+	SwitchTo(_wakerCPU);
+	info.SetCurrentPState(wakerPState);
+	SwitchTo(_sleeperCPU);
+	info.SetCurrentPState(sleeperPState);
+	SwitchTo(-1);
+}
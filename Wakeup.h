@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma once
+
+#include <vector>
+#include "Info.h"
+#include "RecordWriter.h"
+
+
+// "Wakeup" command: measures the cross-core wake-up latency with two pinned
+// threads playing ping-pong after idle periods of various lengths, with C1E
+// on and off and at each software P-state.
+class WakeupBenchmark
+{
+public:
+
+	WakeupBenchmark(const Info& info)
+		: _info(&info)
+		, _wakerCPU(0)
+		, _sleeperCPU(-1)
+		, _rounds(20)
+		, _c1e(-1)
+		, _format(FORMAT_TEXT)
+	{ }
+
+	bool ParseParams(int argc, const char* argv[]);
+
+	void Run();
+
+
+private:
+
+	const Info* _info;
+	int _wakerCPU, _sleeperCPU; // -1: the last logical CPU
+	std::vector<int> _idlePeriods; // ms
+	std::vector<int> _pStates;     // hardware indices, empty: all software P-states
+	int _rounds;
+	int _c1e; // -1: both
+	OutputFormat _format;
+
+	// one-way latencies in s
+	void Measure(int idlePeriod, std::vector<double>& latencies) const;
+
+	void SetPState(int pState) const; // on both CPUs
+	void SetC1E(bool enabled) const;  // on all logical CPUs
+	void Restore(const std::vector<int>& originalC1E, int wakerPState, int sleeperPState) const;
+};
@@ -1,101 +1,229 @@
-/*
- * Copyright (c) Martin Kinkelin
- *
- * See the "License.txt" file in the root directory for infos
- * about permitted and prohibited uses of this code.
- */
-
-#pragma comment(lib, "WinRing0/WinRing0.lib")
-#pragma comment(lib, "WinRing0/WinRing0x64.lib")
-
-#include "WinRing0.h"
-#include "StringUtils.h"
-
-using std::exception;
-using std::string;
-
-
-DWORD ReadPciConfig(DWORD device, DWORD function, DWORD regAddress)
-{
-	const DWORD pciAddress = ((device & 0x1f) << 3) | (function & 0x7);
-
-	DWORD result;
-	if (!ReadPciConfigDwordEx(pciAddress, regAddress, &result))
-	{
-		string msg = "cannot read from PCI configuration space (F";
-		msg += StringUtils::ToString(function);
-		msg += "x";
-		msg += StringUtils::ToHexString(regAddress);
-		msg += ")";
-
-		throw exception(msg.c_str());
-	}
-
-	return result;
-}
-
-void WritePciConfig(DWORD device, DWORD function, DWORD regAddress, DWORD value)
-{
-	const DWORD pciAddress = ((device & 0x1f) << 3) | (function & 0x7);
-
-	if (!WritePciConfigDwordEx(pciAddress, regAddress, value))
-	{
-		string msg = "cannot write to PCI configuration space (F";
-		msg += StringUtils::ToString(function);
-		msg += "x";
-		msg += StringUtils::ToHexString(regAddress);
-		msg += ")";
-
-		throw exception(msg.c_str());
-	}
-}
-
-
-QWORD Rdmsr(DWORD index)
-{
-	QWORD result;
-	PDWORD eax = (PDWORD)&result;
-	PDWORD edx = eax + 1;
-
-	if (!Rdmsr(index, eax, edx))
-	{
-		string msg = "cannot read from MSR (0x";
-		msg += StringUtils::ToHexString(index);
-		msg += ")";
-
-		throw exception(msg.c_str());
-	}
-
-	return result;
-}
-
-void Wrmsr(DWORD index, const QWORD& value)
-{
-	PDWORD eax = (PDWORD)&value;
-	PDWORD edx = eax + 1;
-
-	if (!Wrmsr(index, *eax, *edx))
-	{
-		string msg = "cannot write to MSR (0x";
-		msg += StringUtils::ToHexString(index);
-		msg += ")";
-
-		throw exception(msg.c_str());
-	}
-}
-
-
-CpuidRegs Cpuid(DWORD index)
-{
-	CpuidRegs result;
-	if (!Cpuid(index, &result.eax, &result.ebx, &result.ecx, &result.edx))
-	{
-		string msg = "cannot execute CPUID instruction (0x";
-		msg += StringUtils::ToHexString(index);
-		msg += ")";
-
-		throw exception(msg.c_str());
-	}
-
-	return result;
-}
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#pragma comment(lib, "WinRing0/WinRing0.lib")
+#pragma comment(lib, "WinRing0/WinRing0x64.lib")
+
+#include "WinRing0.h"
+#include "Backend.h"
+#include "StringUtils.h"
+
+using std::exception;
+using std::string;
+
+
+class WinRing0Backend : public Backend
+{
+public:
+
+	DWORD ReadPciConfig(DWORD device, DWORD function, DWORD regAddress);
+	void WritePciConfig(DWORD device, DWORD function, DWORD regAddress, DWORD value);
+
+	QWORD Rdmsr(DWORD index);
+	void Wrmsr(DWORD index, const QWORD& value);
+
+	CpuidRegs Cpuid(DWORD index);
+
+	int GetNumLogicalCPUs();
+	void SwitchTo(int logicalCPUIndex);
+	bool IsOnline(int logicalCPUIndex);
+};
+
+static WinRing0Backend winRing0Backend;
+static Backend* currentBackend = &winRing0Backend;
+
+// logical CPU of the calling thread, as set by SwitchTo()
+static __declspec(thread) int currentCPU = -1;
+
+
+Backend* GetBackend()
+{
+	return (currentBackend == &winRing0Backend ? NULL : currentBackend);
+}
+
+void SetBackend(Backend* backend)
+{
+	currentBackend = (backend == NULL ? &winRing0Backend : backend);
+}
+
+Backend* GetWinRing0Backend()
+{
+	return &winRing0Backend;
+}
+
+
+DWORD ReadPciConfig(DWORD device, DWORD function, DWORD regAddress)
+{
+	return currentBackend->ReadPciConfig(device, function, regAddress);
+}
+
+void WritePciConfig(DWORD device, DWORD function, DWORD regAddress, DWORD value)
+{
+	currentBackend->WritePciConfig(device, function, regAddress, value);
+}
+
+void ReadPciConfigBlock(DWORD device, DWORD function, DWORD regAddress, DWORD* values, int count)
+{
+	currentBackend->ReadPciConfigBlock(device, function, regAddress, values, count);
+}
+
+QWORD Rdmsr(DWORD index)
+{
+	return currentBackend->Rdmsr(index);
+}
+
+void Wrmsr(DWORD index, const QWORD& value)
+{
+	currentBackend->Wrmsr(index, value);
+}
+
+CpuidRegs Cpuid(DWORD index)
+{
+	return currentBackend->Cpuid(index);
+}
+
+int GetNumLogicalCPUs()
+{
+	return currentBackend->GetNumLogicalCPUs();
+}
+
+bool IsOnline(int logicalCPUIndex)
+{
+	return currentBackend->IsOnline(logicalCPUIndex);
+}
+
+void SwitchTo(int logicalCPUIndex)
+{
+	currentBackend->SwitchTo(logicalCPUIndex);
+	currentCPU = logicalCPUIndex;
+}
+
+int GetCurrentCPU()
+{
+	return currentCPU;
+}
+
+
+DWORD WinRing0Backend::ReadPciConfig(DWORD device, DWORD function, DWORD regAddress)
+{
+	const DWORD pciAddress = ((device & 0x1f) << 3) | (function & 0x7);
+
+	DWORD result;
+	if (!ReadPciConfigDwordEx(pciAddress, regAddress, &result))
+	{
+		string msg = "cannot read from PCI configuration space (F";
+		msg += StringUtils::ToString(function);
+		msg += "x";
+		msg += StringUtils::ToHexString(regAddress);
+		msg += ")";
+
+		throw exception(msg.c_str());
+	}
+
+	return result;
+}
+
+void WinRing0Backend::WritePciConfig(DWORD device, DWORD function, DWORD regAddress, DWORD value)
+{
+	const DWORD pciAddress = ((device & 0x1f) << 3) | (function & 0x7);
+
+	if (!WritePciConfigDwordEx(pciAddress, regAddress, value))
+	{
+		string msg = "cannot write to PCI configuration space (F";
+		msg += StringUtils::ToString(function);
+		msg += "x";
+		msg += StringUtils::ToHexString(regAddress);
+		msg += ")";
+
+		throw exception(msg.c_str());
+	}
+}
+
+
+QWORD WinRing0Backend::Rdmsr(DWORD index)
+{
+	QWORD result;
+	PDWORD eax = (PDWORD)&result;
+	PDWORD edx = eax + 1;
+
+	if (!::Rdmsr(index, eax, edx))
+	{
+		string msg = "cannot read from MSR (0x";
+		msg += StringUtils::ToHexString(index);
+		msg += ")";
+
+		throw exception(msg.c_str());
+	}
+
+	return result;
+}
+
+void WinRing0Backend::Wrmsr(DWORD index, const QWORD& value)
+{
+	PDWORD eax = (PDWORD)&value;
+	PDWORD edx = eax + 1;
+
+	if (!::Wrmsr(index, *eax, *edx))
+	{
+		string msg = "cannot write to MSR (0x";
+		msg += StringUtils::ToHexString(index);
+		msg += ")";
+
+		throw exception(msg.c_str());
+	}
+}
+
+
+CpuidRegs WinRing0Backend::Cpuid(DWORD index)
+{
+	CpuidRegs result;
+	if (!::Cpuid(index, &result.eax, &result.ebx, &result.ecx, &result.edx))
+	{
+		string msg = "cannot execute CPUID instruction (0x";
+		msg += StringUtils::ToHexString(index);
+		msg += ")";
+
+		throw exception(msg.c_str());
+	}
+
+	return result;
+}
+
+
+int WinRing0Backend::GetNumLogicalCPUs()
+{
+	SYSTEM_INFO sysInfo;
+	GetSystemInfo(&sysInfo);
+	return (int)sysInfo.dwNumberOfProcessors;
+}
+
+bool WinRing0Backend::IsOnline(int logicalCPUIndex)
+{
+	// processors added at runtime are counted and marked active
+	SYSTEM_INFO sysInfo;
+	GetSystemInfo(&sysInfo);
+
+	if (logicalCPUIndex < 0 || logicalCPUIndex >= (int)sysInfo.dwNumberOfProcessors)
+		return false;
+
+	// the mask only covers the first processor group
+	return (logicalCPUIndex >= (int)sizeof(DWORD_PTR) * 8 || ((sysInfo.dwActiveProcessorMask >> logicalCPUIndex) & 1) != 0);
+}
+
+void WinRing0Backend::SwitchTo(int logicalCPUIndex)
+{
+	const HANDLE hThread = GetCurrentThread();
+
+	if (logicalCPUIndex < 0)
+	{
+		DWORD_PTR processMask, systemMask;
+		GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask);
+		SetThreadAffinityMask(hThread, processMask);
+	}
+	else
+		SetThreadAffinityMask(hThread, (DWORD_PTR)1 << logicalCPUIndex);
+}
@@ -1,253 +1,403 @@
-/*
- * Copyright (c) Martin Kinkelin
- *
- * See the "License.txt" file in the root directory for infos
- * about permitted and prohibited uses of this code.
- */
-
-#include <algorithm>
-#include <iostream>
-#include <locale>
-#include "Worker.h"
-#include "StringUtils.h"
-#include "WinRing0.h"
-
-using std::cerr;
-using std::endl;
-using std::min;
-using std::max;
-using std::string;
-using std::tolower;
-using std::vector;
-
-
-static void SplitPair(string& left, string& right, const string& str, char delimiter)
-{
-	const size_t i = str.find(delimiter);
-
-	left = str.substr(0, i);
-
-	if (i == string::npos)
-		right.clear();
-	else
-		right = str.substr(i + 1);
-
-}
-
-bool Worker::ParseParams(int argc, const char* argv[])
-{
-	const Info& info = *_info;
-
-	PStateInfo psi;
-	psi.Multi = psi.VID = psi.NBVID = -1;
-	psi.NBPState = -1;
-
-	NBPStateInfo nbpsi;
-	nbpsi.Multi = nbpsi.VID = -1.0;
-
-	for (int i = 0; i < info.NumPStates; i++)
-	{
-		_pStates.push_back(psi);
-		_pStates.back().Index = i;
-	}
-	for (int i = 0; i < info.NumNBPStates; i++)
-	{
-		_nbPStates.push_back(nbpsi);
-		_nbPStates.back().Index = i;
-	}
-
-	for (int i = 1; i < argc; i++)
-	{
-		const string param(argv[i]);
-
-		string key, value;
-		SplitPair(key, value, param, '=');
-
-		if (value.empty())
-		{
-			if (param.length() >= 2 && tolower(param[0]) == 'p')
-			{
-				const int index = atoi(param.c_str() + 1);
-				if (index >= 0 && index < info.NumPStates)
-				{
-					_pState = index;
-					continue;
-				}
-			}
-		}
-		else
-		{
-			if (key.length() >= 2 && tolower(key[0]) == 'p')
-			{
-				const int index = atoi(key.c_str() + 1);
-				if (index >= 0 && index < info.NumPStates)
-				{
-					string multi, vid;
-					SplitPair(multi, vid, value, '@');
-
-					if (!multi.empty())
-						_pStates[index].Multi = info.multiScaleFactor * atof(multi.c_str());
-					if (!vid.empty())
-						_pStates[index].VID = info.EncodeVID(atof(vid.c_str()));
-
-					continue;
-				}
-			}
-
-			if (key.length() >= 5 && _strnicmp(key.c_str(), "NB_P", 4) == 0)
-			{
-				const int index = atoi(key.c_str() + 4);
-				if (index >= 0 && index < info.NumNBPStates)
-				{
-					string multi, vid;
-					SplitPair(multi, vid, value, '@');
-
-					if (!multi.empty())
-						_nbPStates[index].Multi = atof(multi.c_str());
-					if (!vid.empty())
-						_nbPStates[index].VID = info.EncodeVID(atof(vid.c_str()));
-
-					continue;
-				}
-			}
-
-			if (_stricmp(key.c_str(), "NB_low") == 0)
-			{
-				const int index = atoi(value.c_str());
-
-				int j = 0;
-				for (; j < min(index, info.NumPStates); j++)
-					_pStates[j].NBPState = 0;
-				for (; j < info.NumPStates; j++)
-					_pStates[j].NBPState = 1;
-
-				continue;
-			}
-
-			if (_stricmp(key.c_str(), "Turbo") == 0)
-			{
-				const int flag = atoi(value.c_str());
-				if (flag == 0 || flag == 1)
-				{
-					_turbo = flag;
-					continue;
-				}
-			}
-
-			if (_stricmp(key.c_str(), "APM") == 0)
-			{
-				const int flag = atoi(value.c_str());
-				if (flag == 0 || flag == 1)
-				{
-					_apm = flag;
-					continue;
-				}
-			}
-		}
-
-		cerr << "ERROR: invalid parameter " << param.c_str() << endl;
-		return false;
-	}
-
-	return true;
-}
-
-
-static bool ContainsChanges(const PStateInfo& info)
-{
-	return (info.Multi >= 0 || info.VID >= 0 || info.NBVID >= 0 || info.NBPState >= 0);
-}
-static bool ContainsChanges(const NBPStateInfo& info)
-{
-	return (info.Multi >= 0 || info.VID >= 0);
-}
-
-static void SwitchTo(int logicalCPUIndex)
-{
-	const HANDLE hThread = GetCurrentThread();
-	SetThreadAffinityMask(hThread, (DWORD_PTR)1 << logicalCPUIndex);
-}
-
-void Worker::ApplyChanges()
-{
-	const Info& info = *_info;
-
-	if (info.Family == 0x15)
-	{
-		for (int i = 0; i < _nbPStates.size(); i++)
-		{
-			const NBPStateInfo& nbpsi = _nbPStates[i];
-			if (ContainsChanges(nbpsi))
-				info.WriteNBPState(nbpsi);
-		}
-	}
-	else if (info.Family == 0x10 && (_nbPStates[0].VID >= 0 || _nbPStates[1].VID >= 0))
-	{
-		for (int i = 0; i < _pStates.size(); i++)
-		{
-			PStateInfo& psi = _pStates[i];
-
-			const int nbPState = (psi.NBPState >= 0 ? psi.NBPState :
-			                                          info.ReadPState(i).NBPState);
-			const NBPStateInfo& nbpsi = _nbPStates[nbPState];
-
-			if (nbpsi.VID >= 0)
-				psi.NBVID = nbpsi.VID;
-		}
-	}
-
-	if (_turbo >= 0 && info.IsBoostSupported)
-		info.SetBoostSource(_turbo == 1);
-	if (_apm >= 0 && info.Family == 0x15)
-		info.SetAPM(_apm == 1);
-
-	SYSTEM_INFO sysInfo;
-	GetSystemInfo(&sysInfo);
-	const int numLogicalCPUs = sysInfo.dwNumberOfProcessors;
-
-	// switch to the highest thread priority (we do not want to get interrupted often)
-	const HANDLE hProcess = GetCurrentProcess();
-	const HANDLE hThread = GetCurrentThread();
-	SetPriorityClass(hProcess, REALTIME_PRIORITY_CLASS);
-	SetThreadPriority(hThread, THREAD_PRIORITY_HIGHEST);
-
-	// perform one iteration in each logical core
-	for (int j = 0; j < numLogicalCPUs; j++)
-	{
-		SwitchTo(j);
-
-		for (int i = 0; i < _pStates.size(); i++)
-		{
-			const PStateInfo& psi = _pStates[i];
-			if (ContainsChanges(psi))
-				info.WritePState(psi);
-		}
-
-		if (_turbo >= 0 && info.IsBoostSupported)
-			info.SetCPBDis(_turbo == 1);
-	}
-
-	for (int j = 0; j < numLogicalCPUs; j++)
-	{
-		SwitchTo(j);
-
-		const int currentPState = info.GetCurrentPState();
-		const int newPState = (_pState >= 0 ? _pState : currentPState);
-
-		if (newPState != currentPState)
-			info.SetCurrentPState(newPState);
-		else
-		{
-			if (ContainsChanges(_pStates[currentPState]))
-			{
-				const int tempPState = (currentPState == info.NumPStates - 1 ? 0 : info.NumPStates - 1);
-				info.SetCurrentPState(tempPState);
-				Sleep(1);
-				info.SetCurrentPState(currentPState);
-			}
-		}
-	}
-
-	SetThreadPriority(hThread, THREAD_PRIORITY_NORMAL);
-	SetPriorityClass(hProcess, NORMAL_PRIORITY_CLASS);
-}
+/*
+ * Copyright (c) Martin Kinkelin
+ *
+ * See the "License.txt" file in the root directory for infos
+ * about permitted and prohibited uses of this code.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <locale>
+#include "Worker.h"
+#include "PStateTable.h"
+#include "StringUtils.h"
+#include "WinRing0.h"
+
+using std::cerr;
+using std::endl;
+using std::min;
+using std::max;
+using std::string;
+using std::tolower;
+using std::vector;
+
+
+bool Worker::ParseParams(int argc, const char* argv[])
+{
+	const Info& info = *_info;
+
+	// may be called again to apply another set of changes
+	_pStates.clear();
+	_nbPStates.clear();
+	_turbo = _apm = _c1e = _pState = -1;
+
+	PStateInfo psi;
+	psi.Multi = psi.VID = psi.NBVID = -1;
+	psi.NBPState = -1;
+
+	NBPStateInfo nbpsi;
+	nbpsi.Multi = nbpsi.VID = -1.0;
+
+	for (int i = 0; i < info.NumPStates; i++)
+	{
+		_pStates.push_back(psi);
+		_pStates.back().Index = i;
+	}
+	for (int i = 0; i < info.NumNBPStates; i++)
+	{
+		_nbPStates.push_back(nbpsi);
+		_nbPStates.back().Index = i;
+	}
+
+	for (int i = 1; i < argc; i++)
+	{
+		const string param(argv[i]);
+
+		string key, value;
+		StringUtils::SplitPair(key, value, param, '=');
+
+		if (value.empty())
+		{
+			if (param.length() >= 2 && tolower(param[0]) == 'p')
+			{
+				const int index = atoi(param.c_str() + 1);
+				if (index >= 0 && index < info.NumPStates)
+				{
+					_pState = index;
+					continue;
+				}
+			}
+		}
+		else
+		{
+			if (key.length() >= 2 && tolower(key[0]) == 'p')
+			{
+				const int index = atoi(key.c_str() + 1);
+				if (index >= 0 && index < info.NumPStates)
+				{
+					string multi, vid;
+					StringUtils::SplitPair(multi, vid, value, '@');
+
+					if (!multi.empty())
+						_pStates[index].Multi = info.multiScaleFactor * atof(multi.c_str());
+					if (!vid.empty())
+						_pStates[index].VID = info.EncodeVID(atof(vid.c_str()));
+
+					continue;
+				}
+			}
+
+			if (key.length() >= 5 && _strnicmp(key.c_str(), "NB_P", 4) == 0)
+			{
+				const int index = atoi(key.c_str() + 4);
+				if (index >= 0 && index < info.NumNBPStates)
+				{
+					string multi, vid;
+					StringUtils::SplitPair(multi, vid, value, '@');
+
+					if (!multi.empty())
+						_nbPStates[index].Multi = atof(multi.c_str());
+					if (!vid.empty())
+						_nbPStates[index].VID = info.EncodeVID(atof(vid.c_str()));
+
+					continue;
+				}
+			}
+
+			if (_stricmp(key.c_str(), "NB_low") == 0)
+			{
+				const int index = atoi(value.c_str());
+
+				int j = 0;
+				for (; j < min(index, info.NumPStates); j++)
+					_pStates[j].NBPState = 0;
+				for (; j < info.NumPStates; j++)
+					_pStates[j].NBPState = 1;
+
+				continue;
+			}
+
+			if (_stricmp(key.c_str(), "Turbo") == 0)
+			{
+				const int flag = atoi(value.c_str());
+				if (flag == 0 || flag == 1)
+				{
+					_turbo = flag;
+					continue;
+				}
+			}
+
+			if (_stricmp(key.c_str(), "APM") == 0)
+			{
+				const int flag = atoi(value.c_str());
+				if (flag == 0 || flag == 1)
+				{
+					_apm = flag;
+					continue;
+				}
+			}
+
+			if (_stricmp(key.c_str(), "C1E") == 0)
+			{
+				const int flag = atoi(value.c_str());
+				if ((flag == 0 || flag == 1) && info.IsC1ESupported())
+				{
+					_c1e = flag;
+					continue;
+				}
+			}
+		}
+
+		cerr << "ERROR: invalid parameter " << param.c_str() << endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+static bool ContainsChanges(const PStateInfo& info)
+{
+	return (info.Multi >= 0 || info.VID >= 0 || info.NBVID >= 0 || info.NBPState >= 0);
+}
+static bool ContainsChanges(const NBPStateInfo& info)
+{
+	return (info.Multi >= 0 || info.VID >= 0);
+}
+
+void Worker::ApplyChanges()
+{
+	const Info& info = *_info;
+
+	// the P-state status and control registers are read more than once
+	RegisterEpoch epoch(info);
+
+	if (info.Family == 0x15)
+	{
+		for (int i = 0; i < _nbPStates.size(); i++)
+		{
+			const NBPStateInfo& nbpsi = _nbPStates[i];
+			if (ContainsChanges(nbpsi))
+				info.WriteNBPState(nbpsi);
+		}
+	}
+	else if (info.Family == 0x10 && (_nbPStates[0].VID >= 0 || _nbPStates[1].VID >= 0))
+	{
+		for (int i = 0; i < _pStates.size(); i++)
+		{
+			PStateInfo& psi = _pStates[i];
+
+			const int nbPState = (psi.NBPState >= 0 ? psi.NBPState :
+			                                          info.ReadPState(i).NBPState);
+			const NBPStateInfo& nbpsi = _nbPStates[nbPState];
+
+			if (nbpsi.VID >= 0)
+				psi.NBVID = nbpsi.VID;
+		}
+	}
+
+	if (_turbo >= 0 && info.IsBoostSupported)
+		info.SetBoostSource(_turbo == 1);
+	if (_apm >= 0 && info.Family == 0x15)
+		info.SetAPM(_apm == 1);
+
+	const int numLogicalCPUs = GetNumLogicalCPUs();
+
+	// switch to the highest thread priority (we do not want to get interrupted often)
+	const HANDLE hProcess = GetCurrentProcess();
+	const HANDLE hThread = GetCurrentThread();
+	SetPriorityClass(hProcess, REALTIME_PRIORITY_CLASS);
+	SetThreadPriority(hThread, THREAD_PRIORITY_HIGHEST);
+
+	// P-states actually rewritten, per logical core (bit i for P<i>)
+	vector<int> changedPStates(numLogicalCPUs, 0);
+
+	// perform one iteration in each logical core
+	for (int j = 0; j < numLogicalCPUs; j++)
+	{
+		SwitchTo(j);
+		changedPStates[j] = WriteCoreSettings();
+	}
+
+	for (int j = 0; j < numLogicalCPUs; j++)
+	{
+		SwitchTo(j);
+		ActivatePState(changedPStates[j]);
+	}
+
+	SetThreadPriority(hThread, THREAD_PRIORITY_NORMAL);
+	SetPriorityClass(hProcess, NORMAL_PRIORITY_CLASS);
+}
+
+int Worker::ApplyToCore(int logicalCPUIndex) const
+{
+	RegisterEpoch epoch(*_info);
+
+	SwitchTo(logicalCPUIndex);
+	const int changedPStates = WriteCoreSettings();
+	ActivatePState(changedPStates);
+	SwitchTo(-1);
+
+	return changedPStates;
+}
+
+
+int Worker::WriteCoreSettings() const
+{
+	const Info& info = *_info;
+
+	int changedPStates = 0;
+	for (int i = 0; i < _pStates.size(); i++)
+	{
+		const PStateInfo& psi = _pStates[i];
+		if (ContainsChanges(psi) && info.WritePState(psi))
+			changedPStates |= (1 << i);
+	}
+
+	if (_turbo >= 0 && info.IsBoostSupported)
+		info.SetCPBDis(_turbo == 1);
+	if (_c1e >= 0)
+		info.SetC1E(_c1e == 1);
+
+	return changedPStates;
+}
+
+void Worker::ActivatePState(int changedPStates) const
+{
+	const Info& info = *_info;
+
+	const int currentPState = info.GetCurrentPState();
+	const int newPState = (_pState >= 0 ? _pState : currentPState);
+
+	if (newPState != currentPState)
+		info.SetCurrentPState(newPState);
+	else
+	{
+		// a rewritten P-state only takes effect when entered again
+		if (changedPStates & (1 << currentPState))
+		{
+			const int tempPState = (currentPState == info.NumPStates - 1 ? 0 : info.NumPStates - 1);
+			info.SetCurrentPState(tempPState);
+			Sleep(1);
+			info.SetCurrentPState(currentPState);
+		}
+	}
+}
+
+
+static void ReportMismatch(int logicalCPUIndex, const char* what, int index, double actual, double expected)
+{
+	if (logicalCPUIndex >= 0)
+		cerr << "  CPU " << logicalCPUIndex << ": ";
+	else
+		cerr << "  ";
+
+	cerr << what << index << " is " << actual << ", expected " << expected << endl;
+}
+
+bool Worker::Verify() const
+{
+	const Info& info = *_info;
+
+	bool result = true;
+
+	if (info.Family == 0x15)
+	{
+		for (int i = 0; i < _nbPStates.size(); i++)
+		{
+			const NBPStateInfo& nbpsi = _nbPStates[i];
+			if (!ContainsChanges(nbpsi))
+				continue;
+
+			// encode + decode the requested values to account for rounding
+			DWORD eax = 0;
+			info.EncodeNBPState(nbpsi, eax);
+			const NBPStateInfo expected = info.DecodeNBPState(i, eax);
+			const NBPStateInfo actual = info.ReadNBPState(i);
+
+			if (nbpsi.Multi >= 0 && actual.Multi != expected.Multi)
+			{
+				ReportMismatch(-1, "multi of NB_P", i, actual.Multi, expected.Multi);
+				result = false;
+			}
+			if (nbpsi.VID >= 0 && actual.VID != expected.VID)
+			{
+				ReportMismatch(-1, "voltage of NB_P", i, info.DecodeVID(actual.VID), info.DecodeVID(expected.VID));
+				result = false;
+			}
+		}
+	}
+
+	// P-state MSRs of all logical CPUs in one pass
+	PStateTable table;
+	table.Read(info);
+	info.LoadRegisters(table);
+
+	for (int j = 0; j < table.NumCPUs; j++)
+	{
+		for (int i = 0; i < _pStates.size(); i++)
+		{
+			const PStateInfo& psi = _pStates[i];
+			if (!ContainsChanges(psi))
+				continue;
+
+			QWORD msr = 0;
+			info.EncodePState(psi, msr);
+			const PStateInfo expected = info.DecodePState(i, msr);
+			const PStateInfo actual = table.GetPState(info, j, i);
+
+			if (psi.Multi >= 0 && actual.Multi != expected.Multi)
+			{
+				ReportMismatch(j, "multi of P", i, actual.Multi / info.multiScaleFactor, expected.Multi / info.multiScaleFactor);
+				result = false;
+			}
+			if (psi.VID >= 0 && actual.VID != expected.VID)
+			{
+				ReportMismatch(j, "voltage of P", i, info.DecodeVID(actual.VID), info.DecodeVID(expected.VID));
+				result = false;
+			}
+			if (psi.NBPState >= 0 && expected.NBPState >= 0 && actual.NBPState != expected.NBPState)
+			{
+				ReportMismatch(j, "NB P-state of P", i, actual.NBPState, expected.NBPState);
+				result = false;
+			}
+			if (psi.NBVID >= 0 && expected.NBVID >= 0 && actual.NBVID != expected.NBVID)
+			{
+				ReportMismatch(j, "NB voltage of P", i, info.DecodeVID(actual.NBVID), info.DecodeVID(expected.NBVID));
+				result = false;
+			}
+		}
+
+		if (_turbo >= 0 && info.IsBoostSupported && table.IsCPBDisabled(j) != (_turbo == 0))
+		{
+			cerr << "  CPU " << j << ": turbo is " << (_turbo == 0 ? "enabled" : "disabled") << endl;
+			result = false;
+		}
+
+		if (_c1e >= 0)
+		{
+			// the hardware rather than the shadow copy
+			SwitchTo(j);
+			if (GetBits(Rdmsr(0xc0010055), 28, 1) != (DWORD)_c1e)
+			{
+				cerr << "  CPU " << j << ": C1E is " << (_c1e == 0 ? "enabled" : "disabled") << endl;
+				result = false;
+			}
+		}
+
+		if (_pState >= 0)
+		{
+			const int currentPState = table.GetCurrentPState(j);
+			if (currentPState != _pState)
+			{
+				cerr << "  CPU " << j << ": current P-state is P" << currentPState << ", expected P" << _pState << endl;
+				result = false;
+			}
+		}
+	}
+
+	if (_c1e >= 0)
+		SwitchTo(-1);
+
+	return result;
+}